@@ -3,386 +3,353 @@
 
 #include <stdlib.h>
 #include <gtk/gtk.h> /* GUI, Gtk library */
-#include "mt64.h"    /* Pseudo-random number generation MT library (64 bit) */
-#include <math.h>    /* Math to transform random n from continuous to discrete */
+#include "rng.h"     /* Pseudo-random number generators */
+#include "simulation.h" /* GUI-free simulation core */
+#include "observables.h" /* Time series of the observables */
+#include "checkpoint.h"  /* Checkpoint and restart */
+#include "movie.h"       /* Time-lapse movies of the lattice */
+#include "render.h"      /* Lattice to RGBA pixels */
 #include <time.h>    /* Used to seed pseudo-random number generator */
+#include <math.h>
 #include <stdio.h>
 
-/* Lattice Size */
-#define X_SIZE 256
-#define Y_SIZE 256
-
-/* Defaulfs */
+/* Scale ranges for the model parameters (defaults live in simulation.h) */
 #define SAMPLE_RATE 100
-// default birth/colonization rate/probability and scale ranges
-#define BETA  0.003
+// Largest image of the lattice, in pixels a side: larger lattices are shown
+// downsampled, or a part of them zoomed in
+#define VIEW_SIZE 512
+// birth/colonization rate/probability scale ranges
 #define BETA_STEP 0.00001
 #define BETA_MIN 0.000000
 #define BETA_MAX 0.005
-// default mortality/extinction rate/probability and scale ranges
-#define DELTA  0.0001
+// mortality/extinction rate/probability scale ranges
 #define DELTA_STEP  0.00001
 #define DELTA_MIN 0.000000
 #define DELTA_MAX 0.005
-// default differentiation rate/probability and scale ranges
-#define ALPHA  0.1
+// differentiation rate/probability scale ranges
 #define ALPHA_STEP 0.01
 #define ALPHA_MIN  0.00
 #define ALPHA_MAX  1.0
-// strength of the coupling in positive terms (J =  -1*COUPLING kBT units)
-// we should have 1/2 if we do not want to douple count pairs
-// therefore
-// use a positive number!
-#define COUPLING (1)
-// default Temperature and scale ranges
-#define TEMPERATURE 2.269
+// Temperature scale ranges
 #define TEMPERATURE_STEP 0.0000001
 #define TEMPERATURE_MIN  0.0000001
 #define TEMPERATURE_MAX  15 
-// default interaction radius
-#define RADIUS 1
-// default initial condition chosen
-#define INIT 1
-
-
-
-/* Structure with the simulation data */
-struct simulation
-  {
-  int lattice_configuration[X_SIZE][Y_SIZE]; /* Store latice configuration */
-  gint run;                   /* Time handler tag */
-  gboolean running;           /* Are we running? */
-  int init_option;            /* Choice of initial condition*/
-  gboolean initialized;       /* Have we been initialized? */
-  int generation_time;        /* Generations simulated */
-  int Ising_neighboorhood;    /* Ising Neighboorhood: r=1 (NN) vs r=2 (NNN)*/
-  int occupancy;              /* Lattice occupancy */
-  int vacancy;                /* Lattice vacancy*/
-  int up;                     /* Number of spins in the up   (+1) state */
-  int down;                   /* Number of spins in the down (-1) state */
+
+
+struct simulation s;  // instance s of the structure to hold the simulation
+struct observables o; // stream of the observables (--observables FILE)
+struct movie m;       // time-lapse movie of the lattice (--movie FILE)
+
+/* Command line options of the stream of observables */
+static gchar *observables_path = NULL;
+static gchar *observables_format = NULL;
+static gint observables_interval = 1;
+/* Command line option of the lattice size */
+static gchar *lattice_size = NULL;
+/* Command line option of the checkpoint */
+static gchar *checkpoint_path = NULL;
+/* Command line options of the movie */
+static gchar *movie_path = NULL;
+static gint movie_interval = SAMPLE_RATE;
+static GOptionEntry command_line_options[] =
+  {
+  {"size", 's', 0, G_OPTION_ARG_STRING, &lattice_size,
+   "Lattice size, L or WxH (default 256)", "SIZE"},
+  {"observables", 'o', 0, G_OPTION_ARG_FILENAME, &observables_path,
+   "Stream the observables (counts, Ising energy, magnetization) to FILE", "FILE"},
+  {"format", 'O', 0, G_OPTION_ARG_STRING, &observables_format,
+   "Format of the stream: csv, ndjson or binary (default csv)", "NAME"},
+  {"every", 'e', 0, G_OPTION_ARG_INT, &observables_interval,
+   "Generations between two samples of the stream (default 1)", "N"},
+  {"checkpoint", 'c', 0, G_OPTION_ARG_FILENAME, &checkpoint_path,
+   "Resume the run saved in FILE if there is one, and save the run to FILE on exit", "FILE"},
+  {"movie", 'm', 0, G_OPTION_ARG_FILENAME, &movie_path,
+   "Record a time-lapse movie of the lattice to FILE (see cpim-movie)", "FILE"},
+  {"movie-every", 'f', 0, G_OPTION_ARG_INT, &movie_interval,
+   "Generations between two frames of the movie (default 100)", "N"},
+  {NULL}
+  };
+
+/* Values of the controls, handed to the simulation thread */
+struct parameters
+  {
+  double birth_rate, death_rate, differentiation_rate, T, J;
+  int Ising_neighboorhood;
+  int init_option;
+  int rng_backend;
+  unsigned long long seed;    /* Seed of the next REQUEST_SEED */
   int display_rate;           /* Display rate: to paint the lattice*/
-  double birth_rate;          /* Contact Process' birth */
-  double death_rate;          /* Contact Process' death */
-  double differentiation_rate;/* Differentiation into spin state */
-  double T;                   /* Ising's temperature */
-  double J;                   /* Ising's coupling: ferro (-kB) or anti-ferro (+kB) */
-  double lamda_rate;          /* Contact-Ising Monte Carlo biass*/
-} s ;        // instance s of the structure to hold the simulation
+  struct render_view view;    /* Part of the lattice on display */
+  };
+
+/* Requests of the controls to the simulation thread */
+#define REQUEST_INIT 1        /* init_lattice () */
+#define REQUEST_SEED 2        /* simulation_seed () with rng_backend and seed */
+#define REQUEST_PAINT 4       /* Paint the view again (it moved) */
+
+/* The simulation thread: while it runs, it alone touches s. The controls
+   edit the parameters under the lock and set changed; the thread reads
+   changed (atomically, without the lock) between generations, and then
+   applies the whole block at once. */
+struct worker
+  {
+  GThread *thread;
+  GMutex lock;
+  GCond wake;                 /* Signalled on every change */
+  struct parameters parameters; /* Under lock */
+  int requests;               /* REQUEST_ bits, under lock */
+  gint changed;               /* Parameters or requests changed (atomic) */
+  gint running;               /* Are we running? (atomic) */
+  gint initialized;           /* Has the lattice been initialized? (atomic) */
+  gint quit;                  /* Leave the thread (atomic) */
+} w;         // instance w of the structure to hold the simulation thread
+
+/* Structure with the display (Gtk) side of the app */
+struct display
+  {
+  struct render_frames frames;/* Frames painted by the simulation thread */
+  GdkPixbuf *pixbuf[3];       /* The frames, as pixbufs for the image */
+  struct render_view view;    /* Part of the lattice on display */
+  struct render_view grab;    /* The view when the drag started */
+  double grab_x, grab_y;      /* Where the drag started */
+  gint x_size, y_size;        /* Lattice on display, as the simulation thread last
+                                 applied it (atomic): the controls do not read s */
+} d ;        // instance d of the structure to hold the display state
 
 
 // Gdk Pixel Buffer functions Implemented at the end of document.
-void put_pixel(GdkPixbuf *pixbuf, int x, int y, guchar red, guchar green, guchar blue, guchar alpha);
 static void paint_a_background (gpointer data);
-static void paint_lattice (gpointer data);
-
-
-// Other Funtions
-
-double local_energy (int x, int y)
-	{
-  // Energy of site at coordinate (x,y)
-  double energy; //in kB*T units
-	int up = 0;   
-	int down = 0; 
-	if (s.Ising_neighboorhood == 1)  // Nearest Neighboorhood (NN) has 4 sites
-    	{ 
-      // we check the South (S) neighboor (#1)
-      if (s.lattice_configuration[x][(int)((Y_SIZE + y+1)%Y_SIZE)] == 1){up++;}
-    	 else if (s.lattice_configuration[x][(int)((Y_SIZE + y+1)%Y_SIZE)] == -1){down++;}
-    	// we check the North (N) neighboor (#2)
-      if (s.lattice_configuration[x][(int)((Y_SIZE + y-1)%Y_SIZE)] == 1){up++;}
-    	 else if (s.lattice_configuration[x][(int)((Y_SIZE + y-1)%Y_SIZE)] == -1){down++;}
-    	// we check the West (W) neighboor  (#3)
-      if (s.lattice_configuration[(int)((X_SIZE + x-1)%X_SIZE)][y] == 1){up++;}
-    	 else if (s.lattice_configuration[(int)((X_SIZE + x-1)%X_SIZE)][y] == -1){down++;}
-    	// we check the East (E) neighboor  (#4)
-      if (s.lattice_configuration[(int)((X_SIZE + x+1)%X_SIZE)][y] == 1){up++;}
-    	 else if (s.lattice_configuration[(int)((X_SIZE + x+1)%X_SIZE)][y] == -1){down++;}
-    	}
-    else if (s.Ising_neighboorhood == 2) //Next Nearest Neighboorhood (NNN) has 12 sites
-        { 
-        // we check the South (S) neighboor (#1)
-        if (s.lattice_configuration[x][(int)((Y_SIZE + y+1)%Y_SIZE)] == 1){up++;}
-    	   else if (s.lattice_configuration[x][(int)((Y_SIZE + y+1)%Y_SIZE)] == -1){down++;}
-    	  // we check the North (N) neighboor (#2)
-        if (s.lattice_configuration[x][(int)((Y_SIZE + y-1)%Y_SIZE)] == 1){up++;}
-    	   else if (s.lattice_configuration[x][(int)((Y_SIZE + y-1)%Y_SIZE)] == -1){down++;}
-    	  // we check the West (W) neighboor (#3)
-        if (s.lattice_configuration[(int)((X_SIZE + x-1)%X_SIZE)][y] == 1){up++;}
-    	   else if (s.lattice_configuration[(int)((X_SIZE + x-1)%X_SIZE)][y] == -1){down++;}
-    	  // we check the East (E) neighboor (#4)
-        if (s.lattice_configuration[(int)((X_SIZE + x+1)%X_SIZE)][y] == 1){up++;}
-    	   else if (s.lattice_configuration[(int)((X_SIZE + x+1)%X_SIZE)][y] == -1){down++;}
-        // we check the South-South (SS) neighboor (#5)
-        if (s.lattice_configuration[x][(int)((Y_SIZE + y+2)%Y_SIZE)] == 1){up++;}
-    	   else if (s.lattice_configuration[x][(int)((Y_SIZE + y+2)%Y_SIZE)] == -1){down++;}
-    	  // we check the North-North (NN) neighboor (#6)
-        if (s.lattice_configuration[x][(int)((Y_SIZE + y-2)%Y_SIZE)] == 1){up++;}
-    	   else if (s.lattice_configuration[x][(int)((Y_SIZE + y-2)%Y_SIZE)] == -1){down++;}
-    	  // we check the West-West (WW) neighboor   (#7)
-        if (s.lattice_configuration[(int)((X_SIZE + x-2)%X_SIZE)][y] == 1){up++;}
-    	   else if (s.lattice_configuration[(int)((X_SIZE + x-2)%X_SIZE)][y] == -1){down++;}
-    	  // we chack the East-East (EE) neighboor   (#8)
-        if (s.lattice_configuration[(int)((X_SIZE + x+2)%X_SIZE)][y] == 1){up++;}
-    	   else if (s.lattice_configuration[(int)((X_SIZE + x+2)%X_SIZE)][y] == -1){down++;}
-    	  // we check the South-West (SW) neighboor  (#9)
-        if (s.lattice_configuration[(int)((X_SIZE + x-1)%X_SIZE)][(int)((Y_SIZE + y+1)%Y_SIZE)] == 1){up++;}
-    	   else if (s.lattice_configuration[(int)((X_SIZE + x-1)%X_SIZE)][(int)((Y_SIZE + y+1)%Y_SIZE)] == -1){down++;}
-    	  // we check the North-East (NE) neighboor  (#10)
-        if (s.lattice_configuration[(int)((X_SIZE + x+1)%X_SIZE)][(int)((Y_SIZE + y-1)%Y_SIZE)] == 1){up++;}
-    	   else if (s.lattice_configuration[(int)((X_SIZE + x+1)%X_SIZE)][(int)((Y_SIZE + y-1)%Y_SIZE)] == -1){down++;}
-    	  // we check the North-West (NW) neighboor  (#11)
-        if (s.lattice_configuration[(int)((X_SIZE + x-1)%X_SIZE)][(int)((Y_SIZE + y-1)%Y_SIZE)] == 1){up++;}
-    	   else if (s.lattice_configuration[(int)((X_SIZE + x-1)%X_SIZE)][(int)((Y_SIZE + y-1)%Y_SIZE)] == -1){down++;}
-       	// we check the South-East (SE) neighboor  (#12)
-        if (s.lattice_configuration[(int)((X_SIZE + x+1)%X_SIZE)][(int)((Y_SIZE + y+1)%Y_SIZE)] == 1){up++;}
-    	   else if (s.lattice_configuration[(int)((X_SIZE + x+1)%X_SIZE)][(int)((Y_SIZE + y+1)%Y_SIZE)] == -1){down++;}
-    	  }
-	energy =  s.J * (double) (s.lattice_configuration[x][y] * (up-down));
-  return energy;
-	}
-
-
-
-/* Update function */
-int update_lattice (gpointer data)
-  {
-  // int random_neighbor;
-  int random_neighbor_state, random_neighbor;
-  double random_spin;
-  // Energies
-  double spin_energy, spin_energy_diff;
-  // Probability of reactions
-  double transition_probability;
-  int random_x_coor, random_y_coor;
-  // For the Contact Process we always consider NN interactions
-  for (int site = 0; site < (int) (Y_SIZE*X_SIZE); site++)
+
+
+
+/* Apply the controls to the simulation (simulation thread) */
+static void apply_parameters (const struct parameters *p, int requests)
+  {
+  s.birth_rate = p->birth_rate;
+  s.death_rate = p->death_rate;
+  s.differentiation_rate = p->differentiation_rate;
+  if (s.T != p->T || s.J != p->J)
+    {
+    s.T = p->T;
+    s.J = p->J;
+    build_boltzmann_table (&s);
+    }
+  s.Ising_neighboorhood = p->Ising_neighboorhood;
+  s.init_option = p->init_option;
+  if (requests & REQUEST_SEED)
+    {
+    s.rng_backend = p->rng_backend;
+    simulation_seed (&s, p->seed);
+    }
+  if (requests & REQUEST_INIT)
     {
-    /* Pick a random focal site */
-    random_x_coor = (int) floor (genrand64_real1 ()* X_SIZE);
-    random_y_coor = (int) floor (genrand64_real1 ()* Y_SIZE);
-    switch (s.lattice_configuration[random_x_coor][random_y_coor])
+    init_lattice (&s);
+    g_atomic_int_set (&d.x_size, s.x_size);
+    g_atomic_int_set (&d.y_size, s.y_size);
+    observables_restart (&o);
+    observables_sample (&o, &s);
+    movie_restart (&m);
+    movie_frame (&m, &s);
+    render_frames_publish (&d.frames, &s, &p->view);
+    g_atomic_int_set (&w.initialized, TRUE);
+    g_print ("Lattice initialized\n");
+    }
+  else if ((requests & REQUEST_PAINT) && g_atomic_int_get (&w.initialized))
+    render_frames_publish (&d.frames, &s, &p->view);
+  }
+
+
+/* Simulation thread: advance one generation after the other while running,
+   publish a frame every display_rate, and apply the controls in between */
+static gpointer simulation_thread (gpointer data)
+  {
+  struct parameters p;
+  int requests;
+  for (;;)
+    {
+    if (g_atomic_int_get (&w.changed) || !g_atomic_int_get (&w.running))
       {
-      case 0: /* Site is empty */
-      /* Chose a random neighbor from the num_neighbors posible ones */
-      random_neighbor = (int) floor (genrand64_real3()* 4);
-			switch(random_neighbor)
-					{
-					case 0: // South
-							random_neighbor_state = s.lattice_configuration[random_x_coor][(int) ((Y_SIZE + random_y_coor-1)%Y_SIZE)]; 
-							break;
-					case 1: // North
-							random_neighbor_state =	s.lattice_configuration[random_x_coor][(int) ((Y_SIZE + random_y_coor+1)%Y_SIZE)]; 
-							break;
-					case 2: // East
-							random_neighbor_state =	s.lattice_configuration[(int) ((X_SIZE + random_x_coor-1)%X_SIZE)][random_y_coor];
-							break;
-					case 3: // West
-							random_neighbor_state =	s.lattice_configuration[(int) ((X_SIZE + random_x_coor+1)%X_SIZE)][random_y_coor];
-							break;
-					}
-        /* If its random neighbor is occupied: put a copy at the focal site
-           with probability brith_rate * dt */
-        if (genrand64_real2 () < s.birth_rate)
-           {
-           switch(random_neighbor_state)
-             {
-              case 2: 
-                s.lattice_configuration[random_x_coor][random_y_coor] = 2;
-                s.occupancy ++; s.vacancy --;
-               break;
-              case 1: 
-                s.lattice_configuration[random_x_coor][random_y_coor] = 1;
-                s.occupancy ++; s.vacancy --;
-                s.up ++;
-               break;
-              case -1:
-                s.lattice_configuration[random_x_coor][random_y_coor] = -1;
-                s.occupancy ++;s.vacancy --;
-                s.down ++;
-               break; 
-              case 0:
-                s.lattice_configuration[random_x_coor][random_y_coor] = 0;
-                break;
-             }
-          }
-        break; /* break case 0 */
-      case 2: /* Focal point is in the occupied, undifferentiated state */
-        // First we check if the site survives
-        // No need for Gillespie as cells are macroscopic compare to its 
-        // inner components which can undertake reactions only if the cell
-        // indeed exists
-        if (genrand64_real2 () < s.death_rate)
-                       {
-                        s.lattice_configuration[random_x_coor][random_y_coor] = 0;
-                        s.occupancy --; s.vacancy ++;
-                       }
-             else if (genrand64_real2 () < s.differentiation_rate)
-                      {
-                       /* Set an occupied site in the middle of the lattice */
-                       random_spin = (int) ((genrand64_int64 () % 2) * 2) - 1;
-                      if (random_spin == 1)
-                          {
-                           s.lattice_configuration[random_x_coor][random_y_coor] = random_spin;
-                           s.up ++;
-                           }
-                       else if (random_spin == -1)
-                           {
-                           s.lattice_configuration[random_x_coor][random_y_coor] = random_spin;
-                           s.down ++;
-                           }
-                      }
-        break;
-      case 1: /* Focal point is in the up (+1) state */
-        // We skip Gillespie because of separation of scales
-        spin_energy = local_energy (random_x_coor, random_y_coor);
-        spin_energy_diff = -(2) * spin_energy;
-        transition_probability = exp (-spin_energy_diff/s.T);
-        if (genrand64_real2 () < s.death_rate)
-                        {
-                        s.lattice_configuration[random_x_coor][random_y_coor] = 0;
-                        s.occupancy --; s.vacancy ++;
-                        s.up --;
-                        }
-                else if (spin_energy_diff < 0 ||
-                                              genrand64_real2 () < transition_probability)
-                        {
-                        s.lattice_configuration[random_x_coor][random_y_coor] = -1;
-                        s.up --;
-                        s.down ++;
-                        }
-        break;
-      case -1: /* Focal point is in the down (-1) state */
-        // We skip Gillespie because of separation of scales
-        spin_energy = local_energy (random_x_coor, random_y_coor);
-        spin_energy_diff = -(2) * spin_energy;
-        transition_probability = exp (-spin_energy_diff/s.T);
-        if (genrand64_real2 () < s.death_rate)
-                        {
-                        s.lattice_configuration[random_x_coor][random_y_coor] = 0;
-                        s.occupancy --; s.vacancy ++;
-                        s.down --;
-                        }
-                else if (spin_energy_diff < 0 ||
-                                              genrand64_real2 () < transition_probability)
-                        {
-                        s.lattice_configuration[random_x_coor][random_y_coor] = 1;
-                        s.up ++;
-                        s.down --;
-                        }
+      g_mutex_lock (&w.lock);
+      while (!g_atomic_int_get (&w.changed) && !g_atomic_int_get (&w.running))
+        g_cond_wait (&w.wake, &w.lock);
+      p = w.parameters;
+      requests = w.requests;
+      w.requests = 0;
+      g_atomic_int_set (&w.changed, FALSE);
+      g_mutex_unlock (&w.lock);
+      if (g_atomic_int_get (&w.quit))
         break;
+      apply_parameters (&p, requests);
+      continue;
       }
-    }
-  s.generation_time ++;
-  if(s.generation_time%s.display_rate == 0)
+    // Out of memory: pause (start resumes, with the tables built again)
+    if (update_lattice (&s) != 0)
+      {
+      g_print ("Out of memory in generation %d: paused\n", s.generation_time + 1);
+      g_atomic_int_set (&w.running, FALSE);
+      continue;
+      }
+    observables_sample (&o, &s);
+    movie_frame (&m, &s);
+    if (s.generation_time % p.display_rate == 0)
       {
-      paint_lattice (data);
+      render_frames_publish (&d.frames, &s, &p.view);
       g_print ("Gen: %d \t Vacancy: %f \t Occupancy: %f \t Up: %f \t Down: %f\n",
-           s.generation_time, (double) s.vacancy / (double) (Y_SIZE*X_SIZE), (double) s.occupancy/(double) (Y_SIZE*X_SIZE), (double) s.up/(double) (s.occupancy), (double) s.down/(double) s.occupancy);
-     }
-  return 0;
-}
+           s.generation_time, (double) s.vacancy / (double) s.n_sites, (double) s.occupancy/(double) s.n_sites, (double) s.up/(double) (s.occupancy), (double) s.down/(double) s.occupancy);
+      }
+    }
+  return NULL;
+  }
 
 
+/* Lock the parameters of the simulation thread to edit them */
+static struct parameters *edit_parameters (void)
+  {
+  g_mutex_lock (&w.lock);
+  return &w.parameters;
+  }
 
-/* Time handler to connect update function to the gtk loop */
-gboolean time_handler (gpointer data)
-   { 
-    update_lattice (data);
-    return TRUE;
-    }
+/* Hand the edited parameters (and requests) to the simulation thread */
+static void post_parameters (int requests)
+  {
+  w.requests |= requests;
+  g_atomic_int_set (&w.changed, TRUE);
+  g_cond_signal (&w.wake);
+  g_mutex_unlock (&w.lock);
+  }
 
+/* Start or stop the generations of the simulation thread */
+static void set_running (gboolean running)
+  {
+  g_mutex_lock (&w.lock);
+  g_atomic_int_set (&w.running, running);
+  g_cond_signal (&w.wake);
+  g_mutex_unlock (&w.lock);
+  }
 
-/* Callback to initialize lattice*/
-static void init_lattice (GtkWidget *widget, gpointer data)
+
+/* Frame clock callback (once per screen refresh): show the last frame the
+   simulation thread published, if there is a new one */
+static gboolean on_frame_clock (GtkWidget *image, GdkFrameClock *clock, gpointer data)
   {
-  int random_spin;
-  int x,y;
-  /* Fill the lattice with 0s (unoccupied state) */
-  for (x = 0; x < X_SIZE; x++)
+  struct render_frame *frame = render_frames_take (&d.frames);
+  if (frame != NULL)
+    gtk_image_set_from_pixbuf (GTK_IMAGE (image), d.pixbuf[frame - d.frames.frame]);
+  return G_SOURCE_CONTINUE;
+  }
+
+
+
+/* Zoom of the whole lattice: no need to zoom out further */
+static int fit_zoom (void)
+  {
+  struct render_view fit;
+  render_view_fit (&fit, g_atomic_int_get (&d.x_size), g_atomic_int_get (&d.y_size),
+                   d.frames.width, d.frames.height);
+  return fit.zoom;
+  }
+
+/* Show the view (clamped to the lattice) */
+static void set_view (struct render_view view)
+  {
+  if (view.zoom < fit_zoom ())
+    view.zoom = fit_zoom ();
+  render_view_clamp (&view, g_atomic_int_get (&d.x_size), g_atomic_int_get (&d.y_size),
+                     d.frames.width, d.frames.height);
+  if (view.x == d.view.x && view.y == d.view.y && view.zoom == d.view.zoom)
+    return;
+  d.view = view;
+  edit_parameters ()->view = view;
+  post_parameters (REQUEST_PAINT);
+  }
+
+/* Sites from the corner of the view to a pixel at a zoom */
+static int view_sites (double pixels, int zoom)
+  {
+  return (int) floor ((zoom >= 0) ? pixels / (double) (1 << zoom) : pixels * (double) (1 << -zoom));
+  }
+
+/* Pixel of the image under a point of the event box around it */
+static void image_point (GtkWidget *box, double *x, double *y)
+  {
+  GtkAllocation allocation;
+  gtk_widget_get_allocation (box, &allocation);
+  *x -= (allocation.width - d.frames.width) / 2;
+  *y -= (allocation.height - d.frames.height) / 2;
+  }
+
+/* Mouse wheel on the lattice: zoom in or out, keeping the site under the
+   pointer in place */
+static gboolean on_lattice_scroll (GtkWidget *box, GdkEventScroll *event, gpointer data)
+  {
+  struct render_view view = d.view;
+  double x = event->x, y = event->y;
+  int step;
+  if (event->direction == GDK_SCROLL_UP)
+    step = 1;
+  else if (event->direction == GDK_SCROLL_DOWN)
+    step = -1;
+  else if (event->direction == GDK_SCROLL_SMOOTH && event->delta_y != 0)
+    step = (event->delta_y < 0) ? 1 : -1;
+  else
+    return FALSE;
+  view.zoom += step;
+  if (view.zoom > RENDER_MAX_ZOOM || view.zoom < fit_zoom ())
+    return TRUE;
+  image_point (box, &x, &y);
+  view.x = d.view.x + view_sites (x, d.view.zoom) - view_sites (x, view.zoom);
+  view.y = d.view.y + view_sites (y, d.view.zoom) - view_sites (y, view.zoom);
+  set_view (view);
+  return TRUE;
+  }
+
+/* Mouse button on the lattice: the left one starts a drag, the right one
+   shows the whole lattice again */
+static gboolean on_lattice_button (GtkWidget *box, GdkEventButton *event, gpointer data)
+  {
+  if (event->button == 1)
     {
-    for (y = 0; y < Y_SIZE; y++)
-      {
-      s.lattice_configuration[x][y]= 0;
-      }
+    d.grab = d.view;
+    d.grab_x = event->x;
+    d.grab_y = event->y;
     }
-  s.occupancy = 0;
-  s.up =  0;
-  s.down = 0;
-  s.vacancy = (int) X_SIZE*Y_SIZE;
-  switch(s.init_option)
+  else if (event->button == 3)
     {
-      case 1:
-            /* Set an occupied site in the middle of the lattice */
-            random_spin = (int) ((genrand64_int64 () % 2) * 2) - 1;
-            if (random_spin == 1)
-              {
-              s.lattice_configuration[(int) X_SIZE/2][(int) Y_SIZE/2] = random_spin;
-              s.up ++; s.vacancy--; s.occupancy++;
-              }
-            else if (random_spin == -1)
-              {
-              s.lattice_configuration[(int) X_SIZE/2][(int) Y_SIZE/2] = random_spin;
-              s.down ++; s.vacancy --; s.occupancy++;
-              }
-            break;
-      case 2:
-            /* Set an undifferentiated site in the middle of the lattice*/
-              s.lattice_configuration[(int) X_SIZE/2][(int) Y_SIZE/2] = 2;
-              s.vacancy--; s.occupancy++;
-
-            break;
-      case 3:
-            // Set a small (r=2) cluster with undifferentiated sites in the middle of the lattice
-           for (x = (int) X_SIZE/2 - 2 ; x < (int) X_SIZE/2 + 2; x++)
-                                for (y = (int) X_SIZE/2 - 2; y < (int) X_SIZE/2 + 2; y++)
-                                        {
-                                        s.lattice_configuration[x][y]=2;
-                                        s.occupancy ++; s.vacancy --;
-                                        }
-                        break;
-            break;
-      case 4:
-            for (x = (int) X_SIZE/2 - 2 ; x < (int) X_SIZE/2 + 2; x++)
-                                for (y = (int) X_SIZE/2 - 2; y < (int) X_SIZE/2 + 2; y++)
-                                    {
-                                      random_spin = (int) ((genrand64_int64 () % 2) * 2) - 1;
-                                      if (random_spin == 1)
-                                        {
-                                        s.lattice_configuration[x][y] = random_spin;
-                                        s.up ++; s.vacancy--; s.occupancy++;
-                                        }
-                                        else if (random_spin == -1)
-                                           {
-                                           s.lattice_configuration[x][y] = random_spin;
-                                           s.down ++; s.vacancy --; s.occupancy++;
-                                           }
-                                    }
-         
-            break;
-      case 5:
-            // Se a lattice fully occupied with undufferenciated particels
-            for (x = 0; x < (int) X_SIZE; x++)
-               for (y = 0; y < (int) Y_SIZE; y++)
-                    {
-                    s.lattice_configuration[x][y]=2;
-                    s.occupancy ++; s.vacancy --;
-                    }
-            break;
+    struct render_view view;
+    render_view_fit (&view, g_atomic_int_get (&d.x_size), g_atomic_int_get (&d.y_size),
+                     d.frames.width, d.frames.height);
+    set_view (view);
     }
-   s.initialized = TRUE;
-   s.generation_time = 0;
-   paint_lattice (data);
-   g_print ("Lattice initialized\n");
+  return TRUE;
+  }
+
+/* Pointer moved on the lattice: pan while the left button is down */
+static gboolean on_lattice_motion (GtkWidget *box, GdkEventMotion *event, gpointer data)
+  {
+  struct render_view view = d.grab;
+  if (!(event->state & GDK_BUTTON1_MASK))
+    return FALSE;
+  view.x -= view_sites (event->x - d.grab_x, view.zoom);
+  view.y -= view_sites (event->y - d.grab_y, view.zoom);
+  set_view (view);
+  return TRUE;
+  }
+
+
+
+/* Callback to initialize lattice*/
+static void on_button_init_lattice (GtkWidget *widget, gpointer data)
+  {
+  edit_parameters ();
+  post_parameters (REQUEST_INIT);
   }
 
 // Stop simulation control
 static void stop_simulation (gpointer data)
   {
-  if (s.running)
+  if (g_atomic_int_get (&w.running))
     {
-    g_source_remove (s.run);
-    s.running = FALSE;
+    set_running (FALSE);
     g_print ("Simulation stopped\n");
     }
   }
@@ -411,10 +378,9 @@ static void on_button_show_about(GtkWidget *widget, gpointer data)
 /* Callback to start simulation */
 static void on_button_start_simulation (GtkWidget *button, gpointer data)
   {
-  if(!s.running && s.initialized)
+  if(!g_atomic_int_get (&w.running) && g_atomic_int_get (&w.initialized))
     {
-    s.run = g_idle_add ((GSourceFunc) time_handler, GTK_IMAGE (data));
-    s.running = TRUE;
+    set_running (TRUE);
     g_print ("Simulation started\n");
     }
   }
@@ -434,31 +400,36 @@ static void on_button_stop_simulation (GtkWidget *button, gpointer data)
 static void on_radio_initial_condition_1 (GtkWidget *button, gpointer data)
   {
   char *id_radio = (char*)data;g_print("%s\n", id_radio);
-  s.init_option = 1;
+  edit_parameters ()->init_option = 1;
+  post_parameters (0);
   }
 // Init 2
 static void on_radio_initial_condition_2 (GtkWidget *button, gpointer data)
   {
   char *id_radio = (char*)data;g_print("%s\n", id_radio);
-  s.init_option = 2;
+  edit_parameters ()->init_option = 2;
+  post_parameters (0);
   }
 // Init 3
 static void on_radio_initial_condition_3 (GtkWidget *button, gpointer data)
   {
   char *id_radio = (char*)data;g_print("%s\n", id_radio);
-  s.init_option = 3;
+  edit_parameters ()->init_option = 3;
+  post_parameters (0);
   }
 // Init 4
 static void on_radio_initial_condition_4 (GtkWidget *button, gpointer data)
   {
   char *id_radio = (char*)data;g_print("%s\n", id_radio);
-  s.init_option = 4;
+  edit_parameters ()->init_option = 4;
+  post_parameters (0);
   }
 // Init 5
 static void on_radio_initial_condition_5 (GtkWidget *button, gpointer data)
   {
   char *id_radio = (char*)data;g_print("%s\n", id_radio);
-  s.init_option = 5;
+  edit_parameters ()->init_option = 5;
+  post_parameters (0);
   }
 
 /* Callback to change Ising NN (r=1) vs NNN (r=2) conditions -- dirty */
@@ -467,13 +438,15 @@ static void on_radio_initial_condition_5 (GtkWidget *button, gpointer data)
 static void on_radio_NN (GtkWidget *button, gpointer data)
   {
   char *id_radio = (char*)data;g_print("%s\n", id_radio);
-  s.Ising_neighboorhood = 1;
+  edit_parameters ()->Ising_neighboorhood = 1;
+  post_parameters (0);
   }
 // NNN; r =2
 static void on_radio_NNN (GtkWidget *button, gpointer data)
   {
   char *id_radio = (char*)data;g_print("%s\n", id_radio);
-  s.Ising_neighboorhood = 2;
+  edit_parameters ()->Ising_neighboorhood = 2;
+  post_parameters (0);
   }
 
 /* Callback to change Ising J = -kB (ferro) vs J = +kB (anti-ferro) -- dirty */
@@ -482,21 +455,35 @@ static void on_radio_NNN (GtkWidget *button, gpointer data)
 static void on_radio_ferro (GtkWidget *button, gpointer data)
   {
     char *id_radio = (char*)data;g_print("%s\n", id_radio);
-    s.J = -1 * (float) COUPLING;
+    edit_parameters ()->J = -1 * (float) COUPLING;
+    post_parameters (0);
     }
 // anti Ferro:  J = +kB
 static void on_radio_anti_ferro(GtkWidget *button, gpointer data)
   {
     char *id_radio = (char*)data;g_print("%s\n", id_radio);
-    s.J =  1 * (float) COUPLING;
+    edit_parameters ()->J =  1 * (float) COUPLING;
+    post_parameters (0);
     }
 
 
+/* Callback to choose the random number generator: seeded again from the clock */
+static void on_radio_rng (GtkWidget *button, gpointer data)
+  {
+  struct parameters *p = edit_parameters ();
+  p->rng_backend = GPOINTER_TO_INT (data);
+  p->seed = (unsigned long long) time (NULL);
+  post_parameters (REQUEST_SEED);
+  g_print ("%s random number generator selected\n", rng_name (GPOINTER_TO_INT (data)));
+  }
+
+
 /*  Callback to respond Gtk scale slide move event */
 static void birth_rate_scale_moved (GtkRange *range, gpointer user_data)
   {
   gdouble pos = gtk_range_get_value (range);
-  s.birth_rate = (float) pos;
+  edit_parameters ()->birth_rate = (float) pos;
+  post_parameters (0);
   }
 
 
@@ -504,7 +491,8 @@ static void birth_rate_scale_moved (GtkRange *range, gpointer user_data)
 static void differenciation_rate_scale_moved (GtkRange *range, gpointer user_data)
   {
   gdouble pos = gtk_range_get_value (range);
-  s.differentiation_rate = (float) pos;;
+  edit_parameters ()->differentiation_rate = (float) pos;
+  post_parameters (0);
   }
 
 
@@ -512,7 +500,8 @@ static void differenciation_rate_scale_moved (GtkRange *range, gpointer user_dat
 static void death_rate_scale_moved (GtkRange *range, gpointer user_data)
   {
   gdouble pos = gtk_range_get_value (range);
-  s.death_rate = (float) pos;
+  edit_parameters ()->death_rate = (float) pos;
+  post_parameters (0);
   }
 
 
@@ -520,7 +509,8 @@ static void death_rate_scale_moved (GtkRange *range, gpointer user_data)
 static void temperature_scale_moved (GtkRange *range, gpointer user_data)
   {
   gdouble pos = gtk_range_get_value (range);
-  s.T = (float) pos;
+  edit_parameters ()->T = (float) pos;
+  post_parameters (0);
   }
 
 
@@ -528,39 +518,100 @@ static void temperature_scale_moved (GtkRange *range, gpointer user_data)
 static void display_rate_scale_moved (GtkRange *range, gpointer user_data)
   {
   gdouble pos = gtk_range_get_value (range);
-  s.display_rate = (int) pos;
+  edit_parameters ()->display_rate = (int) pos;
+  post_parameters (0);
   }
 
 
 static void initialize_simulation(void)
 {
-  /* Initialize Mersenne Twister algorithm for random number genration */
   unsigned int seed = (unsigned int) time (NULL);
-  init_genrand64 (seed);
+  int x_size = X_SIZE, y_size = Y_SIZE;
 
   /* Set default parameters of the simulation */
-  //initial condition option
-   s.init_option = (int) INIT;
-
-  // Contact Process
-  s.birth_rate = (double) BETA;
-  s.death_rate = (double) DELTA;
-
-  // Cell differenciation
-  s.differentiation_rate = (double) ALPHA;
-
-  // Ising Model
-  // interaction radius
-  s.Ising_neighboorhood = (int) RADIUS;
-  // Temperature
-  s.T = (double) TEMPERATURE;
-  // Spin coupling
-  s.J = -1 * (double) COUPLING;
-  /* Set simulation flags */
-  s.running = FALSE;
-  s.initialized = FALSE;
+  simulation_defaults (&s);
+  /* Lattice size: L (square) or WxH */
+  if (lattice_size != NULL)
+    switch (sscanf (lattice_size, "%dx%d", &x_size, &y_size))
+      {
+      case 1: y_size = x_size; break;
+      case 2: break;
+      default:
+        g_print ("The lattice size must be L or WxH, not %s\n", lattice_size);
+        exit (EXIT_FAILURE);
+      }
+  /* Resume the run of the checkpoint, if there is one */
+  if (checkpoint_path != NULL && g_file_test (checkpoint_path, G_FILE_TEST_EXISTS))
+    {
+    // The lattice of the checkpoint, unless a size was asked for
+    if (checkpoint_load (&s, checkpoint_path) != 0
+        || (lattice_size != NULL && (s.x_size != x_size || s.y_size != y_size)))
+      {
+      g_print ("%s is not a checkpoint of a %dx%d lattice of this version and build\n",
+               checkpoint_path, x_size, y_size);
+      exit (EXIT_FAILURE);
+      }
+    g_print ("Resumed %s at generation %d\n", checkpoint_path, s.generation_time);
+    }
+  else
+    {
+    /* Initialize Mersenne Twister algorithm for random number genration */
+    simulation_seed (&s, seed);
+    if (simulation_alloc (&s, x_size, y_size, BOUNDARY_PERIODIC) != 0)
+      {
+      g_print ("Could not allocate a %dx%d lattice (sides from %d)\n", x_size, y_size, MIN_SIZE);
+      exit (EXIT_FAILURE);
+      }
+    }
+  /* Stream of the observables, written by its own thread */
+  if (observables_path != NULL)
+    {
+    int format = observables_format ? observables_format_from_name (observables_format) : OBSERVABLES_CSV;
+    if (format < 0 || observables_open (&o, observables_path, &s, format, observables_interval) != 0)
+      {
+      g_print ("Could not stream the observables to %s (format csv, ndjson or binary, every >= 1)\n",
+               observables_path);
+      exit (EXIT_FAILURE);
+      }
+    }
+  /* Time-lapse movie, compressed and written by its own thread */
+  if (movie_path != NULL && movie_open (&m, movie_path, &s, movie_interval, MOVIE_KEYFRAME) != 0)
+    {
+    g_print ("Could not record the movie to %s (movie-every >= 1)\n", movie_path);
+    exit (EXIT_FAILURE);
+    }
+  /* Controls of the simulation thread, as the simulation starts */
+  g_mutex_init (&w.lock);
+  g_cond_init (&w.wake);
+  w.parameters.birth_rate = s.birth_rate;
+  w.parameters.death_rate = s.death_rate;
+  w.parameters.differentiation_rate = s.differentiation_rate;
+  w.parameters.T = s.T;
+  w.parameters.J = s.J;
+  w.parameters.Ising_neighboorhood = s.Ising_neighboorhood;
+  w.parameters.init_option = s.init_option;
+  w.parameters.rng_backend = s.rng_backend;
   // Display rate to paint the lattice
-  s.display_rate = (int) SAMPLE_RATE;
+  w.parameters.display_rate = (int) SAMPLE_RATE;
+  // The image: the lattice, up to VIEW_SIZE pixels a side
+  if (render_frames_alloc (&d.frames, MIN (s.x_size, VIEW_SIZE), MIN (s.y_size, VIEW_SIZE)) != 0)
+    {
+    g_print ("Could not allocate the frames of a %dx%d lattice\n", s.x_size, s.y_size);
+    exit (EXIT_FAILURE);
+    }
+  d.x_size = s.x_size;
+  d.y_size = s.y_size;
+  render_view_fit (&d.view, d.x_size, d.y_size, d.frames.width, d.frames.height);
+  w.parameters.view = d.view;
+  // Views of 2^BLOCK_COUNT_FIRST sites per pixel side and more are painted
+  // from the block counts, kept by the simulation as sites change, for the
+  // levels down to the whole lattice (the view never zooms out further)
+  s.block_count_last = (d.view.zoom <= -BLOCK_COUNT_FIRST) ? -d.view.zoom : 0;
+  prepare_block_counts (&s);
+  /* Set simulation flags */
+  w.running = FALSE;
+  w.initialized = s.initialized;
+  w.changed = TRUE;
 }
 
 
@@ -570,8 +621,7 @@ static void activate (GtkApplication *app, gpointer user_data)
   initialize_simulation();
   // This function should only contain Gtk stuff
   /* General Gtk widgets for the Window packing */
-  GtkWidget *window, *grid, *image_lattice, *label, *frame, *notebook, *box, *scale, *radio, *separator;
-  GdkPixbuf *pixbuf;
+  GtkWidget *window, *grid, *image_lattice, *lattice_box, *label, *frame, *notebook, *box, *scale, *radio, *separator;
 
   // Parameters Section
   /* Create a Gtk Notebook to hold pages of parameters */
@@ -631,8 +681,8 @@ static void activate (GtkApplication *app, gpointer user_data)
   // BIRTH
   // scale bar to set birth rate
   scale = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL,(gdouble) BETA_MIN, (gdouble) BETA_MAX, (gdouble) BETA_STEP);
-  // we set it to its default value
-  gtk_range_set_value (GTK_RANGE(scale), (gfloat) BETA);
+  // we set it to its current value (default, or that of the checkpoint)
+  gtk_range_set_value (GTK_RANGE(scale), (gfloat) s.birth_rate);
   g_signal_connect (scale, "value-changed", G_CALLBACK (birth_rate_scale_moved), NULL);
   // we pack it in a Frame
   frame = gtk_frame_new("Birth rate");
@@ -642,8 +692,8 @@ static void activate (GtkApplication *app, gpointer user_data)
   // DEATH
   // scale bar to set death rate
   scale = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, (gdouble) DELTA_MIN, (gdouble) DELTA_MAX, (gdouble) DELTA_STEP);
-  // we set it to its default value
-  gtk_range_set_value (GTK_RANGE(scale), (gfloat) DELTA);
+  // we set it to its current value (default, or that of the checkpoint)
+  gtk_range_set_value (GTK_RANGE(scale), (gfloat) s.death_rate);
   g_signal_connect (scale, "value-changed", G_CALLBACK (death_rate_scale_moved), NULL);
   // we pack it in a Frame
   frame = gtk_frame_new ("Death rate");
@@ -653,8 +703,8 @@ static void activate (GtkApplication *app, gpointer user_data)
   // ALPHA
   // scale bar to set the cell differenciation rate
   scale = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL,(gdouble) ALPHA_MIN, (gdouble) ALPHA_MAX, (gdouble) ALPHA_STEP);
-  // we set it to its default value
-  gtk_range_set_value (GTK_RANGE(scale), (gfloat) ALPHA);
+  // we set it to its current value (default, or that of the checkpoint)
+  gtk_range_set_value (GTK_RANGE(scale), (gfloat) s.differentiation_rate);
   g_signal_connect (scale, "value-changed", G_CALLBACK (differenciation_rate_scale_moved), NULL);
   // we pack it in a Frame
   frame = gtk_frame_new ("Differenciation rate");
@@ -673,8 +723,8 @@ static void activate (GtkApplication *app, gpointer user_data)
   // TEMPERATURE
   // make a scale bar to set Temperature
   scale = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, (gdouble) TEMPERATURE_MIN, (gdouble) TEMPERATURE_MAX, (gdouble) TEMPERATURE_STEP);
-  // we set it to its default value
-  gtk_range_set_value (GTK_RANGE(scale), (gfloat) TEMPERATURE);
+  // we set it to its current value (default, or that of the checkpoint)
+  gtk_range_set_value (GTK_RANGE(scale), (gfloat) s.T);
   g_signal_connect (scale, "value-changed", G_CALLBACK (temperature_scale_moved), NULL);
   frame =  gtk_frame_new ("Temperature");
   gtk_container_add (GTK_CONTAINER (frame), scale);
@@ -727,6 +777,18 @@ static void activate (GtkApplication *app, gpointer user_data)
   gtk_notebook_append_page (GTK_NOTEBOOK (notebook), frame, label);
   // Add IC box to frame to be put on the frame of the third page of the Notebook
   gtk_container_add (GTK_CONTAINER (frame), box);
+  // Random number generator radio buttons, under the initial conditions
+  GtkWidget *rng_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
+  radio = NULL;
+  for (int backend = 0; backend < RNG_BACKENDS; backend++)
+    {
+    radio = gtk_radio_button_new_with_label_from_widget (GTK_RADIO_BUTTON (radio), rng_name (backend));
+    g_signal_connect (GTK_TOGGLE_BUTTON (radio), "pressed", G_CALLBACK (on_radio_rng), GINT_TO_POINTER (backend));
+    gtk_box_pack_start (GTK_BOX (rng_box), radio, TRUE, TRUE, 0);
+    }
+  GtkWidget *rng_frame = gtk_frame_new ("Random number generator");
+  gtk_container_add (GTK_CONTAINER (rng_frame), rng_box);
+  gtk_box_pack_start (GTK_BOX (box), rng_frame, TRUE, TRUE, 0);
 
 
   // Parameters section final touch
@@ -757,12 +819,27 @@ static void activate (GtkApplication *app, gpointer user_data)
 
 
   // PIX BUFFER
-  /* Pixel buffer @ start up and default canvas display */
-  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, 0, 8, X_SIZE, Y_SIZE);
-  image_lattice = gtk_image_new_from_pixbuf (pixbuf);
+  /* Pixel buffers @ start up and default canvas display: the three frames
+     the simulation thread paints into, in turn */
+  for (int k = 0; k < 3; k++)
+    d.pixbuf[k] = gdk_pixbuf_new_from_data (d.frames.frame[k].pixels, GDK_COLORSPACE_RGB, TRUE, 8,
+                                            d.frames.width, d.frames.height, d.frames.rowstride, NULL, NULL);
+  image_lattice = gtk_image_new_from_pixbuf (d.pixbuf[d.frames.front]);
   paint_a_background (image_lattice);
+  // A resumed run shows its lattice (the simulation thread is not started yet)
+  if (s.initialized)
+    render_frames_publish (&d.frames, &s, &d.view);
+  gtk_widget_add_tick_callback (image_lattice, on_frame_clock, NULL, NULL);
+  // The mouse pans (drag) and zooms (wheel) the image, in an event box
+  lattice_box = gtk_event_box_new ();
+  gtk_widget_add_events (lattice_box, GDK_BUTTON_PRESS_MASK | GDK_BUTTON_RELEASE_MASK
+                         | GDK_POINTER_MOTION_MASK | GDK_SCROLL_MASK);
+  g_signal_connect (lattice_box, "scroll-event", G_CALLBACK (on_lattice_scroll), NULL);
+  g_signal_connect (lattice_box, "button-press-event", G_CALLBACK (on_lattice_button), NULL);
+  g_signal_connect (lattice_box, "motion-notify-event", G_CALLBACK (on_lattice_motion), NULL);
+  gtk_container_add (GTK_CONTAINER (lattice_box), image_lattice);
   // We place the image on row 7 of our grid spanning 5 columns
-  gtk_grid_attach (GTK_GRID (grid), image_lattice, 0, 7, 5, 1); 
+  gtk_grid_attach (GTK_GRID (grid), lattice_box, 0, 7, 5, 1); 
   /* Position (0,3) spanning 5 col and 1 row */
 
 
@@ -773,7 +850,7 @@ static void activate (GtkApplication *app, gpointer user_data)
   ctrl_frame =  gtk_frame_new ("Simulation Control");
   // Initialize Lattice
   button = gtk_button_new_with_label ("Init");
-  g_signal_connect (button, "clicked", G_CALLBACK (init_lattice), GTK_IMAGE (image_lattice));
+  g_signal_connect (button, "clicked", G_CALLBACK (on_button_init_lattice), GTK_IMAGE (image_lattice));
   gtk_container_add (GTK_CONTAINER (button_box), button);
   // Start
   button = gtk_button_new_with_label ("Start");
@@ -816,88 +893,28 @@ static void activate (GtkApplication *app, gpointer user_data)
   gtk_container_add (GTK_CONTAINER (window), grid);
   /* Show the window and all widgets in it */
   gtk_widget_show_all (window);
+  /* The simulation runs on its own thread from now on */
+  w.thread = g_thread_new ("simulation", simulation_thread, NULL);
 }
 
 
 
 
-/* Implementation of put pixel function. Code retrieved from:
-   https://developer.gnome.org/gdk-pixbuf/stable/gdk-pixbuf-The-GdkPixbuf-Structure.html */
-void put_pixel (GdkPixbuf *pixbuf, int x, int y,
-                guchar red, guchar green, guchar blue, guchar alpha)
-  {
-  guchar *pixels, *p;
-  int rowstride, numchannels;
-  numchannels = gdk_pixbuf_get_n_channels(pixbuf);
-  rowstride = gdk_pixbuf_get_rowstride(pixbuf);
-  pixels = gdk_pixbuf_get_pixels(pixbuf);
-  p = pixels + y * rowstride + x * numchannels;
-  p[0] = red;	p[1] = green; p[2] = blue; p[3] = alpha;
-  return;
-  }
-
-
-
-/* Creates a pixel buffer and paints an image to display as default canvas */
+/* Paints a background to display as default canvas (in the front frame,
+   which the display owns) */
 static void paint_a_background (gpointer data)
   {
-  GdkPixbuf *p;
-  p = gdk_pixbuf_new (GDK_COLORSPACE_RGB, 0, 8, X_SIZE, Y_SIZE);
+  guchar *pixels = d.frames.frame[d.frames.front].pixels, *p;
+  int rowstride = d.frames.rowstride;
   /* Paint a background canvas for start up image */
   int x, y;
-  for (x = 0; x < X_SIZE; x++)
-    	{
-        for (y = 0; y < Y_SIZE; y++)
-            {
-            put_pixel (p, (int) x, (int) y,
-                       (guchar) x, (guchar) y, (guchar) x, 255);
-            }
-      }
-  gtk_image_set_from_pixbuf (GTK_IMAGE (data), GDK_PIXBUF (p));
-  g_object_unref (p);
-  }
-
-
-/* Function that paints the pixel buffer with the simulation data   */
-// The states are:
-//  0: vacant
-// -1: spin down
-// +1: spin up
-//  2: undifferenciated
-static void paint_lattice (gpointer data)
-  {
-  // we make a Gdk pixbuffer to paint configurations
-  GdkPixbuf *p;
-  p = gdk_pixbuf_new (GDK_COLORSPACE_RGB, 0, 8, X_SIZE, Y_SIZE);
-  /* Paint lattice configuration to a pixel buffer */
-  int x, y;
-  for (x = 0; x < X_SIZE; x++)
-    {
-    for (y = 0; y < Y_SIZE; y++)
+  for (y = 0; y < d.frames.height; y++)
+    for (x = 0; x < d.frames.width; x++)
       {
-      switch (s.lattice_configuration[x][y])
-        {
-        case 0:	/* Empty (vacant) site  (black) */
-          put_pixel (p, (int) x, (int) y, 
-                     (guchar) 0, (guchar) 0, (guchar) 0, 255);
-          break;
-        case -1:	/* Spin down (occupied) site (green) */
-          put_pixel (p, (int) x, (int) y, 
-                       (guchar) 0, (guchar) 255, (guchar) 0, 255);
-          break;
-        case 1:	  /* Spin  up  (occupied) site (magenta) */
-          put_pixel (p, (int) x, (int) y, 
-                     (guchar) 255, (guchar) 0, (guchar) 255, 255);
-          break;
-        case 2:	/*  Un-differentiated (occupied) site (white) */
-          put_pixel (p, (int) x, (int) y, 
-                     (guchar) 255, (guchar) 255, (guchar) 255, 255);
-          break;
-        }
+      p = pixels + y * rowstride + x * RENDER_CHANNELS;
+      p[0] = (guchar) x; p[1] = (guchar) y; p[2] = (guchar) x; p[3] = 255;
       }
-    }
-  gtk_image_set_from_pixbuf (GTK_IMAGE (data), GDK_PIXBUF (p));
-  g_object_unref (p);
+  gtk_image_set_from_pixbuf (GTK_IMAGE (data), d.pixbuf[d.frames.front]);
   }
 
 
@@ -908,7 +925,36 @@ int main (int argc, char **argv)
   int status;
   app = gtk_application_new ("keymer.lab.contact_process_ising_model", G_APPLICATION_FLAGS_NONE);
   g_signal_connect (app, "activate", G_CALLBACK (activate), NULL);
+  g_application_add_main_option_entries (G_APPLICATION (app), command_line_options);
   status = g_application_run (G_APPLICATION (app), argc, argv);
   g_object_unref (app);
+  /* Stop the simulation thread before s is saved and released */
+  if (w.thread != NULL)
+    {
+    g_mutex_lock (&w.lock);
+    g_atomic_int_set (&w.quit, TRUE);
+    g_atomic_int_set (&w.changed, TRUE);
+    g_cond_signal (&w.wake);
+    g_mutex_unlock (&w.lock);
+    g_thread_join (w.thread);
+    }
+  for (int k = 0; k < 3; k++)
+    if (d.pixbuf[k] != NULL)
+      g_object_unref (d.pixbuf[k]);
+  render_frames_free (&d.frames);
+  if (observables_dropped (&o) > 0)
+    g_print ("%ld samples of the observables dropped\n", observables_dropped (&o));
+  observables_close (&o);
+  if (movie_dropped (&m) > 0)
+    g_print ("%ld frames of the movie dropped\n", movie_dropped (&m));
+  movie_close (&m);
+  if (checkpoint_path != NULL && s.lattice_configuration != NULL)
+    {
+    if (checkpoint_save (&s, checkpoint_path) != 0)
+      g_print ("Could not write the checkpoint %s\n", checkpoint_path);
+    else
+      g_print ("Saved the run to %s at generation %d\n", checkpoint_path, s.generation_time);
+    }
+  simulation_free (&s);
   return status;
   }
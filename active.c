@@ -0,0 +1,246 @@
+// Active set update schedule for the Contact Process Ising Model.
+//
+// update_lattice() picks x_size*y_size sites per generation, uniformly.
+// A vacancy with no occupied NN is inactive: its update draws a vacant
+// neighboor and changes nothing. While a colony grows from a single seed
+// (init_option 1 to 4) nearly every pick is such a no-op.
+//
+// This schedule keeps the set of active sites (occupied sites, and
+// vacancies with at least one occupied NN) and only updates those. With A
+// active sites among N, each pick is active with probability p = A/N, so
+// the number of inactive picks before the next active one is geometric:
+// the schedule skips them in one draw and updates a uniform active site.
+// A generation still ends after N picks, skipped ones included (time
+// advances by (skipped + 1)/N per update), so the dynamics is the one of
+// the random schedule. The set changes only when a site is occupied or
+// emptied; then the site and its 4 NN are reclassified.
+//
+// When most sites are active (2A >= N) the skips are short, and the
+// schedule picks sites over the whole lattice like update_lattice(),
+// updating the active ones.
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "rng.h"
+#include "simulation.h"
+#include "kernels.h"
+
+
+struct active
+  {
+  int x_size, y_size;         /* Geometry the set was built for */
+  int lattice_epoch;          /* s->lattice_epoch the set was built for */
+  int32_t *position;          /* Position of each site (y*x_size + x) in sites[], -1 if inactive */
+  int32_t *sites;             /* Active sites */
+  long count;                 /* Active sites in sites[] */
+  };
+
+
+/* Can s be updated with the active set schedule? 0 if so */
+int active_supported (const struct simulation *s)
+  {
+  // Sites are stored as 32 bit numbers
+  return s->n_sites < INT32_MAX ? 0 : -1;
+  }
+
+
+/* Release the active set of s */
+void active_free (struct simulation *s)
+  {
+  if (s->active == NULL)
+    return;
+  free (s->active->position);
+  free (s->active->sites);
+  free (s->active);
+  s->active = NULL;
+  }
+
+
+/* The order of the active set decides which site a pick draws, so
+   checkpoints keep it: the count (int64), then the active sites (int32) */
+size_t active_state_bytes (const struct simulation *s)
+  {
+  const struct active *a = s->active;
+  if (a == NULL || a->x_size != s->x_size || a->y_size != s->y_size
+      || a->lattice_epoch != s->lattice_epoch)
+    return 0;
+  return sizeof (int64_t) + (size_t) a->count * sizeof (int32_t);
+  }
+
+void active_state_save (const struct simulation *s, void *data)
+  {
+  int64_t *count = data;
+  *count = s->active->count;
+  memcpy (count + 1, s->active->sites, (size_t) s->active->count * sizeof (int32_t));
+  }
+
+int active_state_load (struct simulation *s, const void *data, size_t bytes)
+  {
+  const int64_t *count = data;
+  const int32_t *sites = (const int32_t *) (count + 1);
+  struct active *a;
+  if (bytes < sizeof (int64_t) || *count < 0 || *count > s->n_sites
+      || bytes != sizeof (int64_t) + (size_t) *count * sizeof (int32_t))
+    return -1;
+  active_free (s);
+  a = calloc (1, sizeof (struct active));
+  if (a == NULL)
+    return -1;
+  s->active = a;
+  a->x_size = s->x_size;
+  a->y_size = s->y_size;
+  a->lattice_epoch = s->lattice_epoch;
+  a->position = malloc ((size_t) s->n_sites * sizeof (int32_t));
+  a->sites = malloc ((size_t) s->n_sites * sizeof (int32_t));
+  if (a->position == NULL || a->sites == NULL)
+    {
+    active_free (s);
+    return -1;
+    }
+  for (long p = 0; p < s->n_sites; p++)
+    a->position[p] = -1;
+  for (a->count = 0; a->count < *count; a->count++)
+    {
+    int32_t p = sites[a->count];
+    if (p < 0 || p >= s->n_sites || a->position[p] >= 0)
+      {
+      active_free (s);
+      return -1;
+      }
+    a->position[p] = (int32_t) a->count;
+    a->sites[a->count] = p;
+    }
+  return 0;
+  }
+
+
+/* Is site (x,y) occupied or next to an occupied site? */
+static int is_active (const struct simulation *s, int x, int y)
+  {
+  int nx, ny;
+  if (get_site (s, site_index (s, x, y)) != 0)
+    return 1;
+  for (int n = 0; n < 4; n++)
+    if (lattice_neighbor (s, x, y, neighbor_offsets[n][0], neighbor_offsets[n][1], &nx, &ny)
+        && get_site (s, site_index (s, nx, ny)) != 0)
+      return 1;
+  return 0;
+  }
+
+
+/* Add site (x,y) to the set, or remove it, according to is_active () */
+static void refresh (const struct simulation *s, struct active *a, int x, int y)
+  {
+  int32_t p = (int32_t) y * s->x_size + x, last;
+  int active = is_active (s, x, y);
+  if (active == (a->position[p] >= 0))
+    return;
+  if (active)
+    {
+    a->position[p] = (int32_t) a->count;
+    a->sites[a->count++] = p;
+    return;
+    }
+  // The last active site takes its place
+  last = a->sites[--a->count];
+  a->sites[a->position[p]] = last;
+  a->position[last] = a->position[p];
+  a->position[p] = -1;
+  }
+
+
+/* (Re)build the set of s if the lattice was changed from outside the
+   schedule; 0 on success */
+static int prepare_active (struct simulation *s)
+  {
+  struct active *a = s->active;
+  if (a != NULL && a->x_size == s->x_size && a->y_size == s->y_size
+      && a->lattice_epoch == s->lattice_epoch)
+    return 0;
+  active_free (s);
+  a = calloc (1, sizeof (struct active));
+  if (a == NULL)
+    return -1;
+  s->active = a;
+  a->x_size = s->x_size;
+  a->y_size = s->y_size;
+  a->lattice_epoch = s->lattice_epoch;
+  a->position = malloc ((size_t) s->n_sites * sizeof (int32_t));
+  a->sites = malloc ((size_t) s->n_sites * sizeof (int32_t));
+  if (a->position == NULL || a->sites == NULL)
+    {
+    active_free (s);
+    return -1;
+    }
+  for (long p = 0; p < s->n_sites; p++)
+    a->position[p] = -1;
+  for (int y = 0; y < s->y_size; y++)
+    for (int x = 0; x < s->x_size; x++)
+      refresh (s, a, x, y);
+  return 0;
+  }
+
+
+/* Update site (x,y) and, if it was occupied or emptied, the set */
+static inline void update_active_site (struct simulation *s, struct active *a, int x, int y,
+                                       struct site_counts *counts, const int wrap_mode, const int radius)
+  {
+  long focal = site_index (s, x, y);
+  int occupied = get_site (s, focal) != 0, nx, ny;
+  update_site (s, &s->rng, x, y, focal, counts, wrap_mode, radius);
+  if ((get_site (s, focal) != 0) == occupied)
+    return;
+  refresh (s, a, x, y);
+  for (int n = 0; n < 4; n++)
+    if (lattice_neighbor (s, x, y, neighbor_offsets[n][0], neighbor_offsets[n][1], &nx, &ny))
+      refresh (s, a, nx, ny);
+  }
+
+
+static inline void active_kernel (struct simulation *s, const int wrap_mode, const int radius)
+  {
+  struct active *a = s->active;
+  struct site_counts counts = {0, 0, 0, 0};
+  double skip;
+  int32_t p;
+  int x, y;
+  prepare_rate_thresholds (s);
+  // Picks of the generation, skipped ones included
+  for (long pick = 0; pick < s->n_sites; pick++)
+    {
+    if (2 * a->count >= s->n_sites)
+      {
+      x = (int) draw_index (&s->rng, s->x_size);
+      y = (int) draw_index (&s->rng, s->y_size);
+      if (a->position[(int32_t) y * s->x_size + x] >= 0)
+        update_active_site (s, a, x, y, &counts, wrap_mode, radius);
+      continue;
+      }
+    if (a->count == 0)
+      break;                  /* absorbing state */
+    // Inactive picks before the next active one: floor (log U / log (1 - p)), U in (0,1]
+    skip = floor (log (((rng_next (&s->rng) >> 11) + 1) * (1.0/9007199254740992.0))
+                  / log1p (-(double) a->count / (double) s->n_sites));
+    if (skip >= (double) (s->n_sites - pick))
+      break;
+    pick += (long) skip;
+    p = a->sites[draw_index (&s->rng, (uint64_t) a->count)];
+    update_active_site (s, a, p % s->x_size, p / s->x_size, &counts, wrap_mode, radius);
+    }
+  s->occupancy += counts.occupancy; s->vacancy += counts.vacancy;
+  s->up += counts.up; s->down += counts.down;
+  s->generation_time ++;
+  }
+
+
+/* One generation of the active set schedule */
+int update_lattice_active (struct simulation *s)
+  {
+  if (prepare_active (s) != 0)
+    return -1;
+#define SWEEP(wrap_mode, radius) active_kernel (s, wrap_mode, radius)
+  DISPATCH_KERNEL (s, SWEEP);
+#undef SWEEP
+  return 0;
+  }
@@ -0,0 +1,110 @@
+// Checkerboard (sublattice) update schedule for the Contact Process Ising Model.
+//
+// The lattice is colored so that no two sites of the same color are within
+// the update stencil of each other: a site update writes only its own site
+// and reads at most its r=2 (NNN) neighboorhood (the CP colonization reads
+// one of the 4 NN). All the sites of one color can then be updated at the
+// same time, in parallel over rows with OpenMP.
+//
+//   r=1 (NN):  2 colors, (x + y) mod 2   (sides must be even on a torus)
+//   r=2 (NNN): 8 colors, (x + 2y) mod 8  (width multiple of 8, height of 4)
+//
+// How the dynamics differ from the random sequential update_lattice():
+//  - every site is visited exactly once per generation, one color after the
+//    other, instead of a Poisson(1) number of times in random order;
+//  - a cell born while updating one color can spread in the next colors of
+//    the same generation, but never within its own color;
+//  - with the mt64 generator each thread draws from its own stream of the
+//    seed, so a run is reproducible for a given seed and number of threads,
+//    but not across thread counts. The other backends can seed a stream
+//    for free, so each row of each color of each generation gets its own
+//    stream (row_stream) and runs do not depend on the number of threads.
+// The single site rules (birth, death, differentiation, Metropolis flips)
+// are the same, and so is the equilibrium of the pure Ising limit.
+
+#include <stdlib.h>
+#include "rng.h"
+#include "simulation.h"
+#include "kernels.h"
+
+
+/* Can s be updated with the checkerboard schedule? 0 if so */
+int checkerboard_supported (const struct simulation *s)
+  {
+  int x_period = (s->Ising_neighboorhood == 2) ? 8 : 2;
+  int y_period = (s->Ising_neighboorhood == 2) ? 4 : 2;
+  // On a torus the coloring must wrap around
+  if (s->boundary != BOUNDARY_OPEN
+      && (s->x_size % x_period != 0 || s->y_size % y_period != 0))
+    return -1;
+#if defined(CPIM_PACKED_LATTICE)
+  // Rows are shared among threads: they must not share bytes
+  if (s->stride % 4 != 0)
+    return -1;
+#endif
+  return 0;
+  }
+
+
+/* One generator per thread: independent streams of the seed of s */
+int prepare_thread_generators (struct simulation *s)
+  {
+  int threads = thread_count ();
+  if (s->n_thread_rng == threads)
+    return 0;
+  free (s->thread_rng);
+  s->thread_rng = malloc ((size_t) threads * sizeof (struct rng));
+  if (s->thread_rng == NULL)
+    {
+    s->n_thread_rng = 0;
+    return -1;
+    }
+  for (int t = 0; t < threads; t++)
+    simulation_stream (s, &s->thread_rng[t]);
+  s->n_thread_rng = threads;
+  return 0;
+  }
+
+
+static inline void checkerboard_kernel (struct simulation *s, const int wrap_mode, const int radius)
+  {
+  const int colors = (radius == 2) ? 8 : 2;
+  const int per_row = rng_cheap_streams (s->rng_backend);
+  long occupancy = 0, vacancy = 0, up = 0, down = 0;
+#pragma omp parallel reduction(+:occupancy, vacancy, up, down)
+    {
+    struct rng row_rng;
+    struct rng *rng = per_row ? &row_rng : &s->thread_rng[thread_number ()];
+    struct site_counts counts = {0, 0, 0, 0};
+    for (int color = 0; color < colors; color++)
+      {
+      // The implicit barrier at the end of each color keeps colors apart
+#pragma omp for schedule(static)
+      for (int y = 0; y < s->y_size; y++)
+        {
+        if (per_row)
+          rng_seed_stream (rng, s->rng_backend, s->seed, row_stream (s, color, y));
+        for (int x = first_x (color, y, radius); x < s->x_size; x += colors)
+          update_site (s, rng, x, y, site_index (s, x, y), &counts, wrap_mode, radius);
+        }
+      }
+    occupancy += counts.occupancy; vacancy += counts.vacancy;
+    up += counts.up; down += counts.down;
+    }
+  s->occupancy += occupancy; s->vacancy += vacancy;
+  s->up += up; s->down += down;
+  s->generation_time ++;
+  }
+
+
+/* One generation of the checkerboard schedule */
+int update_lattice_checkerboard (struct simulation *s)
+  {
+  if (!rng_cheap_streams (s->rng_backend) && prepare_thread_generators (s) != 0)
+    return -1;
+  prepare_rate_thresholds (s);
+#define SWEEP(wrap_mode, radius) checkerboard_kernel (s, wrap_mode, radius)
+  DISPATCH_KERNEL (s, SWEEP);
+#undef SWEEP
+  return 0;
+  }
@@ -0,0 +1,382 @@
+// Checkpoints of a simulation.
+//
+// Long runs on preemptible nodes must be able to stop and restart without
+// changing their outcome, so a checkpoint keeps everything that the next
+// generations depend on: the parameters and counters, the lattice, the
+// generator of s with its block of buffered outputs, the thread generators
+// of the checkerboard engines, and the state of the domain, kmc and active
+// engines (tile generators and clocks, the order of their site lists).
+// What follows from the lattice (halo, field cache, multispin planes) is
+// rebuilt. A run restarted from a checkpoint continues bit for bit as the
+// uninterrupted run (with the same number of threads, as always).
+//
+// Layout (version 1, in the byte order of the host):
+//   header    "CPIMCKPT", uint32 version, uint32 sections, uint64 file bytes
+//   table     per section: uint32 id, uint32 0, uint64 offset, uint64 bytes
+//   sections  at offsets that are multiples of 64:
+//     PARAMETERS  struct checkpoint_parameters
+//     RNG         the struct rng of s
+//     THREAD_RNG  the n_thread_rng thread generators (struct rng)
+//     LATTICE     the x_size*y_size sites row by row, 2 bits each (state & 3,
+//                 4 sites per byte, the first one in the low bits), whatever
+//                 the lattice layout of the build
+//     DOMAIN, KMC, ACTIVE  the states of the engines (*_state_save)
+// Generators are stored as they are in memory: PARAMETERS records the size
+// of struct rng, and a build that differs refuses the file. Checkpoints
+// are read through mmap: restoring decodes the lattice straight from the
+// page cache.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "rng.h"
+#include "simulation.h"
+#include "checkpoint.h"
+
+/* Sections of a checkpoint */
+enum
+  {
+  SECTION_PARAMETERS = 1,
+  SECTION_RNG,
+  SECTION_THREAD_RNG,
+  SECTION_LATTICE,
+  SECTION_DOMAIN,
+  SECTION_KMC,
+  SECTION_ACTIVE,
+  SECTIONS = SECTION_ACTIVE
+  };
+
+#define SECTION_ALIGNMENT 64
+
+struct checkpoint_header
+  {
+  char magic[8];              /* "CPIMCKPT" */
+  uint32_t version;           /* CHECKPOINT_VERSION */
+  uint32_t sections;          /* Entries of the table that follows */
+  uint64_t file_bytes;        /* Size of the file */
+  };
+
+struct checkpoint_section
+  {
+  uint32_t id;                /* SECTION_ */
+  uint32_t reserved;
+  uint64_t offset;            /* From the start of the file */
+  uint64_t bytes;
+  };
+
+/* Parameters and counters of the simulation */
+struct checkpoint_parameters
+  {
+  int32_t x_size, y_size, boundary, rng_backend;
+  int32_t schedule, use_multispin, simd, engine;
+  int32_t domain_rounds, cluster_interval, use_field_cache, init_option;
+  int32_t initialized, generation_time, Ising_neighboorhood, lattice_epoch;
+  int32_t rng_bytes, reserved;
+  int64_t occupancy, vacancy, up, down;
+  uint64_t seed, streams;
+  double birth_rate, death_rate, differentiation_rate, T, J, lamda_rate;
+  };
+
+
+/* Sites of s, 2 bits each (pack_lattice); NULL if out of memory */
+static uint8_t *encode_lattice (const struct simulation *s, size_t *bytes)
+  {
+  uint8_t *codes;
+  *bytes = (size_t) (s->n_sites + 3) / 4;
+  codes = malloc (*bytes);
+  if (codes != NULL)
+    pack_lattice (s, codes);
+  return codes;
+  }
+
+/* Write the sites of s from their codes; -1 if they do not add up to the
+   counters of s */
+static int decode_lattice (struct simulation *s, const uint8_t *codes)
+  {
+  static const int8_t decode[4] = {0, 1, 2, -1};
+  long p = 0, occupancy = 0, up = 0, down = 0;
+  int state;
+  for (int y = 0; y < s->y_size; y++)
+    for (int x = 0; x < s->x_size; x++, p++)
+      {
+      state = decode[(codes[p >> 2] >> ((p & 3) << 1)) & 3];
+      set_site (s, site_index (s, x, y), state);
+      occupancy += state != 0;
+      up += state == 1;
+      down += state == -1;
+      }
+  return (occupancy == s->occupancy && up == s->up && down == s->down
+          && s->vacancy == s->n_sites - occupancy) ? 0 : -1;
+  }
+
+
+/* Write bytes of data that start at offset (mod SECTION_ALIGNMENT) of an
+   aligned block, then zeros up to the end of the block */
+static int write_padded (FILE *file, const void *data, size_t bytes, size_t offset)
+  {
+  static const char zeros[SECTION_ALIGNMENT];
+  size_t padding = (SECTION_ALIGNMENT - (offset + bytes) % SECTION_ALIGNMENT) % SECTION_ALIGNMENT;
+  if (bytes > 0 && fwrite (data, 1, bytes, file) != bytes)
+    return -1;
+  return (padding > 0 && fwrite (zeros, 1, padding, file) != padding) ? -1 : 0;
+  }
+
+
+/* Lay out the n sections of table (their id and bytes set) after the
+   header, and write them to a file next to path, synced, then renamed
+   over it; 0 on success */
+static int write_sections (const char *path, struct checkpoint_section *table, const void **data, int n)
+  {
+  struct checkpoint_header header;
+  uint64_t offset = sizeof (header) + (uint64_t) n * sizeof (struct checkpoint_section);
+  char *temporary = malloc (strlen (path) + 5);
+  FILE *file;
+  int status;
+  if (temporary == NULL)
+    return -1;
+  for (int k = 0; k < n; k++)
+    {
+    offset = (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+    table[k].offset = offset;
+    offset += table[k].bytes;
+    }
+  memcpy (header.magic, "CPIMCKPT", 8);
+  header.version = CHECKPOINT_VERSION;
+  header.sections = (uint32_t) n;
+  header.file_bytes = (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+  sprintf (temporary, "%s.tmp", path);
+  file = fopen (temporary, "wb");
+  if (file == NULL)
+    {
+    free (temporary);
+    return -1;
+    }
+  status = (fwrite (&header, sizeof (header), 1, file) == 1
+            && write_padded (file, table, (size_t) n * sizeof (struct checkpoint_section),
+                             sizeof (header)) == 0) ? 0 : -1;
+  for (int k = 0; k < n && status == 0; k++)
+    status = write_padded (file, data[k], table[k].bytes, 0);
+  if (fflush (file) != 0 || fsync (fileno (file)) != 0)
+    status = -1;
+  if (fclose (file) != 0)
+    status = -1;
+  if (status == 0 && rename (temporary, path) != 0)
+    status = -1;
+  if (status != 0)
+    remove (temporary);
+  free (temporary);
+  return status;
+  }
+
+
+int checkpoint_save (const struct simulation *s, const char *path)
+  {
+  struct checkpoint_section table[SECTIONS];
+  struct checkpoint_parameters parameters;
+  const void *data[SECTIONS];
+  void *engine[3] = {NULL, NULL, NULL};
+  size_t engine_bytes[3], lattice_bytes;
+  uint8_t *codes;
+  int n = 0, status = -1, ready;
+
+  memset (&parameters, 0, sizeof (parameters));
+  parameters.x_size = s->x_size;
+  parameters.y_size = s->y_size;
+  parameters.boundary = s->boundary;
+  parameters.rng_backend = s->rng_backend;
+  parameters.schedule = s->schedule;
+  parameters.use_multispin = s->use_multispin;
+  parameters.simd = s->simd;
+  parameters.engine = s->engine;
+  parameters.domain_rounds = s->domain_rounds;
+  parameters.cluster_interval = s->cluster_interval;
+  parameters.use_field_cache = s->use_field_cache;
+  parameters.init_option = s->init_option;
+  parameters.initialized = s->initialized;
+  parameters.generation_time = s->generation_time;
+  parameters.Ising_neighboorhood = s->Ising_neighboorhood;
+  parameters.lattice_epoch = s->lattice_epoch;
+  parameters.rng_bytes = (int32_t) sizeof (struct rng);
+  parameters.occupancy = s->occupancy;
+  parameters.vacancy = s->vacancy;
+  parameters.up = s->up;
+  parameters.down = s->down;
+  parameters.seed = s->seed;
+  parameters.streams = s->streams;
+  parameters.birth_rate = s->birth_rate;
+  parameters.death_rate = s->death_rate;
+  parameters.differentiation_rate = s->differentiation_rate;
+  parameters.T = s->T;
+  parameters.J = s->J;
+  parameters.lamda_rate = s->lamda_rate;
+
+  codes = encode_lattice (s, &lattice_bytes);
+  engine_bytes[0] = domain_state_bytes (s);
+  engine_bytes[1] = kmc_state_bytes (s);
+  engine_bytes[2] = active_state_bytes (s);
+  ready = codes != NULL;
+  for (int k = 0; k < 3; k++)
+    if (engine_bytes[k] > 0)
+      {
+      engine[k] = malloc (engine_bytes[k]);
+      ready = ready && engine[k] != NULL;
+      }
+  if (ready)
+    {
+#define SECTION(section, pointer, size) \
+  do { table[n].id = (section); table[n].reserved = 0; table[n].bytes = (size); data[n++] = (pointer); } while (0)
+    SECTION (SECTION_PARAMETERS, &parameters, sizeof (parameters));
+    SECTION (SECTION_RNG, &s->rng, sizeof (struct rng));
+    if (s->n_thread_rng > 0)
+      SECTION (SECTION_THREAD_RNG, s->thread_rng, (size_t) s->n_thread_rng * sizeof (struct rng));
+    SECTION (SECTION_LATTICE, codes, lattice_bytes);
+    if (engine[0] != NULL)
+      {
+      domain_state_save (s, engine[0]);
+      SECTION (SECTION_DOMAIN, engine[0], engine_bytes[0]);
+      }
+    if (engine[1] != NULL)
+      {
+      kmc_state_save (s, engine[1]);
+      SECTION (SECTION_KMC, engine[1], engine_bytes[1]);
+      }
+    if (engine[2] != NULL)
+      {
+      active_state_save (s, engine[2]);
+      SECTION (SECTION_ACTIVE, engine[2], engine_bytes[2]);
+      }
+#undef SECTION
+    status = write_sections (path, table, data, n);
+    }
+  free (codes);
+  for (int k = 0; k < 3; k++)
+    free (engine[k]);
+  return status;
+  }
+
+
+/* Section id of the checkpoint at map (file bytes long), or NULL */
+static const void *find_section (const uint8_t *map, size_t file_bytes, uint32_t id, size_t *bytes)
+  {
+  const struct checkpoint_header *header = (const struct checkpoint_header *) map;
+  const struct checkpoint_section *table = (const struct checkpoint_section *) (header + 1);
+  for (uint32_t k = 0; k < header->sections; k++)
+    if (table[k].id == id)
+      {
+      if (table[k].offset > file_bytes || table[k].bytes > file_bytes - table[k].offset)
+        return NULL;
+      *bytes = (size_t) table[k].bytes;
+      return map + table[k].offset;
+      }
+  return NULL;
+  }
+
+
+/* Restore s from the checkpoint mapped at map; 0 on success */
+static int restore (struct simulation *s, const uint8_t *map, size_t file_bytes)
+  {
+  const struct checkpoint_header *header = (const struct checkpoint_header *) map;
+  const struct checkpoint_parameters *parameters;
+  const void *section;
+  size_t bytes;
+  if (file_bytes < sizeof (*header) || memcmp (header->magic, "CPIMCKPT", 8) != 0
+      || header->version != CHECKPOINT_VERSION || header->file_bytes != file_bytes
+      || header->sections > SECTIONS
+      || sizeof (*header) + header->sections * sizeof (struct checkpoint_section) > file_bytes)
+    return -1;
+  parameters = find_section (map, file_bytes, SECTION_PARAMETERS, &bytes);
+  if (parameters == NULL || bytes != sizeof (*parameters)
+      || parameters->rng_bytes != (int32_t) sizeof (struct rng)
+      || simulation_alloc (s, parameters->x_size, parameters->y_size, parameters->boundary) != 0)
+    return -1;
+
+  s->rng_backend = parameters->rng_backend;
+  s->schedule = parameters->schedule;
+  s->use_multispin = parameters->use_multispin;
+  s->simd = parameters->simd;
+  s->engine = parameters->engine;
+  s->domain_rounds = parameters->domain_rounds;
+  s->cluster_interval = parameters->cluster_interval;
+  s->use_field_cache = parameters->use_field_cache;
+  s->init_option = parameters->init_option;
+  s->generation_time = parameters->generation_time;
+  s->Ising_neighboorhood = parameters->Ising_neighboorhood;
+  s->occupancy = parameters->occupancy;
+  s->vacancy = parameters->vacancy;
+  s->up = parameters->up;
+  s->down = parameters->down;
+  s->seed = parameters->seed;
+  s->birth_rate = parameters->birth_rate;
+  s->death_rate = parameters->death_rate;
+  s->differentiation_rate = parameters->differentiation_rate;
+  s->T = parameters->T;
+  s->J = parameters->J;
+  s->lamda_rate = parameters->lamda_rate;
+  build_boltzmann_table (s);
+
+  section = find_section (map, file_bytes, SECTION_RNG, &bytes);
+  if (section == NULL || bytes != sizeof (struct rng))
+    return -1;
+  memcpy (&s->rng, section, sizeof (struct rng));
+  section = find_section (map, file_bytes, SECTION_THREAD_RNG, &bytes);
+  if (section != NULL)
+    {
+    if (bytes == 0 || bytes % sizeof (struct rng) != 0 || (s->thread_rng = malloc (bytes)) == NULL)
+      return -1;
+    memcpy (s->thread_rng, section, bytes);
+    s->n_thread_rng = (int) (bytes / sizeof (struct rng));
+    }
+  section = find_section (map, file_bytes, SECTION_LATTICE, &bytes);
+  if (section == NULL || bytes != (size_t) (s->n_sites + 3) / 4 || decode_lattice (s, section) != 0)
+    return -1;
+  // The halo follows from the lattice; the epoch is that of the saved run
+  halo_exchange (s);
+  s->lattice_epoch = parameters->lattice_epoch;
+  s->field_cache_epoch = -1;
+  s->block_counts_epoch = -1;
+  s->initialized = parameters->initialized;
+
+  section = find_section (map, file_bytes, SECTION_DOMAIN, &bytes);
+  if (section != NULL && domain_state_load (s, section, bytes) != 0)
+    return -1;
+  section = find_section (map, file_bytes, SECTION_KMC, &bytes);
+  if (section != NULL && kmc_state_load (s, section, bytes) != 0)
+    return -1;
+  section = find_section (map, file_bytes, SECTION_ACTIVE, &bytes);
+  if (section != NULL && active_state_load (s, section, bytes) != 0)
+    return -1;
+  // Rebuilding the tiles drew streams: back to the count of the saved run
+  s->streams = parameters->streams;
+  return 0;
+  }
+
+
+int checkpoint_load (struct simulation *s, const char *path)
+  {
+  struct stat status;
+  void *map;
+  int fd = open (path, O_RDONLY), result;
+  if (fd < 0)
+    return -1;
+  if (fstat (fd, &status) != 0 || status.st_size <= 0)
+    {
+    close (fd);
+    return -1;
+    }
+  map = mmap (NULL, (size_t) status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+    return -1;
+#ifdef MADV_SEQUENTIAL
+  madvise (map, (size_t) status.st_size, MADV_SEQUENTIAL);
+#endif
+  result = restore (s, map, (size_t) status.st_size);
+  munmap (map, (size_t) status.st_size);
+  if (result != 0)
+    simulation_free (s);
+  return result;
+  }
@@ -0,0 +1,23 @@
+// Checkpoints of a simulation: the parameters, counters, lattice and the
+// exact state of every generator, so that a restarted run continues
+// bit for bit as the uninterrupted one; see checkpoint.c.
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "simulation.h"
+
+/* Version of the file format */
+#define CHECKPOINT_VERSION 1
+
+
+/* Write s to path: to a temporary file next to it, synced, then renamed
+   over path, so that path always holds a complete checkpoint. 0 on success */
+int checkpoint_save (const struct simulation *s, const char *path);
+
+/* Restore s (which holds no lattice: fresh, or after simulation_free ())
+   from the checkpoint at path, read through mmap. 0 on success, -1 if the
+   file can not be read or is not a checkpoint of this version and build */
+int checkpoint_load (struct simulation *s, const char *path);
+
+#endif
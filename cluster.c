@@ -0,0 +1,128 @@
+// Cluster moves (Swendsen-Wang) of the spins of the Contact Process Ising
+// Model.
+//
+// The spins (+1 and -1 sites) form a diluted Ising model on the occupied
+// sites, and near Tc single spin flips decorrelate slowly. A Swendsen-Wang
+// step puts a bond between each pair of spins of the Ising neighboorhood
+// (NN or NNN) that satisfies the coupling (same sign for a ferromagnet,
+// J < 0; opposite signs for an antiferromagnet), with probability
+//   p = 1 - exp (-2|J|/T)
+// joins bonded spins in clusters (union-find), and flips each cluster with
+// probability 1/2. Flipping a cluster keeps its bonds satisfied, so this
+// is a valid Ising update for both signs of J. Vacancies and
+// undifferentiated sites take no part in it: the Contact Process steps of
+// update_lattice() are untouched. With s->cluster_interval = k > 0,
+// update_lattice() runs a step every k generations (a serial pass, about
+// the cost of one random sequential generation).
+
+#include <stdlib.h>
+#include <math.h>
+#include "rng.h"
+#include "simulation.h"
+#include "kernels.h"
+
+
+/* Can s run cluster steps? 0 if so */
+int cluster_supported (const struct simulation *s)
+  {
+  // Sites are stored as 32 bit numbers
+  return s->n_sites < INT32_MAX ? 0 : -1;
+  }
+
+
+/* Root of the cluster of p (with path halving) */
+static inline int32_t find (int32_t *parent, int32_t p)
+  {
+  while (parent[p] != p)
+    {
+    parent[p] = parent[parent[p]];
+    p = parent[p];
+    }
+  return p;
+  }
+
+/* Join the clusters of p and q; the root is the smallest site of a cluster */
+static inline void join (int32_t *parent, int32_t p, int32_t q)
+  {
+  p = find (parent, p);
+  q = find (parent, q);
+  if (p < q)
+    parent[q] = p;
+  else if (q < p)
+    parent[p] = q;
+  }
+
+
+/* One Swendsen-Wang step of the spins of s */
+int cluster_update (struct simulation *s)
+  {
+  const int neighbors = (s->Ising_neighboorhood == 2) ? 12 : 4;
+  const int wrap_mode = wrap_mode_of (s);
+  uint64_t bond = rate_threshold (1 - exp (-2 * fabs (s->J) / s->T));
+  int satisfied = (s->J < 0) ? 1 : -1;  /* s_i*s_j of a satisfied pair */
+  int32_t *parent;
+  int8_t *flip;
+  int32_t p, q, root;
+  int state, nx, ny;
+  long i;
+  if (cluster_supported (s) != 0 || s->J == 0)
+    return 0;
+  parent = malloc ((size_t) s->n_sites * sizeof (int32_t));
+  flip = malloc ((size_t) s->n_sites);
+  if (parent == NULL || flip == NULL)
+    {
+    free (parent);
+    free (flip);
+    return -1;
+    }
+  for (p = 0; p < (int32_t) s->n_sites; p++)
+    parent[p] = p;
+
+  // Bonds, each pair seen once: from each spin to its neighboors "ahead"
+  for (int y = 0; y < s->y_size; y++)
+    for (int x = 0; x < s->x_size; x++)
+      {
+      state = get_site (s, site_index (s, x, y));
+      if (state != 1 && state != -1)
+        continue;
+      p = (int32_t) y * s->x_size + x;
+      for (int n = 0; n < neighbors; n++)
+        {
+        const int dx = neighbor_offsets[n][0], dy = neighbor_offsets[n][1];
+        if (dy < 0 || (dy == 0 && dx < 0))
+          continue;
+        if (!lattice_neighbor (s, x, y, dx, dy, &nx, &ny)
+            || state * get_site (s, site_index (s, nx, ny)) != satisfied)
+          continue;
+        if (draw_below (&s->rng, bond))
+          join (parent, p, (int32_t) ny * s->x_size + nx);
+        }
+      }
+
+  // Each cluster flips with probability 1/2, decided at its root (its first site)
+  for (int y = 0; y < s->y_size; y++)
+    for (int x = 0; x < s->x_size; x++)
+      {
+      i = site_index (s, x, y);
+      state = get_site (s, i);
+      if (state != 1 && state != -1)
+        continue;
+      q = (int32_t) y * s->x_size + x;
+      root = find (parent, q);
+      if (root == q)
+        flip[q] = (int8_t) (rng_next (&s->rng) >> 63);
+      if (!flip[root])
+        continue;
+      change_site (s, x, y, i, -state, wrap_mode);
+      s->up += (state == -1) - (state == 1);
+      s->down += (state == 1) - (state == -1);
+      }
+  free (parent);
+  free (flip);
+  // The flips went through change_site (field cache, block counts) and
+  // left the occupancy (active set) as it was: only the tables of the kmc
+  // and multispin engines, which follow the spins, are stale
+  kmc_invalidate (s);
+  multispin_invalidate (s);
+  return 0;
+  }
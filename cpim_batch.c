@@ -0,0 +1,682 @@
+// Command line (headless) driver for the Contact Process Ising Model.
+// Runs the same simulation core as the Gtk app (simulation.c) but without
+// any display, so it can be used on cluster nodes.
+//
+// Example:
+//   ./cpim-batch --beta 0.003 --delta 0.0001 --alpha 0.1 --temperature 2.269
+//                --coupling ferro --radius 1 --init 1 --sweeps 10000 --seed 42
+//   ./cpim-batch --tempering 2.0,2.1,2.2,2.269,2.35,2.5 --exchange 10 --sweeps 10000
+//   ./cpim-batch --batch 4096 --size 64 --init 3 --sweeps 1000
+//   ./cpim-batch --observables run.csv --every 10 --sample 0 --sweeps 100000
+//   ./cpim-batch --checkpoint run.ckpt --checkpoint-every 1000 --sweeps 100000
+//   ./cpim-batch --restart run.ckpt --checkpoint run.ckpt --sweeps 50000
+//   ./cpim-batch --movie run.movie --movie-every 10 --size 1024 --sweeps 100000
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>    /* Used to seed pseudo-random number generator and to time runs */
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "rng.h"     /* Pseudo-random number generators */
+#include "simulation.h"
+#include "tempering.h"  /* Replica exchange */
+#include "replicas.h"   /* Batched seed replicas */
+#include "observables.h" /* Time series of the observables */
+#include "checkpoint.h"  /* Checkpoint and restart */
+#include "movie.h"       /* Time-lapse movies of the lattice */
+
+/* Defaults of the batch run */
+#define SWEEPS 1000
+#define SAMPLE_RATE 100
+/* Largest number of temperatures of a tempering ladder */
+#define MAX_REPLICAS 256
+
+
+static void usage (const char *program)
+  {
+  fprintf (stderr,
+    "Usage: %s [options]\n"
+    "  -b, --beta VALUE         birth/colonization rate (default %g)\n"
+    "  -d, --delta VALUE        death rate (default %g)\n"
+    "  -a, --alpha VALUE        differentiation rate (default %g)\n"
+    "  -T, --temperature VALUE  Ising temperature (default %g)\n"
+    "  -J, --coupling VALUE     Ising coupling: ferro, anti-ferro or a number (default ferro)\n"
+    "  -r, --radius 1|2         Ising neighbourhood: NN (1) or NNN (2) (default %d)\n"
+    "  -i, --init 1..5          initial condition (default %d)\n"
+    "  -L, --size L|WxH         lattice side, or width x height (default %dx%d)\n"
+    "  -B, --boundary NAME      periodic (torus), halo (torus on a halo-padded lattice)\n"
+    "                           or open (absorbing edges) (default periodic)\n"
+    "  -S, --schedule NAME      random (sequential), checkerboard (parallel sublattices),\n"
+    "                           domain (parallel random sequential tiles), kmc (event\n"
+    "                           driven, for low rates) or active (random sequential over\n"
+    "                           the sites next to the colony) (default random)\n"
+    "  -R, --rounds N           rounds per generation of the domain schedule (default %d)\n"
+    "  -t, --threads N          threads of the parallel schedules (default: all cores)\n"
+    "  -M, --multispin          run the checkerboard schedule on bit planes, 64 sites at a\n"
+    "                           time (the width must be a multiple of the colors)\n"
+    "  -V, --simd NAME          run the checkerboard schedule with the vector engine: auto,\n"
+    "                           scalar, avx2 or avx512 (needs -B halo or open)\n"
+    "  -C, --cluster K          a Swendsen-Wang cluster step of the spins every K\n"
+    "                           generations (default 0: none)\n"
+    "  -F, --field-cache        keep the local field of every site up to date instead of\n"
+    "                           summing it on each spin visit (random, domain, active)\n"
+    "  -X, --tempering T1,T2,.. run one replica per temperature (increasing) in parallel\n"
+    "                           and swap neighbouring temperatures (replica exchange);\n"
+    "                           prints the observables and swap acceptance of each one\n"
+    "  -x, --exchange N         generations between two rounds of swaps (default %d)\n"
+    "  -K, --batch N            run N seed replicas (rounded up to a multiple of %d) in\n"
+    "                           lockstep, vectorized across replicas, in the order of the\n"
+    "                           checkerboard schedule (-V picks the kernel); prints the\n"
+    "                           surviving fraction and the mean observables\n"
+    "  -n, --sweeps N           generations to simulate (default %d)\n"
+    "  -s, --seed N             seed of the random number generator (default: time)\n"
+    "  -g, --rng NAME           random number generator: mt64, xoshiro, pcg64 or philox\n"
+    "                           (default mt64)\n"
+    "  -p, --sample N           print observables every N generations, 0 = only at the end (default %d)\n"
+    "  -o, --observables FILE   stream the observables (counts, Ising energy, magnetization)\n"
+    "                           to FILE from a writer thread\n"
+    "  -O, --format NAME        format of the stream: csv, ndjson or binary (default csv)\n"
+    "  -e, --every N            generations between two samples of the stream (default 1)\n"
+    "  -c, --checkpoint FILE    write a checkpoint of the run to FILE at the end\n"
+    "  -k, --checkpoint-every N also write it every N generations (default 0: only at the end)\n"
+    "  -m, --movie FILE         record a time-lapse movie of the lattice to FILE from a writer\n"
+    "                           thread (./cpim-movie exports its frames to PNG)\n"
+    "  -f, --movie-every N      generations between two frames of the movie (default %d)\n"
+    "  -l, --restart FILE       continue the run of the checkpoint FILE for --sweeps more\n"
+    "                           generations, bit for bit as if it had not stopped (the model,\n"
+    "                           lattice, schedule and generator options come from FILE)\n"
+    "  -h, --help               show this help\n",
+    program, BETA, DELTA, ALPHA, TEMPERATURE, RADIUS, INIT, X_SIZE, Y_SIZE, DOMAIN_ROUNDS,
+    EXCHANGE_INTERVAL, REPLICA_BLOCK, SWEEPS, SAMPLE_RATE, SAMPLE_RATE);
+  }
+
+
+static void print_observables (const struct simulation *s)
+  {
+  printf ("Gen: %d \t Vacancy: %f \t Occupancy: %f \t Up: %f \t Down: %f\n",
+          s->generation_time,
+          (double) s->vacancy / (double) s->n_sites,
+          (double) s->occupancy / (double) s->n_sites,
+          (double) s->up / (double) s->occupancy,
+          (double) s->down / (double) s->occupancy);
+  }
+
+
+/* Parse "T1,T2,..." into temperatures; number of temperatures, -1 if
+   one is not positive or they do not increase */
+static int parse_temperatures (const char *text, double *temperatures, int max)
+  {
+  char *end;
+  int n = 0;
+  for (;;)
+    {
+    if (n == max)
+      return -1;
+    temperatures[n] = strtod (text, &end);
+    if (end == text || temperatures[n] <= 0 || (n > 0 && temperatures[n] <= temperatures[n - 1]))
+      return -1;
+    n ++;
+    if (*end == '\0')
+      return n;
+    if (*end != ',')
+      return -1;
+    text = end + 1;
+    }
+  }
+
+
+/* Run the ladder of temperatures with replica exchange */
+static int run_tempering (const struct simulation *s, const double *temperatures, int replicas,
+                          int exchange_interval, int sweeps, int sample_rate)
+  {
+  struct tempering t;
+  struct timespec start, end;
+  double seconds;
+  int generation;
+  if (tempering_alloc (&t, s, temperatures, replicas, exchange_interval) != 0)
+    {
+    fprintf (stderr, "Could not allocate %d replicas\n", replicas);
+    return EXIT_FAILURE;
+    }
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  for (generation = 0; generation < sweeps; generation++)
+    {
+    if (tempering_update (&t) != 0)
+      {
+      fprintf (stderr, "Out of memory in generation %d: the run stops there\n", t.generation_time + 1);
+      break;
+      }
+    if (sample_rate > 0 && t.generation_time % sample_rate == 0)
+      for (int k = 0; k < replicas; k++)
+        {
+        printf ("T: %g \t ", t.temperature[k]);
+        print_observables (&t.replica[t.slot[k]]);
+        }
+    }
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  seconds = (double) (end.tv_sec - start.tv_sec) + 1e-9 * (double) (end.tv_nsec - start.tv_nsec);
+
+  // Averages over the run, and the acceptance of the swaps with the next temperature
+  printf ("T\toccupancy\t|m|\tenergy/site\tswap acceptance\n");
+  for (int k = 0; k < replicas; k++)
+    {
+    printf ("%g\t%f\t%f\t%f\t", t.temperature[k], tempering_occupancy (&t, k),
+            tempering_magnetization (&t, k), tempering_energy (&t, k));
+    if (tempering_acceptance (&t, k) < 0)
+      printf ("-\n");
+    else
+      printf ("%f\n", tempering_acceptance (&t, k));
+    }
+  fprintf (stderr, "%d sweeps of %d replicas of %dx%d in %.3f s (%.1f sweeps/s), seed %llu (%s)\n",
+           generation, replicas, s->x_size, s->y_size, seconds, seconds > 0 ? generation / seconds : 0.0,
+           s->seed, rng_name (s->rng_backend));
+  tempering_free (&t);
+  return (generation == sweeps) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+
+/* Surviving fraction of the batch, mean occupancy, and mean up and down
+   fractions of the surviving replicas */
+static void print_batch (const struct replicas *b)
+  {
+  double occupancy = 0, up = 0, down = 0;
+  long surviving = replicas_surviving (b);
+  for (int r = 0; r < b->count; r++)
+    {
+    occupancy += (double) b->occupancy[r] / (double) b->n_sites;
+    if (b->occupancy[r] > 0)
+      {
+      up += (double) b->up[r] / (double) b->occupancy[r];
+      down += (double) b->down[r] / (double) b->occupancy[r];
+      }
+    }
+  printf ("Gen: %d \t Surviving: %f \t Occupancy: %f \t Up: %f \t Down: %f\n",
+          b->generation_time, (double) surviving / (double) b->count, occupancy / (double) b->count,
+          surviving ? up / (double) surviving : 0.0, surviving ? down / (double) surviving : 0.0);
+  }
+
+
+/* Run count seed replicas of s in lockstep */
+static int run_batch (const struct simulation *s, int count, int sweeps, int sample_rate)
+  {
+  struct replicas b;
+  struct timespec start, end;
+  double seconds;
+  if (replicas_alloc (&b, s, count) != 0)
+    {
+    fprintf (stderr, "Could not allocate %d replicas\n", count);
+    return EXIT_FAILURE;
+    }
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  for (int generation = 0; generation < sweeps; generation++)
+    {
+    replicas_update (&b);
+    if (sample_rate > 0 && b.generation_time % sample_rate == 0)
+      print_batch (&b);
+    }
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  seconds = (double) (end.tv_sec - start.tv_sec) + 1e-9 * (double) (end.tv_nsec - start.tv_nsec);
+
+  if (sample_rate <= 0)
+    print_batch (&b);
+  fprintf (stderr, "%d sweeps of %d replicas of %dx%d in %.3f s (%.1f sweeps/s), seed %llu (%s)\n",
+           sweeps, b.count, s->x_size, s->y_size, seconds, seconds > 0 ? sweeps / seconds : 0.0,
+           s->seed, simd_name (b.simd));
+  replicas_free (&b);
+  return EXIT_SUCCESS;
+  }
+
+
+/* Parse "L" or "WxH" */
+static int parse_size (const char *text, int *x_size, int *y_size)
+  {
+  char *end;
+  long width = strtol (text, &end, 10);
+  long height = width;
+  if (*end == 'x' || *end == 'X')
+    height = strtol (end + 1, &end, 10);
+  if (*end != '\0' || width < MIN_SIZE || height < MIN_SIZE || width > 1L << 20 || height > 1L << 20)
+    return -1;
+  *x_size = (int) width;
+  *y_size = (int) height;
+  return 0;
+  }
+
+
+int main (int argc, char **argv)
+  {
+  struct simulation *s;
+  int x_size = X_SIZE, y_size = Y_SIZE;
+  int boundary = BOUNDARY_PERIODIC;
+  int sweeps = SWEEPS;
+  int sample_rate = SAMPLE_RATE;
+  unsigned long long seed = (unsigned long long) time (NULL);
+  double temperatures[MAX_REPLICAS];
+  int replicas = 0, exchange_interval = EXCHANGE_INTERVAL;
+  int batch = 0;
+  const char *observables_path = NULL;
+  int observables_format = OBSERVABLES_CSV, observables_interval = 1;
+  struct observables observables;
+  const char *checkpoint_path = NULL, *restart_path = NULL;
+  int checkpoint_interval = 0;
+  const char *movie_path = NULL;
+  int movie_interval = SAMPLE_RATE;
+  struct movie movie;
+  static struct option long_options[] =
+    {
+    {"beta",        required_argument, 0, 'b'},
+    {"delta",       required_argument, 0, 'd'},
+    {"alpha",       required_argument, 0, 'a'},
+    {"temperature", required_argument, 0, 'T'},
+    {"coupling",    required_argument, 0, 'J'},
+    {"radius",      required_argument, 0, 'r'},
+    {"init",        required_argument, 0, 'i'},
+    {"size",        required_argument, 0, 'L'},
+    {"boundary",    required_argument, 0, 'B'},
+    {"schedule",    required_argument, 0, 'S'},
+    {"rounds",      required_argument, 0, 'R'},
+    {"threads",     required_argument, 0, 't'},
+    {"field-cache", no_argument,       0, 'F'},
+    {"cluster",     required_argument, 0, 'C'},
+    {"multispin",   no_argument,       0, 'M'},
+    {"simd",        required_argument, 0, 'V'},
+    {"tempering",   required_argument, 0, 'X'},
+    {"exchange",    required_argument, 0, 'x'},
+    {"batch",       required_argument, 0, 'K'},
+    {"sweeps",      required_argument, 0, 'n'},
+    {"seed",        required_argument, 0, 's'},
+    {"rng",         required_argument, 0, 'g'},
+    {"sample",      required_argument, 0, 'p'},
+    {"observables", required_argument, 0, 'o'},
+    {"format",      required_argument, 0, 'O'},
+    {"every",       required_argument, 0, 'e'},
+    {"checkpoint",  required_argument, 0, 'c'},
+    {"checkpoint-every", required_argument, 0, 'k'},
+    {"restart",     required_argument, 0, 'l'},
+    {"movie",       required_argument, 0, 'm'},
+    {"movie-every", required_argument, 0, 'f'},
+    {"help",        no_argument,       0, 'h'},
+    {0, 0, 0, 0}
+    };
+  int option;
+
+  s = calloc (1, sizeof (struct simulation));
+  if (s == NULL)
+    {
+    fprintf (stderr, "Could not allocate the simulation\n");
+    return EXIT_FAILURE;
+    }
+  simulation_defaults (s);
+
+  while ((option = getopt_long (argc, argv, "b:d:a:T:J:r:i:L:B:S:R:t:FC:MV:X:x:K:n:s:g:p:o:O:e:c:k:l:m:f:h", long_options, NULL)) != -1)
+    {
+    switch (option)
+      {
+      case 'b': s->birth_rate = atof (optarg); break;
+      case 'd': s->death_rate = atof (optarg); break;
+      case 'a': s->differentiation_rate = atof (optarg); break;
+      case 'T': s->T = atof (optarg); break;
+      case 'J':
+        if (strcmp (optarg, "ferro") == 0)
+          s->J = -1 * (double) COUPLING;
+        else if (strcmp (optarg, "anti-ferro") == 0)
+          s->J =  1 * (double) COUPLING;
+        else
+          s->J = atof (optarg);
+        break;
+      case 'r': s->Ising_neighboorhood = atoi (optarg); break;
+      case 'i': s->init_option = atoi (optarg); break;
+      case 'L':
+        if (parse_size (optarg, &x_size, &y_size) != 0)
+          {
+          fprintf (stderr, "size must be L or WxH with sides of at least %d\n", MIN_SIZE);
+          free (s);
+          return EXIT_FAILURE;
+          }
+        break;
+      case 'B':
+        boundary = boundary_from_name (optarg);
+        if (boundary < 0)
+          {
+          fprintf (stderr, "boundary must be periodic, halo or open\n");
+          free (s);
+          return EXIT_FAILURE;
+          }
+        break;
+      case 'S':
+        s->schedule = schedule_from_name (optarg);
+        if (s->schedule < 0)
+          {
+          fprintf (stderr, "schedule must be random, checkerboard, domain, kmc or active\n");
+          free (s);
+          return EXIT_FAILURE;
+          }
+        break;
+      case 'R': s->domain_rounds = atoi (optarg); break;
+      case 't':
+#ifdef _OPENMP
+        omp_set_num_threads (atoi (optarg));
+#endif
+        break;
+      case 'F': s->use_field_cache = 1; break;
+      case 'C': s->cluster_interval = atoi (optarg); break;
+      case 'M': s->use_multispin = 1; break;
+      case 'V':
+        s->simd = simd_from_name (optarg);
+        if (s->simd < 0)
+          {
+          fprintf (stderr, "simd must be off, auto, scalar, avx2 or avx512\n");
+          free (s);
+          return EXIT_FAILURE;
+          }
+        break;
+      case 'X':
+        replicas = parse_temperatures (optarg, temperatures, MAX_REPLICAS);
+        if (replicas < 1)
+          {
+          fprintf (stderr, "tempering must be up to %d increasing, positive temperatures\n",
+                   MAX_REPLICAS);
+          free (s);
+          return EXIT_FAILURE;
+          }
+        break;
+      case 'x': exchange_interval = atoi (optarg); break;
+      case 'K': batch = atoi (optarg); break;
+      case 'n': sweeps = atoi (optarg); break;
+      case 's': seed = strtoull (optarg, NULL, 10); break;
+      case 'g':
+        s->rng_backend = rng_from_name (optarg);
+        if (s->rng_backend < 0)
+          {
+          fprintf (stderr, "rng must be mt64, xoshiro, pcg64 or philox\n");
+          free (s);
+          return EXIT_FAILURE;
+          }
+        break;
+      case 'p': sample_rate = atoi (optarg); break;
+      case 'o': observables_path = optarg; break;
+      case 'O':
+        observables_format = observables_format_from_name (optarg);
+        if (observables_format < 0)
+          {
+          fprintf (stderr, "format must be csv, ndjson or binary\n");
+          free (s);
+          return EXIT_FAILURE;
+          }
+        break;
+      case 'e': observables_interval = atoi (optarg); break;
+      case 'c': checkpoint_path = optarg; break;
+      case 'k': checkpoint_interval = atoi (optarg); break;
+      case 'l': restart_path = optarg; break;
+      case 'm': movie_path = optarg; break;
+      case 'f': movie_interval = atoi (optarg); break;
+      case 'h': usage (argv[0]); free (s); return EXIT_SUCCESS;
+      default:  usage (argv[0]); free (s); return EXIT_FAILURE;
+      }
+    }
+  if (s->Ising_neighboorhood != 1 && s->Ising_neighboorhood != 2)
+    {
+    fprintf (stderr, "radius must be 1 (NN) or 2 (NNN)\n");
+    free (s);
+    return EXIT_FAILURE;
+    }
+  if (s->init_option < 1 || s->init_option > 5)
+    {
+    fprintf (stderr, "init must be between 1 and 5\n");
+    free (s);
+    return EXIT_FAILURE;
+    }
+  if (s->T <= 0)
+    {
+    fprintf (stderr, "temperature must be positive\n");
+    free (s);
+    return EXIT_FAILURE;
+    }
+  if (s->use_field_cache && field_cache_supported (s) != 0)
+    {
+    fprintf (stderr, "The field cache needs the random, domain or active schedule\n");
+    free (s);
+    return EXIT_FAILURE;
+    }
+  if (s->domain_rounds < 1)
+    {
+    fprintf (stderr, "rounds must be at least 1\n");
+    free (s);
+    return EXIT_FAILURE;
+    }
+  if (observables_interval < 1 || (observables_path != NULL && (replicas > 0 || batch > 0)))
+    {
+    fprintf (stderr, "every must be at least 1, and the stream of observables goes without -X or -K\n");
+    free (s);
+    return EXIT_FAILURE;
+    }
+
+  if (movie_interval < 1 || (movie_path != NULL && (replicas > 0 || batch > 0)))
+    {
+    fprintf (stderr, "movie-every must be at least 1, and movies go without -X or -K\n");
+    free (s);
+    return EXIT_FAILURE;
+    }
+  if (checkpoint_interval < 0 || (checkpoint_interval > 0 && checkpoint_path == NULL)
+      || ((checkpoint_path != NULL || restart_path != NULL) && (replicas > 0 || batch > 0)))
+    {
+    fprintf (stderr, "checkpoint-every needs --checkpoint, and checkpoints go without -X or -K\n");
+    free (s);
+    return EXIT_FAILURE;
+    }
+
+  if (restart_path != NULL)
+    {
+    // The checkpoint brings its own lattice, parameters and generators
+    if (checkpoint_load (s, restart_path) != 0)
+      {
+      fprintf (stderr, "Could not restart from %s: not a checkpoint of this version and build\n",
+               restart_path);
+      free (s);
+      return EXIT_FAILURE;
+      }
+    seed = s->seed;
+    }
+  else if (simulation_alloc (s, x_size, y_size, boundary) != 0)
+    {
+    fprintf (stderr, "Could not allocate a %dx%d lattice\n", x_size, y_size);
+    free (s);
+    return EXIT_FAILURE;
+    }
+
+  if (batch < 0 || (batch > 0 && (replicas > 0 || s->use_multispin || s->use_field_cache
+                                   || s->cluster_interval != 0)))
+    {
+    fprintf (stderr, "batch must be positive, without -X, -M, -F or -C\n");
+    simulation_free (s);
+    free (s);
+    return EXIT_FAILURE;
+    }
+  if (batch > 0)
+    {
+    int status;
+    if (replicas_supported (s) != 0)
+      {
+      fprintf (stderr, "Batched replicas need sides that are multiples of %s\n",
+               s->Ising_neighboorhood == 2 ? "8 (width) and 4 (height)" : "2");
+      simulation_free (s);
+      free (s);
+      return EXIT_FAILURE;
+      }
+    if (s->simd != SIMD_OFF && s->simd != SIMD_AUTO && !simd_available (s->simd))
+      fprintf (stderr, "This CPU does not run the %s kernel: using the scalar one (same results)\n",
+               simd_name (s->simd));
+    simulation_seed (s, seed);
+    status = run_batch (s, batch, sweeps, sample_rate);
+    simulation_free (s);
+    free (s);
+    return status;
+    }
+
+  if (s->schedule == SCHEDULE_CHECKERBOARD && checkerboard_supported (s) != 0)
+    {
+    fprintf (stderr, "The checkerboard schedule needs sides that are multiples of %s\n",
+             s->Ising_neighboorhood == 2 ? "8 (width) and 4 (height)" : "2");
+    simulation_free (s);
+    free (s);
+    return EXIT_FAILURE;
+    }
+  if (s->use_multispin && (s->schedule != SCHEDULE_CHECKERBOARD || multispin_supported (s) != 0))
+    {
+    fprintf (stderr, "The multispin engine needs the checkerboard schedule and a width that\n"
+                     "is a multiple of %d\n", s->Ising_neighboorhood == 2 ? 8 : 2);
+    simulation_free (s);
+    free (s);
+    return EXIT_FAILURE;
+    }
+  if (s->simd != SIMD_OFF
+      && (s->schedule != SCHEDULE_CHECKERBOARD || s->use_multispin || simd_supported (s) != 0))
+    {
+    fprintf (stderr, "The vector engine needs the checkerboard schedule (without -M), the int8\n"
+                     "lattice layout and the halo or open boundary\n");
+    simulation_free (s);
+    free (s);
+    return EXIT_FAILURE;
+    }
+  if (s->simd != SIMD_OFF && !simd_available (s->simd))
+    fprintf (stderr, "This CPU does not run the %s kernel: using the scalar one (same results)\n",
+             simd_name (s->simd));
+  if ((s->schedule == SCHEDULE_KMC && kmc_supported (s) != 0)
+      || (s->schedule == SCHEDULE_ACTIVE && active_supported (s) != 0))
+    {
+    fprintf (stderr, "The kmc and active schedules handle lattices of up to 2^31 sites\n");
+    simulation_free (s);
+    free (s);
+    return EXIT_FAILURE;
+    }
+  if (s->schedule == SCHEDULE_DOMAIN && domain_supported (s) != 0)
+    {
+    fprintf (stderr, "The domain schedule needs the byte (int8 or int) lattice layouts\n");
+    simulation_free (s);
+    free (s);
+    return EXIT_FAILURE;
+    }
+
+  if (s->cluster_interval < 0 || (s->cluster_interval > 0 && cluster_supported (s) != 0))
+    {
+    fprintf (stderr, "cluster must be 0 (none) or a positive interval, on lattices of up to\n"
+                     "2^31 sites\n");
+    simulation_free (s);
+    free (s);
+    return EXIT_FAILURE;
+    }
+  if (exchange_interval < 1)
+    {
+    fprintf (stderr, "exchange must be at least 1\n");
+    simulation_free (s);
+    free (s);
+    return EXIT_FAILURE;
+    }
+
+  /* Initialize the random number generator */
+  if (restart_path == NULL)
+    simulation_seed (s, seed);
+  if (replicas > 0)
+    {
+    int status = run_tempering (s, temperatures, replicas, exchange_interval, sweeps, sample_rate);
+    simulation_free (s);
+    free (s);
+    return status;
+    }
+  if (restart_path == NULL)
+    init_lattice (s);
+  if (observables_path != NULL)
+    {
+    if (observables_open (&observables, observables_path, s, observables_format, observables_interval) != 0)
+      {
+      fprintf (stderr, "Could not open %s\n", observables_path);
+      simulation_free (s);
+      free (s);
+      return EXIT_FAILURE;
+      }
+    observables_sample (&observables, s);
+    }
+  if (movie_path != NULL)
+    {
+    if (movie_open (&movie, movie_path, s, movie_interval, MOVIE_KEYFRAME) != 0)
+      {
+      fprintf (stderr, "Could not open %s\n", movie_path);
+      if (observables_path != NULL)
+        observables_close (&observables);
+      simulation_free (s);
+      free (s);
+      return EXIT_FAILURE;
+      }
+    movie_frame (&movie, s);
+    }
+
+  struct timespec start, end;
+  int generation;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  for (generation = 0; generation < sweeps; generation++)
+    {
+    if (update_lattice (s) != 0)
+      {
+      fprintf (stderr, "Out of memory in generation %d: the run stops there\n", s->generation_time + 1);
+      break;
+      }
+    if (observables_path != NULL)
+      observables_sample (&observables, s);
+    if (movie_path != NULL)
+      movie_frame (&movie, s);
+    if (sample_rate > 0 && s->generation_time % sample_rate == 0)
+      print_observables (s);
+    if (checkpoint_interval > 0 && s->generation_time % checkpoint_interval == 0
+        && checkpoint_save (s, checkpoint_path) != 0)
+      fprintf (stderr, "Could not write the checkpoint %s at generation %d\n",
+               checkpoint_path, s->generation_time);
+    }
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  double seconds = (double) (end.tv_sec - start.tv_sec) + 1e-9 * (double) (end.tv_nsec - start.tv_nsec);
+
+  if (sample_rate <= 0)
+    print_observables (s);
+  fprintf (stderr, "%d sweeps of %dx%d in %.3f s (%.1f sweeps/s), seed %llu (%s)\n",
+           generation, s->x_size, s->y_size, seconds, seconds > 0 ? generation / seconds : 0.0, seed,
+           rng_name (s->rng_backend));
+  if (observables_path != NULL)
+    {
+    if (observables_dropped (&observables) > 0)
+      fprintf (stderr, "%ld samples of the observables dropped (the writer fell behind)\n",
+               observables_dropped (&observables));
+    if (observables_close (&observables) != 0)
+      {
+      fprintf (stderr, "Could not write %s\n", observables_path);
+      simulation_free (s);
+      free (s);
+      return EXIT_FAILURE;
+      }
+    }
+  if (movie_path != NULL)
+    {
+    if (movie_dropped (&movie) > 0)
+      fprintf (stderr, "%ld frames of the movie dropped (the writer fell behind)\n",
+               movie_dropped (&movie));
+    if (movie_close (&movie) != 0)
+      {
+      fprintf (stderr, "Could not write %s\n", movie_path);
+      simulation_free (s);
+      free (s);
+      return EXIT_FAILURE;
+      }
+    }
+  // A generation cut short is no place to resume from
+  if (checkpoint_path != NULL && generation == sweeps && checkpoint_save (s, checkpoint_path) != 0)
+    {
+    fprintf (stderr, "Could not write the checkpoint %s\n", checkpoint_path);
+    simulation_free (s);
+    free (s);
+    return EXIT_FAILURE;
+    }
+  simulation_free (s);
+  free (s);
+  return (generation == sweeps) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
@@ -0,0 +1,429 @@
+// Throughput benchmark of the simulation core: sweeps per second of
+// update_lattice() for a range of lattice sizes (and a given schedule and
+// random number generator), plus a statistical sanity check of the
+// generators.
+//
+// The lattice layout is chosen at compile time (see site_t in simulation.h),
+// so the makefile builds one benchmark per layout:
+//   make bench    builds cpim-bench-int, cpim-bench-int8 and cpim-bench-packed
+//   ./cpim-bench-int8 --sizes 256,1024,4096 --seconds 2 --rng all
+//   ./cpim-bench-int8 --check --rng all
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <math.h>
+#include <time.h>
+#include "rng.h"     /* Pseudo-random number generators */
+#include "simulation.h"
+
+/* Defaults of the benchmark */
+#define SIZES "256,512,1024,2048,4096,8192,16384"
+#define SECONDS 1.0
+#define BENCH_SEED 5489ULL
+// Generations simulated before timing (lets spins differentiate)
+#define WARMUP 2
+
+/* Sanity check: draws of the uniformity test, and the pure Ising runs */
+#define CHECK_DRAWS (1 << 22)
+#define CHECK_BINS 256
+#define CHECK_SIZE 64
+#define CHECK_EQUILIBRATION 500
+#define CHECK_SWEEPS 2000
+// Largest accepted |<|m|> - Onsager| below Tc, and <|m|> above Tc
+#define CHECK_TOLERANCE 0.01
+#define CHECK_DISORDER 0.1
+// Vector engine: side (not a multiple of the 64 site chunks) and generations
+// of the comparison of its kernels
+#define CHECK_SIMD_SIZE 200
+#define CHECK_SIMD_SWEEPS 50
+
+/* Ising radius, field cache and engines of every simulation of the benchmark */
+static int bench_radius = 1;
+static int bench_field_cache = 0;
+static int bench_multispin = 0;
+static int bench_simd = SIMD_OFF;
+static int bench_cluster = 0;
+
+
+static double now (void)
+  {
+  struct timespec t;
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return (double) t.tv_sec + 1e-9 * (double) t.tv_nsec;
+  }
+
+
+static void usage (const char *program)
+  {
+  fprintf (stderr,
+    "Usage: %s [options]\n"
+    "  -L, --sizes L1,L2,...    lattice sides to time (default %s)\n"
+    "  -t, --seconds S          minimum time spent on each size (default %g)\n"
+    "  -B, --boundary NAME      periodic, halo or open (default periodic)\n"
+    "  -i, --init 1..5          initial condition (default 5, fully occupied)\n"
+    "  -S, --schedule NAME      random, checkerboard, domain, kmc or active (default random,\n"
+    "                           or checkerboard with --multispin or --simd)\n"
+    "  -g, --rng NAME           mt64, xoshiro, pcg64, philox or all (default mt64)\n"
+    "  -r, --radius 1|2         Ising neighbourhood: NN (1) or NNN (2) (default 1)\n"
+    "  -F, --field-cache        keep the local fields in a cache (see cpim-batch)\n"
+    "  -C, --cluster K          a cluster step of the spins every K generations\n"
+    "  -M, --multispin          bit-plane engine of the checkerboard schedule\n"
+    "  -V, --simd NAME          vector engine of the checkerboard schedule: auto, scalar,\n"
+    "                           avx2 or avx512 (with --check, also compares the kernels)\n"
+    "  -c, --check              check the generators instead of timing them (the Ising\n"
+    "                           runs are on a torus, whatever the boundary)\n"
+    "  -h, --help               show this help\n",
+    program, SIZES, SECONDS);
+  }
+
+
+/* A simulation of the benchmark (or of the checks); 0 on success */
+static int bench_simulation (struct simulation *s, int size, int boundary, int schedule, int backend)
+  {
+  memset (s, 0, sizeof (*s));
+  simulation_defaults (s);
+  s->schedule = schedule;
+  s->rng_backend = backend;
+  s->Ising_neighboorhood = bench_radius;
+  s->use_field_cache = bench_field_cache;
+  s->use_multispin = bench_multispin;
+  s->simd = bench_simd;
+  s->cluster_interval = bench_cluster;
+  if (simulation_alloc (s, size, size, boundary) != 0)
+    return -1;
+  if ((schedule == SCHEDULE_CHECKERBOARD && checkerboard_supported (s) != 0)
+      || (schedule == SCHEDULE_DOMAIN && domain_supported (s) != 0)
+      || (schedule == SCHEDULE_KMC && kmc_supported (s) != 0)
+      || (schedule == SCHEDULE_ACTIVE && active_supported (s) != 0)
+      || (s->use_field_cache && field_cache_supported (s) != 0)
+      || (s->cluster_interval > 0 && cluster_supported (s) != 0)
+      || (s->use_multispin && (schedule != SCHEDULE_CHECKERBOARD || multispin_supported (s) != 0))
+      || (s->simd != SIMD_OFF && (schedule != SCHEDULE_CHECKERBOARD || s->use_multispin
+                                  || simd_supported (s) != 0)))
+    {
+    simulation_free (s);
+    return -1;
+    }
+  simulation_seed (s, BENCH_SEED);
+  return 0;
+  }
+
+
+/* Time update_lattice() on an L x L lattice; returns sweeps per second
+   (-1 if the lattice can not be allocated, the schedule not used, or an
+   engine runs out of memory) */
+static double time_sweeps (int size, int boundary, int schedule, int backend, int init_option,
+                           double min_seconds, int *sweeps)
+  {
+  struct simulation s;
+  double start, elapsed;
+  if (bench_simulation (&s, size, boundary, schedule, backend) != 0)
+    return -1;
+  s.init_option = init_option;
+  init_lattice (&s);
+  for (int generation = 0; generation < WARMUP; generation++)
+    if (update_lattice (&s) != 0)
+      {
+      simulation_free (&s);
+      return -1;
+      }
+  *sweeps = 0;
+  start = now ();
+  do
+    {
+    if (update_lattice (&s) != 0)
+      {
+      simulation_free (&s);
+      return -1;
+      }
+    (*sweeps) ++;
+    elapsed = now () - start;
+    }
+  while (elapsed < min_seconds);
+  simulation_free (&s);
+  return *sweeps / elapsed;
+  }
+
+
+/* Chi-square of the top and bottom bytes of CHECK_DRAWS outputs over
+   CHECK_BINS bins (CHECK_BINS-1 degrees of freedom) */
+static void uniformity (int backend, double *chi2_high, double *chi2_low)
+  {
+  static long high[CHECK_BINS], low[CHECK_BINS];
+  struct rng r;
+  double expected = (double) CHECK_DRAWS / CHECK_BINS;
+  uint64_t x;
+  memset (high, 0, sizeof (high));
+  memset (low, 0, sizeof (low));
+  rng_seed_stream (&r, backend, BENCH_SEED, 0);
+  for (long i = 0; i < CHECK_DRAWS; i++)
+    {
+    x = rng_next (&r);
+    high[x >> 56] ++;
+    low[x & 0xFF] ++;
+    }
+  *chi2_high = *chi2_low = 0;
+  for (int bin = 0; bin < CHECK_BINS; bin++)
+    {
+    *chi2_high += (high[bin] - expected) * (high[bin] - expected) / expected;
+    *chi2_low += (low[bin] - expected) * (low[bin] - expected) / expected;
+    }
+  }
+
+
+/* <|m|> of the pure Ising limit (no births, deaths, every site a spin)
+   at temperature T, from an ordered lattice; -1 on failure */
+static double ising_magnetization (int boundary, int schedule, int backend, double T)
+  {
+  struct simulation s;
+  double sum = 0;
+  if (bench_simulation (&s, CHECK_SIZE, boundary, schedule, backend) != 0)
+    return -1;
+  s.birth_rate = 0;
+  s.death_rate = 0;
+  s.T = T;
+  s.Ising_neighboorhood = 1;  /* Onsager's solution is the NN one */
+  s.init_option = 5;
+  init_lattice (&s);
+  for (int y = 0; y < s.y_size; y++)
+    for (int x = 0; x < s.x_size; x++)
+      set_site (&s, site_index (&s, x, y), 1);
+  halo_exchange (&s);
+  s.up = s.n_sites;
+  for (int generation = 0; generation < CHECK_EQUILIBRATION + CHECK_SWEEPS; generation++)
+    {
+    if (update_lattice (&s) != 0)
+      {
+      simulation_free (&s);
+      return -1;
+      }
+    if (generation >= CHECK_EQUILIBRATION)
+      sum += fabs ((double) (s.up - s.down)) / (double) s.n_sites;
+    }
+  simulation_free (&s);
+  return sum / CHECK_SWEEPS;
+  }
+
+
+/* Run every vector kernel this CPU has from the same seed and compare
+   their lattices with the one of the scalar reference; failures */
+static int check_simd (int boundary, int backend)
+  {
+  struct simulation reference, s;
+  int failures = 0, saved = bench_simd;
+  for (int kernel = SIMD_SCALAR; kernel <= SIMD_AVX512; kernel++)
+    {
+    if (!simd_available (kernel))
+      {
+      printf ("%s\tsimd %s: not run by this CPU\n", rng_name (backend), simd_name (kernel));
+      continue;
+      }
+    bench_simd = kernel;
+    if (bench_simulation (&s, CHECK_SIMD_SIZE, boundary, SCHEDULE_CHECKERBOARD, backend) != 0)
+      {
+      printf ("%s\tcould not run the vector engine on a %dx%d lattice\n",
+              rng_name (backend), CHECK_SIMD_SIZE, CHECK_SIMD_SIZE);
+      if (kernel != SIMD_SCALAR)
+        simulation_free (&reference);
+      bench_simd = saved;
+      return 1;
+      }
+    // Every rule in play: births, deaths, differentiation and flips
+    s.birth_rate = 0.5;
+    s.death_rate = 0.05;
+    s.differentiation_rate = 0.3;
+    s.T = 2.0;
+    s.init_option = 5;
+    init_lattice (&s);
+    for (int generation = 0; generation < CHECK_SIMD_SWEEPS; generation++)
+      update_lattice (&s);
+    if (kernel == SIMD_SCALAR)
+      {
+      reference = s;
+      continue;
+      }
+    if (memcmp (s.lattice_configuration, reference.lattice_configuration, s.lattice_bytes) != 0
+        || s.occupancy != reference.occupancy || s.up != reference.up || s.down != reference.down)
+      {
+      printf ("%s\tsimd %s: lattice differs from the scalar reference\n",
+              rng_name (backend), simd_name (kernel));
+      failures ++;
+      }
+    else
+      printf ("%s\tsimd %s: same lattice as the scalar reference (%d generations)\n",
+              rng_name (backend), simd_name (kernel), CHECK_SIMD_SWEEPS);
+    simulation_free (&s);
+    }
+  simulation_free (&reference);
+  bench_simd = saved;
+  return failures;
+  }
+
+
+/* Statistical sanity checks of a generator; 0 if they all pass. Onsager's
+   magnetization is that of an unbounded lattice, so the Ising runs are on
+   a torus (with a halo for the vector engine, which needs one): only the
+   vector kernels are compared with an open boundary */
+static int check_backend (int boundary, int schedule, int backend)
+  {
+  const int torus = (boundary == BOUNDARY_HALO || bench_simd != SIMD_OFF) ? BOUNDARY_HALO : BOUNDARY_PERIODIC;
+  // 255 degrees of freedom: mean 255, standard deviation 22.6
+  const double chi2_limit = (CHECK_BINS - 1) + 5 * sqrt (2.0 * (CHECK_BINS - 1));
+  // Onsager: m = (1 - sinh(2J/T)^-4)^(1/8) below Tc = 2.269 (J = 1)
+  const double T_low = 2.0, T_high = 3.0;
+  const double onsager = pow (1 - pow (sinh (2 / T_low), -4), 0.125);
+  double chi2_high, chi2_low, m_low, m_high;
+  int failures = 0;
+
+  uniformity (backend, &chi2_high, &chi2_low);
+  failures += chi2_high > chi2_limit;
+  failures += chi2_low > chi2_limit;
+  printf ("%s\tchi2 top byte %.1f, bottom byte %.1f (%d dof, limit %.1f)\n",
+          rng_name (backend), chi2_high, chi2_low, CHECK_BINS - 1, chi2_limit);
+
+  m_low = ising_magnetization (torus, schedule, backend, T_low);
+  m_high = ising_magnetization (torus, schedule, backend, T_high);
+  if (m_low < 0 || m_high < 0)
+    {
+    printf ("%s\tcould not run the %dx%d Ising checks with this schedule, engine and layout\n",
+            rng_name (backend), CHECK_SIZE, CHECK_SIZE);
+    return 1;
+    }
+  failures += fabs (m_low - onsager) > CHECK_TOLERANCE;
+  failures += m_high > CHECK_DISORDER;
+  printf ("%s\t<|m|> at T=%.1f: %.4f (Onsager %.4f), at T=%.1f: %.4f (< %.2f)\n",
+          rng_name (backend), T_low, m_low, onsager, T_high, m_high, CHECK_DISORDER);
+  if (bench_simd != SIMD_OFF)
+    failures += check_simd ((boundary == BOUNDARY_OPEN) ? boundary : torus, backend);
+  printf ("%s\t%s\n", rng_name (backend), failures ? "FAILED" : "passed");
+  fflush (stdout);
+  return failures;
+  }
+
+
+int main (int argc, char **argv)
+  {
+  char sizes[1024] = SIZES;
+  double seconds = SECONDS;
+  int init_option = 5;
+  int boundary = BOUNDARY_PERIODIC;
+  int schedule = -1;
+  int first_backend = RNG_MT64, last_backend = RNG_MT64;
+  int check = 0, failures = 0;
+  static struct option long_options[] =
+    {
+    {"sizes",    required_argument, 0, 'L'},
+    {"seconds",  required_argument, 0, 't'},
+    {"boundary", required_argument, 0, 'B'},
+    {"init",     required_argument, 0, 'i'},
+    {"schedule", required_argument, 0, 'S'},
+    {"rng",      required_argument, 0, 'g'},
+    {"radius",   required_argument, 0, 'r'},
+    {"field-cache", no_argument,    0, 'F'},
+    {"cluster",  required_argument, 0, 'C'},
+    {"multispin", no_argument,      0, 'M'},
+    {"simd",     required_argument, 0, 'V'},
+    {"check",    no_argument,       0, 'c'},
+    {"help",     no_argument,       0, 'h'},
+    {0, 0, 0, 0}
+    };
+  int option;
+  while ((option = getopt_long (argc, argv, "L:t:B:i:S:g:r:FC:MV:ch", long_options, NULL)) != -1)
+    {
+    switch (option)
+      {
+      case 'L': snprintf (sizes, sizeof (sizes), "%s", optarg); break;
+      case 't': seconds = atof (optarg); break;
+      case 'B':
+        boundary = boundary_from_name (optarg);
+        if (boundary < 0)
+          {
+          usage (argv[0]);
+          return EXIT_FAILURE;
+          }
+        break;
+      case 'i': init_option = atoi (optarg); break;
+      case 'S':
+        schedule = schedule_from_name (optarg);
+        if (schedule < 0)
+          {
+          usage (argv[0]);
+          return EXIT_FAILURE;
+          }
+        break;
+      case 'g':
+        if (strcmp (optarg, "all") == 0)
+          {
+          first_backend = 0;
+          last_backend = RNG_BACKENDS - 1;
+          break;
+          }
+        first_backend = last_backend = rng_from_name (optarg);
+        if (first_backend < 0)
+          {
+          usage (argv[0]);
+          return EXIT_FAILURE;
+          }
+        break;
+      case 'r':
+        bench_radius = atoi (optarg);
+        if (bench_radius != 1 && bench_radius != 2)
+          {
+          usage (argv[0]);
+          return EXIT_FAILURE;
+          }
+        break;
+      case 'F': bench_field_cache = 1; break;
+      case 'C':
+        bench_cluster = atoi (optarg);
+        if (bench_cluster < 0)
+          {
+          usage (argv[0]);
+          return EXIT_FAILURE;
+          }
+        break;
+      case 'M': bench_multispin = 1; break;
+      case 'V':
+        bench_simd = simd_from_name (optarg);
+        if (bench_simd < 0)
+          {
+          usage (argv[0]);
+          return EXIT_FAILURE;
+          }
+        break;
+      case 'c': check = 1; break;
+      case 'h': usage (argv[0]); return EXIT_SUCCESS;
+      default:  usage (argv[0]); return EXIT_FAILURE;
+      }
+    }
+  // The bit-plane and vector engines only run the checkerboard schedule
+  if (schedule < 0)
+    schedule = (bench_multispin || bench_simd != SIMD_OFF) ? SCHEDULE_CHECKERBOARD : SCHEDULE_RANDOM;
+
+  if (check)
+    {
+    for (int backend = first_backend; backend <= last_backend; backend++)
+      failures += check_backend (boundary, schedule, backend);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+  printf ("layout\trng\tL\tbytes\tsweeps\tsweeps/s\tMsites/s\n");
+  for (char *token = strtok (sizes, ","); token != NULL; token = strtok (NULL, ","))
+    for (int backend = first_backend; backend <= last_backend; backend++)
+      {
+      int size = atoi (token), sweeps;
+      double rate = time_sweeps (size, boundary, schedule, backend, init_option, seconds, &sweeps);
+      if (rate < 0)
+        {
+        fprintf (stderr, "Could not run a %dx%d lattice with this layout and schedule\n", size, size);
+        continue;
+        }
+      printf ("%s\t%s\t%d\t%zu\t%d\t%.3f\t%.2f\n", SITE_LAYOUT, rng_name (backend), size,
+              lattice_size_bytes ((long) size * size), sweeps, rate,
+              rate * (double) size * (double) size * 1e-6);
+      fflush (stdout);
+      }
+  return EXIT_SUCCESS;
+  }
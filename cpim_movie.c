@@ -0,0 +1,274 @@
+// Reader of the time-lapse movies of cpim-batch and the Gtk app (movie.c):
+// lists the frames of a movie, and exports frames to PNG images with the
+// colours of the Gtk app. The images are written with 2 bits per pixel
+// (a palette of the 4 states) and stored deflate blocks, so no image
+// library is needed.
+//
+// Example:
+//   ./cpim-movie run.movie
+//   ./cpim-movie run.movie --frames 0:1000:10 --scale 2 --output frames/run
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include "movie.h"
+
+/* Largest block of a stored deflate stream */
+#define STORED_BLOCK 65535
+
+/* Palette of the 2 bit codes of the states: 0 vacant (black), 1 spin up
+   (magenta), 2 undifferentiated (white), 3 = -1 spin down (green) */
+static const uint8_t palette[4][3] = {{0, 0, 0}, {255, 0, 255}, {255, 255, 255}, {0, 255, 0}};
+
+
+static void usage (const char *program)
+  {
+  fprintf (stderr,
+    "Usage: %s MOVIE [options]\n"
+    "Without --output, lists the frames of MOVIE (index, generation, keyframe, bytes).\n"
+    "  -f, --frames LIST        frames to export: comma separated indices or\n"
+    "                           start:stop[:step] ranges (default: all)\n"
+    "  -o, --output PREFIX      write frame k as PREFIX-GENERATION.png\n"
+    "  -z, --scale N            pixels per site (default 1)\n"
+    "  -h, --help               show this help\n",
+    program);
+  }
+
+
+/* CRC of the PNG chunks */
+static uint32_t crc_update (uint32_t crc, const uint8_t *data, size_t n)
+  {
+  static uint32_t table[256];
+  if (table[1] == 0)
+    for (uint32_t k = 0; k < 256; k++)
+      {
+      uint32_t c = k;
+      for (int bit = 0; bit < 8; bit++)
+        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      table[k] = c;
+      }
+  for (size_t i = 0; i < n; i++)
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  return crc;
+  }
+
+static void put_be32 (uint8_t *out, uint32_t n)
+  {
+  out[0] = (uint8_t) (n >> 24);
+  out[1] = (uint8_t) (n >> 16);
+  out[2] = (uint8_t) (n >> 8);
+  out[3] = (uint8_t) n;
+  }
+
+/* Write a chunk of the given type; 0 on success */
+static int write_chunk (FILE *file, const char *type, const uint8_t *data, size_t n)
+  {
+  uint8_t word[4];
+  uint32_t crc = crc_update (0xffffffffu, (const uint8_t *) type, 4);
+  crc = crc_update (crc, data, n) ^ 0xffffffffu;
+  put_be32 (word, (uint32_t) n);
+  if (fwrite (word, 1, 4, file) != 4 || fwrite (type, 1, 4, file) != 4
+      || (n > 0 && fwrite (data, 1, n, file) != n))
+    return -1;
+  put_be32 (word, crc);
+  return fwrite (word, 1, 4, file) == 4 ? 0 : -1;
+  }
+
+
+/* Write the decoded frame of r, scale pixels per site, as a PNG image */
+static int write_png (const struct movie_reader *r, int scale, const char *path)
+  {
+  size_t width = (size_t) r->x_size * (size_t) scale, height = (size_t) r->y_size * (size_t) scale;
+  size_t row_bytes = 1 + (width + 3) / 4, raw_bytes = row_bytes * height;
+  size_t blocks = (raw_bytes + STORED_BLOCK - 1) / STORED_BLOCK;
+  size_t idat_bytes = 2 + 5 * blocks + raw_bytes + 4;
+  uint8_t header[13], colours[12], *idat, *raw, *row;
+  uint32_t adler_a = 1, adler_b = 0;
+  FILE *file;
+  int status;
+  idat = malloc (idat_bytes);
+  if (idat == NULL)
+    return -1;
+  // Rows of 2 bit palette indices, the first pixel in the high bits
+  raw = idat + 2 + 5 * blocks;
+  for (size_t y = 0; y < height; y++)
+    {
+    row = raw + y * row_bytes;
+    memset (row, 0, row_bytes);
+    for (size_t x = 0; x < width; x++)
+      {
+      size_t p = (y / (size_t) scale) * (size_t) r->x_size + x / (size_t) scale;
+      int code = (r->frame[p >> 2] >> ((p & 3) << 1)) & 3;
+      row[1 + (x >> 2)] |= (uint8_t) (code << (6 - ((x & 3) << 1)));
+      }
+    }
+  for (size_t i = 0; i < raw_bytes; i++)
+    {
+    adler_a = (adler_a + raw[i]) % 65521;
+    adler_b = (adler_b + adler_a) % 65521;
+    }
+  // zlib stream of stored blocks: move the rows up between the block headers
+  idat[0] = 0x78;
+  idat[1] = 0x01;
+  for (size_t k = 0, o = 2; k < blocks; k++)
+    {
+    size_t n = (k + 1 < blocks) ? STORED_BLOCK : raw_bytes - k * STORED_BLOCK;
+    idat[o] = (k + 1 == blocks);
+    idat[o + 1] = (uint8_t) n;
+    idat[o + 2] = (uint8_t) (n >> 8);
+    idat[o + 3] = (uint8_t) ~n;
+    idat[o + 4] = (uint8_t) (~n >> 8);
+    memmove (idat + o + 5, raw + k * STORED_BLOCK, n);
+    o += 5 + n;
+    }
+  put_be32 (idat + idat_bytes - 4, (adler_b << 16) | adler_a);
+
+  put_be32 (header, (uint32_t) width);
+  put_be32 (header + 4, (uint32_t) height);
+  header[8] = 2;               /* Bits per pixel */
+  header[9] = 3;               /* Palette */
+  header[10] = header[11] = header[12] = 0;
+  memcpy (colours, palette, sizeof (colours));
+  file = fopen (path, "wb");
+  if (file == NULL)
+    {
+    free (idat);
+    return -1;
+    }
+  status = (fwrite ("\x89PNG\r\n\x1a\n", 1, 8, file) == 8
+            && write_chunk (file, "IHDR", header, sizeof (header)) == 0
+            && write_chunk (file, "PLTE", colours, sizeof (colours)) == 0
+            && write_chunk (file, "IDAT", idat, idat_bytes) == 0
+            && write_chunk (file, "IEND", NULL, 0) == 0) ? 0 : -1;
+  if (fclose (file) != 0)
+    status = -1;
+  free (idat);
+  return status;
+  }
+
+
+/* Mark the frames of "a,b:c[:step],..." in selected; -1 if malformed */
+static int parse_frames (const char *text, char *selected, long frames)
+  {
+  char *end;
+  long first, last, step;
+  for (;;)
+    {
+    first = last = strtol (text, &end, 10);
+    step = 1;
+    if (end == text || first < 0)
+      return -1;
+    if (*end == ':')
+      {
+      text = end + 1;
+      last = strtol (text, &end, 10);
+      if (end == text)
+        return -1;
+      if (*end == ':')
+        {
+        text = end + 1;
+        step = strtol (text, &end, 10);
+        if (end == text || step < 1)
+          return -1;
+        }
+      }
+    for (long k = first; k <= last && k < frames; k += step)
+      selected[k] = 1;
+    if (*end == '\0')
+      return 0;
+    if (*end != ',')
+      return -1;
+    text = end + 1;
+    }
+  }
+
+
+int main (int argc, char **argv)
+  {
+  struct movie_reader r;
+  const char *frames = NULL, *output = NULL;
+  char *selected, *path;
+  int scale = 1, status = EXIT_SUCCESS;
+  long exported = 0;
+  static struct option long_options[] =
+    {
+    {"frames", required_argument, 0, 'f'},
+    {"output", required_argument, 0, 'o'},
+    {"scale",  required_argument, 0, 'z'},
+    {"help",   no_argument,       0, 'h'},
+    {0, 0, 0, 0}
+    };
+  int option;
+
+  while ((option = getopt_long (argc, argv, "f:o:z:h", long_options, NULL)) != -1)
+    {
+    switch (option)
+      {
+      case 'f': frames = optarg; break;
+      case 'o': output = optarg; break;
+      case 'z': scale = atoi (optarg); break;
+      case 'h': usage (argv[0]); return EXIT_SUCCESS;
+      default:  usage (argv[0]); return EXIT_FAILURE;
+      }
+    }
+  if (optind != argc - 1 || scale < 1 || scale > 64)
+    {
+    usage (argv[0]);
+    return EXIT_FAILURE;
+    }
+  if (movie_reader_open (&r, argv[optind]) != 0)
+    {
+    fprintf (stderr, "%s is not a movie of this version\n", argv[optind]);
+    return EXIT_FAILURE;
+    }
+
+  if (output == NULL)
+    {
+    printf ("# %s: %dx%d, a frame every %d generations, %ld frames\n",
+            argv[optind], r.x_size, r.y_size, r.interval, r.frames);
+    printf ("frame\tgeneration\tkeyframe\tbytes\n");
+    for (long k = 0; k < r.frames; k++)
+      printf ("%ld\t%d\t%d\t%llu\n", k, r.index[k].generation, r.index[k].keyframe,
+              (unsigned long long) r.index[k].bytes);
+    movie_reader_close (&r);
+    return EXIT_SUCCESS;
+    }
+
+  selected = calloc ((size_t) r.frames + 1, 1);
+  path = malloc (strlen (output) + 32);
+  if (selected == NULL || path == NULL)
+    {
+    fprintf (stderr, "Out of memory\n");
+    free (selected);
+    free (path);
+    movie_reader_close (&r);
+    return EXIT_FAILURE;
+    }
+  if (frames == NULL)
+    memset (selected, 1, (size_t) r.frames);
+  else if (parse_frames (frames, selected, r.frames) != 0)
+    {
+    fprintf (stderr, "frames must be indices or start:stop[:step] ranges, separated by commas\n");
+    status = EXIT_FAILURE;
+    }
+  // Frames in increasing order: each one is decoded from the one before
+  for (long k = 0; k < r.frames && status == EXIT_SUCCESS; k++)
+    {
+    if (!selected[k])
+      continue;
+    sprintf (path, "%s-%08d.png", output, r.index[k].generation);
+    if (movie_reader_frame (&r, k) != 0 || write_png (&r, scale, path) != 0)
+      {
+      fprintf (stderr, "Could not export frame %ld to %s\n", k, path);
+      status = EXIT_FAILURE;
+      }
+    else
+      exported ++;
+    }
+  fprintf (stderr, "%ld frames exported\n", exported);
+  free (selected);
+  free (path);
+  movie_reader_close (&r);
+  return status;
+  }
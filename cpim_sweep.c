@@ -0,0 +1,597 @@
+// Parameter sweeps of the Contact Process Ising Model.
+// Expands a grid of parameters (comma separated lists, or start:stop:step
+// ranges) times a number of replicas into jobs, and runs them on all cores:
+// one independent simulation (lattice and generator) per job, one result
+// file per job.
+//
+// Jobs are sorted by estimated cost (sites * sweeps, NNN counted 3 times)
+// and dealt to one deque per thread. A thread runs the jobs of its deque,
+// shortest first; when it runs dry it steals the longest job left in the
+// deque of another thread (work stealing), so long jobs start early enough
+// not to hold up the end of the sweep.
+//
+// Each job writes <dir>/job-NNNNNN.tsv when it completes (through a
+// temporary file), and <dir>/jobs.tsv lists every job of the sweep. Run
+// the same command again to resume an interrupted sweep: finished jobs
+// are skipped, and a different grid in the same directory is refused.
+//
+// Example:
+//   ./cpim-sweep --beta 0.003,0.01 --temperature 2.0:2.5:0.1 --radius 1,2
+//                --replicas 4 --size 256 --sweeps 10000 --output scan
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "rng.h"     /* Pseudo-random number generators */
+#include "simulation.h"
+
+/* Defaults of the sweep */
+#define SWEEPS 1000
+#define SAMPLE_RATE 100
+#define REPLICAS 1
+#define SWEEP_SEED 5489ULL
+/* Largest number of values of a parameter */
+#define MAX_VALUES 1024
+/* Largest number of jobs of a sweep */
+#define MAX_JOBS 100000000L
+
+
+/* Values of one parameter of the grid */
+struct axis
+  {
+  double value[MAX_VALUES];
+  int n;
+  };
+
+/* One simulation of the sweep */
+struct job
+  {
+  int id;                     /* Position in the expanded grid (names the result file) */
+  double birth_rate, death_rate, differentiation_rate, T, J;
+  int radius, size, sweeps;
+  int replica;                /* Replica of the parameter point */
+  unsigned long long seed;    /* seed + id: every job has its own */
+  double cost;                /* Estimated cost: sites * sweeps (* 3 for NNN) */
+  };
+
+/* Jobs of one thread: jobs[head..tail) of the pool, in increasing cost */
+struct deque
+  {
+  int head, tail;
+#ifdef _OPENMP
+  omp_lock_t lock;
+#endif
+  };
+
+/* Settings shared by every job */
+struct settings
+  {
+  int boundary, schedule, backend, init_option, sample_rate;
+  const char *output;
+  };
+
+
+static void usage (const char *program)
+  {
+  fprintf (stderr,
+    "Usage: %s --output DIR [options]\n"
+    "Every parameter takes a list of values, comma separated, each a number or a\n"
+    "start:stop:step range (stop included):\n"
+    "  -b, --beta LIST          birth/colonization rates (default %g)\n"
+    "  -d, --delta LIST         death rates (default %g)\n"
+    "  -a, --alpha LIST         differentiation rates (default %g)\n"
+    "  -T, --temperature LIST   Ising temperatures (default %g)\n"
+    "  -J, --coupling LIST      couplings: ferro, anti-ferro or numbers (default ferro)\n"
+    "  -r, --radius LIST        Ising neighbourhoods, 1 (NN) and/or 2 (NNN) (default %d)\n"
+    "  -L, --size LIST          lattice sides (default %d)\n"
+    "  -n, --sweeps LIST        generations of each run (default %d)\n"
+    "  -R, --replicas N         runs of each parameter point (default %d)\n"
+    "  -s, --seed N             first seed: job k runs with seed + k (default %llu)\n"
+    "  -i, --init 1..5          initial condition (default %d)\n"
+    "  -B, --boundary NAME      periodic, halo or open (default periodic)\n"
+    "  -S, --schedule NAME      update schedule of the runs (default random)\n"
+    "  -g, --rng NAME           mt64, xoshiro, pcg64 or philox (default mt64)\n"
+    "  -p, --sample N           observables every N generations, 0 = only at the end (default %d)\n"
+    "  -j, --jobs N             jobs run at a time (default: all cores)\n"
+    "  -o, --output DIR         directory of the results (created if needed; rerun to resume)\n"
+    "  -h, --help               show this help\n",
+    program, BETA, DELTA, ALPHA, TEMPERATURE, RADIUS, X_SIZE, SWEEPS, REPLICAS, SWEEP_SEED,
+    INIT, SAMPLE_RATE);
+  }
+
+
+/* Parse a list of values into axis; couplings accept ferro and anti-ferro.
+   0 on success */
+static int parse_axis (const char *text, struct axis *axis, int coupling)
+  {
+  char buffer[4096], *token, *save, *end;
+  double start, stop, step;
+  snprintf (buffer, sizeof (buffer), "%s", text);
+  axis->n = 0;
+  for (token = strtok_r (buffer, ",", &save); token != NULL; token = strtok_r (NULL, ",", &save))
+    {
+    if (coupling && (strcmp (token, "ferro") == 0 || strcmp (token, "anti-ferro") == 0))
+      {
+      if (axis->n == MAX_VALUES)
+        return -1;
+      axis->value[axis->n++] = (token[0] == 'f' ? -1 : 1) * (double) COUPLING;
+      continue;
+      }
+    start = strtod (token, &end);
+    if (end == token)
+      return -1;
+    stop = start;
+    step = 1;
+    if (*end == ':')
+      {
+      stop = strtod (end + 1, &end);
+      if (*end != ':')
+        return -1;
+      step = strtod (end + 1, &end);
+      if (step <= 0 || stop < start)
+        return -1;
+      }
+    if (*end != '\0')
+      return -1;
+    // Stop is included, up to rounding
+    for (long k = 0; start + k * step <= stop + 1e-9 * step; k++)
+      {
+      if (axis->n == MAX_VALUES)
+        return -1;
+      axis->value[axis->n++] = start + k * step;
+      }
+    }
+  return axis->n > 0 ? 0 : -1;
+  }
+
+
+/* A whole number from 1 to MAX_JOBS, or 0 */
+static int parse_count (const char *text)
+  {
+  char *end;
+  long value = strtol (text, &end, 10);
+  return (end != text && *end == '\0' && value >= 1 && value <= MAX_JOBS) ? (int) value : 0;
+  }
+
+
+/* An axis with a single value */
+static void single (struct axis *axis, double value)
+  {
+  axis->value[0] = value;
+  axis->n = 1;
+  }
+
+
+/* Jobs of the grid, in grid order; NULL if more than MAX_JOBS or out of
+   memory */
+static struct job *expand (const struct axis *beta, const struct axis *delta, const struct axis *alpha,
+                           const struct axis *T, const struct axis *J, const struct axis *radius,
+                           const struct axis *size, const struct axis *sweeps, int replicas,
+                           unsigned long long seed, int *n_jobs)
+  {
+  const int factor[9] = {beta->n, delta->n, alpha->n, T->n, J->n, radius->n, size->n, sweeps->n, replicas};
+  long n = 1;
+  struct job *jobs, *job;
+  // Axis by axis, so the product never goes past the limit (nor overflows)
+  for (int k = 0; k < 9; k++)
+    {
+    if (factor[k] < 1 || n > MAX_JOBS / factor[k])
+      return NULL;
+    n *= factor[k];
+    }
+  if ((jobs = malloc ((size_t) n * sizeof (struct job))) == NULL)
+    return NULL;
+  job = jobs;
+  for (int i0 = 0; i0 < beta->n; i0++)
+  for (int i1 = 0; i1 < delta->n; i1++)
+  for (int i2 = 0; i2 < alpha->n; i2++)
+  for (int i3 = 0; i3 < T->n; i3++)
+  for (int i4 = 0; i4 < J->n; i4++)
+  for (int i5 = 0; i5 < radius->n; i5++)
+  for (int i6 = 0; i6 < size->n; i6++)
+  for (int i7 = 0; i7 < sweeps->n; i7++)
+  for (int replica = 0; replica < replicas; replica++)
+    {
+    job->id = (int) (job - jobs);
+    job->birth_rate = beta->value[i0];
+    job->death_rate = delta->value[i1];
+    job->differentiation_rate = alpha->value[i2];
+    job->T = T->value[i3];
+    job->J = J->value[i4];
+    job->radius = (int) radius->value[i5];
+    job->size = (int) size->value[i6];
+    job->sweeps = (int) sweeps->value[i7];
+    job->replica = replica;
+    // Seeds of their own: the runs of a scan are independent of one another
+    job->seed = seed + (unsigned long long) job->id;
+    job->cost = (double) job->size * job->size * job->sweeps * (job->radius == 2 ? 3 : 1);
+    job ++;
+    }
+  *n_jobs = (int) n;
+  return jobs;
+  }
+
+
+/* Line of jobs.tsv describing a job */
+static void describe (char *line, size_t length, const struct job *job)
+  {
+  snprintf (line, length, "%d\t%.17g\t%.17g\t%.17g\t%.17g\t%.17g\t%d\t%d\t%d\t%d\t%llu\n",
+            job->id, job->birth_rate, job->death_rate, job->differentiation_rate, job->T, job->J,
+            job->radius, job->size, job->sweeps, job->replica, job->seed);
+  }
+
+static const char jobs_header[] =
+  "job\tbeta\tdelta\talpha\tT\tJ\tradius\tsize\tsweeps\treplica\tseed\n";
+
+
+/* Write <dir>/jobs.tsv, or check that the one of an earlier run lists the
+   same jobs; 0 on success */
+static int write_manifest (const char *output, const struct job *jobs, int n_jobs)
+  {
+  char path[4096], line[512], old[512];
+  FILE *file;
+  snprintf (path, sizeof (path), "%s/jobs.tsv", output);
+  file = fopen (path, "r");
+  if (file != NULL)
+    {
+    int same = fgets (old, sizeof (old), file) != NULL && strcmp (old, jobs_header) == 0;
+    for (int k = 0; same && k < n_jobs; k++)
+      {
+      describe (line, sizeof (line), &jobs[k]);
+      same = fgets (old, sizeof (old), file) != NULL && strcmp (old, line) == 0;
+      }
+    same = same && fgets (old, sizeof (old), file) == NULL;
+    fclose (file);
+    return same ? 0 : -1;
+    }
+  file = fopen (path, "w");
+  if (file == NULL)
+    return -1;
+  fputs (jobs_header, file);
+  for (int k = 0; k < n_jobs; k++)
+    {
+    describe (line, sizeof (line), &jobs[k]);
+    fputs (line, file);
+    }
+  return fclose (file) == 0 ? 0 : -1;
+  }
+
+
+static void result_path (char *path, size_t length, const char *output, int id)
+  {
+  snprintf (path, length, "%s/job-%06d.tsv", output, id);
+  }
+
+static int job_done (const char *output, const struct job *job)
+  {
+  char path[4096];
+  struct stat info;
+  result_path (path, sizeof (path), output, job->id);
+  return stat (path, &info) == 0;
+  }
+
+
+static void print_sample (FILE *file, const struct simulation *s)
+  {
+  fprintf (file, "%d\t%f\t%f\t%f\t%f\n", s->generation_time,
+           (double) s->vacancy / (double) s->n_sites,
+           (double) s->occupancy / (double) s->n_sites,
+           s->occupancy ? (double) s->up / (double) s->occupancy : 0.0,
+           s->occupancy ? (double) s->down / (double) s->occupancy : 0.0);
+  }
+
+
+/* Run a job and write its result file; 0 on success */
+static int run_job (const struct job *job, const struct settings *settings)
+  {
+  struct simulation s;
+  char path[4096], temporary[4200], line[512];
+  FILE *file;
+  double seconds;
+  struct timespec start, end;
+  memset (&s, 0, sizeof (s));
+  simulation_defaults (&s);
+  s.birth_rate = job->birth_rate;
+  s.death_rate = job->death_rate;
+  s.differentiation_rate = job->differentiation_rate;
+  s.T = job->T;
+  s.J = job->J;
+  s.Ising_neighboorhood = job->radius;
+  s.init_option = settings->init_option;
+  s.schedule = settings->schedule;
+  s.rng_backend = settings->backend;
+  if (simulation_alloc (&s, job->size, job->size, settings->boundary) != 0)
+    return -1;
+  if ((s.schedule == SCHEDULE_CHECKERBOARD && checkerboard_supported (&s) != 0)
+      || (s.schedule == SCHEDULE_DOMAIN && domain_supported (&s) != 0)
+      || (s.schedule == SCHEDULE_KMC && kmc_supported (&s) != 0)
+      || (s.schedule == SCHEDULE_ACTIVE && active_supported (&s) != 0))
+    {
+    simulation_free (&s);
+    return -1;
+    }
+  simulation_seed (&s, job->seed);
+  init_lattice (&s);
+
+  result_path (path, sizeof (path), settings->output, job->id);
+  snprintf (temporary, sizeof (temporary), "%s.tmp", path);
+  file = fopen (temporary, "w");
+  if (file == NULL)
+    {
+    simulation_free (&s);
+    return -1;
+    }
+  describe (line, sizeof (line), job);
+  fprintf (file, "# %s# %s", jobs_header, line);
+  fprintf (file, "generation\tvacancy\toccupancy\tup\tdown\n");
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  for (int generation = 0; generation < job->sweeps; generation++)
+    {
+    // Out of memory: no result, the job runs again on resume
+    if (update_lattice (&s) != 0)
+      {
+      fclose (file);
+      remove (temporary);
+      simulation_free (&s);
+      return -1;
+      }
+    if (settings->sample_rate > 0 && s.generation_time % settings->sample_rate == 0)
+      print_sample (file, &s);
+    }
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  seconds = (double) (end.tv_sec - start.tv_sec) + 1e-9 * (double) (end.tv_nsec - start.tv_nsec);
+  if (settings->sample_rate <= 0 || s.generation_time % settings->sample_rate != 0)
+    print_sample (file, &s);
+  fprintf (file, "# seconds %.3f\n", seconds);
+  simulation_free (&s);
+  // The result only appears once it is complete
+  if (fclose (file) != 0 || rename (temporary, path) != 0)
+    {
+    remove (temporary);
+    return -1;
+    }
+  return 0;
+  }
+
+
+static void lock (struct deque *d)
+  {
+#ifdef _OPENMP
+  omp_set_lock (&d->lock);
+#else
+  (void) d;
+#endif
+  }
+
+static void unlock (struct deque *d)
+  {
+#ifdef _OPENMP
+  omp_unset_lock (&d->lock);
+#else
+  (void) d;
+#endif
+  }
+
+/* Next job of thread me: the shortest of its own deque, or else the
+   longest of another one; -1 when every deque is empty */
+static int next_job (struct deque *deques, int threads, int me)
+  {
+  int job = -1;
+  lock (&deques[me]);
+  if (deques[me].head < deques[me].tail)
+    job = deques[me].head++;
+  unlock (&deques[me]);
+  for (int k = 1; job < 0 && k < threads; k++)
+    {
+    struct deque *victim = &deques[(me + k) % threads];
+    lock (victim);
+    if (victim->head < victim->tail)
+      job = --victim->tail;
+    unlock (victim);
+    }
+  return job;
+  }
+
+
+/* Deal the jobs (sorted by cost) in turn to the deques: deque d gets jobs
+   d, d + threads, d + 2*threads... in increasing cost. Returns the jobs in
+   the order of the deques, NULL if out of memory */
+static struct job *deal (const struct job *sorted, int n, struct deque *deques, int threads)
+  {
+  struct job *dealt = malloc ((size_t) (n ? n : 1) * sizeof (struct job));
+  int position = 0;
+  if (dealt == NULL)
+    return NULL;
+  for (int d = 0; d < threads; d++)
+    {
+    deques[d].head = position;
+    for (int k = d; k < n; k += threads)
+      dealt[position++] = sorted[k];
+    deques[d].tail = position;
+    }
+  return dealt;
+  }
+
+
+static int by_cost (const void *a, const void *b)
+  {
+  const struct job *x = a, *y = b;
+  if (x->cost != y->cost)
+    return x->cost < y->cost ? -1 : 1;
+  return x->id - y->id;
+  }
+
+
+int main (int argc, char **argv)
+  {
+  struct axis beta, delta, alpha, T, J, radius, size, sweeps;
+  struct settings settings = {BOUNDARY_PERIODIC, SCHEDULE_RANDOM, RNG_MT64, INIT, SAMPLE_RATE, NULL};
+  struct job *jobs, *pending, *dealt;
+  struct deque *deques;
+  int replicas = REPLICAS, threads = 1, n_jobs = 0, n_pending = 0, failures = 0, finished = 0;
+  unsigned long long seed = SWEEP_SEED;
+  static struct option long_options[] =
+    {
+    {"beta",        required_argument, 0, 'b'},
+    {"delta",       required_argument, 0, 'd'},
+    {"alpha",       required_argument, 0, 'a'},
+    {"temperature", required_argument, 0, 'T'},
+    {"coupling",    required_argument, 0, 'J'},
+    {"radius",      required_argument, 0, 'r'},
+    {"size",        required_argument, 0, 'L'},
+    {"sweeps",      required_argument, 0, 'n'},
+    {"replicas",    required_argument, 0, 'R'},
+    {"seed",        required_argument, 0, 's'},
+    {"init",        required_argument, 0, 'i'},
+    {"boundary",    required_argument, 0, 'B'},
+    {"schedule",    required_argument, 0, 'S'},
+    {"rng",         required_argument, 0, 'g'},
+    {"sample",      required_argument, 0, 'p'},
+    {"jobs",        required_argument, 0, 'j'},
+    {"output",      required_argument, 0, 'o'},
+    {"help",        no_argument,       0, 'h'},
+    {0, 0, 0, 0}
+    };
+  int option, valid = 1;
+
+#ifdef _OPENMP
+  threads = omp_get_max_threads ();
+#endif
+  single (&beta, BETA);
+  single (&delta, DELTA);
+  single (&alpha, ALPHA);
+  single (&T, TEMPERATURE);
+  single (&J, -1 * (double) COUPLING);
+  single (&radius, RADIUS);
+  single (&size, X_SIZE);
+  single (&sweeps, SWEEPS);
+
+  while ((option = getopt_long (argc, argv, "b:d:a:T:J:r:L:n:R:s:i:B:S:g:p:j:o:h", long_options, NULL)) != -1)
+    {
+    switch (option)
+      {
+      case 'b': valid &= parse_axis (optarg, &beta, 0) == 0; break;
+      case 'd': valid &= parse_axis (optarg, &delta, 0) == 0; break;
+      case 'a': valid &= parse_axis (optarg, &alpha, 0) == 0; break;
+      case 'T': valid &= parse_axis (optarg, &T, 0) == 0; break;
+      case 'J': valid &= parse_axis (optarg, &J, 1) == 0; break;
+      case 'r': valid &= parse_axis (optarg, &radius, 0) == 0; break;
+      case 'L': valid &= parse_axis (optarg, &size, 0) == 0; break;
+      case 'n': valid &= parse_axis (optarg, &sweeps, 0) == 0; break;
+      case 'R': replicas = parse_count (optarg); break;
+      case 's': seed = strtoull (optarg, NULL, 10); break;
+      case 'i': settings.init_option = atoi (optarg); break;
+      case 'B': valid &= (settings.boundary = boundary_from_name (optarg)) >= 0; break;
+      case 'S': valid &= (settings.schedule = schedule_from_name (optarg)) >= 0; break;
+      case 'g': valid &= (settings.backend = rng_from_name (optarg)) >= 0; break;
+      case 'p': settings.sample_rate = atoi (optarg); break;
+      case 'j': threads = atoi (optarg); break;
+      case 'o': settings.output = optarg; break;
+      case 'h': usage (argv[0]); return EXIT_SUCCESS;
+      default:  usage (argv[0]); return EXIT_FAILURE;
+      }
+    }
+  for (int k = 0; k < radius.n; k++)
+    valid &= radius.value[k] == 1 || radius.value[k] == 2;
+  // Sides and sweeps are whole numbers
+  for (int k = 0; k < size.n; k++)
+    valid &= size.value[k] >= MIN_SIZE && size.value[k] <= 1 << 20
+             && size.value[k] == (double) (long) size.value[k];
+  for (int k = 0; k < T.n; k++)
+    valid &= T.value[k] > 0;
+  for (int k = 0; k < sweeps.n; k++)
+    valid &= sweeps.value[k] >= 1 && sweeps.value[k] <= 1e9
+             && sweeps.value[k] == (double) (long) sweeps.value[k];
+  if (!valid || settings.output == NULL || replicas < 1 || threads < 1
+      || settings.init_option < 1 || settings.init_option > 5)
+    {
+    usage (argv[0]);
+    return EXIT_FAILURE;
+    }
+
+  jobs = expand (&beta, &delta, &alpha, &T, &J, &radius, &size, &sweeps, replicas, seed, &n_jobs);
+  if (jobs == NULL)
+    {
+    fprintf (stderr, "The grid is too large\n");
+    return EXIT_FAILURE;
+    }
+  if (mkdir (settings.output, 0777) != 0 && errno != EEXIST)
+    {
+    fprintf (stderr, "Could not create %s\n", settings.output);
+    free (jobs);
+    return EXIT_FAILURE;
+    }
+  if (write_manifest (settings.output, jobs, n_jobs) != 0)
+    {
+    fprintf (stderr, "%s/jobs.tsv lists another sweep (or could not be written)\n", settings.output);
+    free (jobs);
+    return EXIT_FAILURE;
+    }
+
+  // Jobs left, shortest first, dealt in turn to the deques of the threads
+  pending = malloc ((size_t) n_jobs * sizeof (struct job));
+  deques = calloc ((size_t) threads, sizeof (struct deque));
+  if (pending == NULL || deques == NULL)
+    {
+    fprintf (stderr, "Could not allocate the jobs\n");
+    free (jobs); free (pending); free (deques);
+    return EXIT_FAILURE;
+    }
+  for (int k = 0; k < n_jobs; k++)
+    if (!job_done (settings.output, &jobs[k]))
+      pending[n_pending++] = jobs[k];
+  qsort (pending, (size_t) n_pending, sizeof (struct job), by_cost);
+  dealt = deal (pending, n_pending, deques, threads);
+  free (pending);
+  pending = dealt;
+  if (pending == NULL)
+    {
+    fprintf (stderr, "Could not allocate the jobs\n");
+    free (jobs); free (deques);
+    return EXIT_FAILURE;
+    }
+#ifdef _OPENMP
+  for (int d = 0; d < threads; d++)
+    omp_init_lock (&deques[d].lock);
+#endif
+  fprintf (stderr, "%d jobs, %d done, %d to run on %d threads\n", n_jobs, n_jobs - n_pending,
+           n_pending, threads);
+
+#pragma omp parallel num_threads(threads) reduction(+:failures)
+    {
+    int me = 0, k;
+#ifdef _OPENMP
+    me = omp_get_thread_num ();
+#endif
+    while ((k = next_job (deques, threads, me)) >= 0)
+      {
+      int status = run_job (&pending[k], &settings);
+#pragma omp critical
+      {
+      finished ++;
+      if (status != 0)
+        fprintf (stderr, "job %d failed (unsupported parameters, out of memory, or could not write)\n",
+                 pending[k].id);
+      else
+        fprintf (stderr, "job %d done (%d/%d)\n", pending[k].id, finished, n_pending);
+      }
+      failures += status != 0;
+      }
+    }
+
+#ifdef _OPENMP
+  for (int d = 0; d < threads; d++)
+    omp_destroy_lock (&deques[d].lock);
+#endif
+  free (deques);
+  free (pending);
+  free (jobs);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
@@ -0,0 +1,296 @@
+// Domain decomposition update schedule for the Contact Process Ising Model.
+//
+// The lattice is split into tiles (about DOMAIN_TILE sites a side, an even
+// number of them along each side, at most DOMAIN_MAX_TILES). Each tile is split in two regions: its
+// interior, and the frame of width r (the Ising radius, which also covers
+// the NN reach of the CP) around it. A site update reads at most r sites
+// away, so
+//  - the interiors of all the tiles can be updated at the same time: an
+//    interior site only reads sites of its own tile;
+//  - the frames are updated in 4 phases, one per tile parity
+//    (tx mod 2, ty mod 2): two frames updated at the same time are a whole
+//    tile apart.
+// No two threads ever update (or read while another writes) neighbooring
+// sites.
+//
+// Within each region the updates are random sequential: every site has a
+// Poisson clock of rate 1 per generation (the continuous time limit of the
+// x_size*y_size random picks of update_lattice()), and the region draws
+// the next firing site uniformly at the next exponential waiting time.
+// A generation is split in s->domain_rounds rounds; in each round every
+// region fires the events of that time window, the interiors first and
+// then the frames, phase after phase. The only difference with a single
+// random sequential stream is the order of events closer than one round
+// in time on both sides of a frame boundary; it vanishes as the number of
+// rounds grows.
+//
+// Each tile owns its generator (an independent stream of the seed of s),
+// so a run is reproducible for a given seed whatever the number of threads.
+
+#include <stdlib.h>
+#include <math.h>
+#include "rng.h"
+#include "simulation.h"
+#include "kernels.h"
+
+/* Target side of a tile */
+#define DOMAIN_TILE 64
+/* At most this many tiles along a side (each tile holds a generator) */
+#define DOMAIN_MAX_TILES 64
+
+
+/* A tile [x0, x1) x [y0, y1) */
+struct tile
+  {
+  struct rng rng;             /* Generator of the tile */
+  int x0, x1, y0, y1;
+  long interior_area;         /* Sites of the interior */
+  long frame_area;            /* Sites of the frame */
+  double interior_clock;      /* Time of the next interior event (this generation = [0,1)) */
+  double frame_clock;         /* Time of the next frame event */
+  };
+
+struct domain
+  {
+  int x_tiles, y_tiles;       /* Tiles along each side (even) */
+  int x_size, y_size, radius; /* Geometry the tiles were built for */
+  struct tile *tiles;         /* y_tiles rows of x_tiles tiles */
+  };
+
+
+/* Tiles along a side of the given size: an even number, at least 2 */
+static int tiles_along (int size)
+  {
+  int tiles = (size / DOMAIN_TILE) & ~1;
+  if (tiles > DOMAIN_MAX_TILES)
+    tiles = DOMAIN_MAX_TILES;
+  return tiles < 2 ? 2 : tiles;
+  }
+
+
+/* Can s be updated with the domain schedule? 0 if so */
+int domain_supported (const struct simulation *s)
+  {
+  int r = (s->Ising_neighboorhood == 2) ? 2 : 1;
+  // The interior of the smallest tile must not be empty
+  if (s->x_size / tiles_along (s->x_size) <= 2*r || s->y_size / tiles_along (s->y_size) <= 2*r)
+    return -1;
+#if defined(CPIM_PACKED_LATTICE)
+  // Neighbooring tiles would write to the same bytes
+  return -1;
+#endif
+  return 0;
+  }
+
+
+/* Exponential waiting time with unit mean */
+static inline double exponential (struct rng *rng)
+  {
+  // -log of a uniform number on (0,1) (genrand64_real3)
+  return -log (((rng_next (rng) >> 12) + 0.5) * (1.0/4503599627370496.0));
+  }
+
+
+/* Release the tiles of s */
+void domain_free (struct simulation *s)
+  {
+  if (s->domain == NULL)
+    return;
+  free (s->domain->tiles);
+  free (s->domain);
+  s->domain = NULL;
+  }
+
+
+/* (Re)build the tiles of s if its geometry changed; 0 on success */
+static int prepare_domain (struct simulation *s)
+  {
+  struct domain *d = s->domain;
+  int r = (s->Ising_neighboorhood == 2) ? 2 : 1;
+  if (d != NULL && d->x_size == s->x_size && d->y_size == s->y_size && d->radius == r)
+    return 0;
+  domain_free (s);
+  d = malloc (sizeof (struct domain));
+  if (d == NULL)
+    return -1;
+  d->x_tiles = tiles_along (s->x_size);
+  d->y_tiles = tiles_along (s->y_size);
+  d->x_size = s->x_size;
+  d->y_size = s->y_size;
+  d->radius = r;
+  d->tiles = malloc ((size_t) d->x_tiles * d->y_tiles * sizeof (struct tile));
+  if (d->tiles == NULL)
+    {
+    free (d);
+    return -1;
+    }
+  for (int ty = 0; ty < d->y_tiles; ty++)
+    for (int tx = 0; tx < d->x_tiles; tx++)
+      {
+      struct tile *t = &d->tiles[ty * d->x_tiles + tx];
+      t->x0 = (int) ((long) tx * s->x_size / d->x_tiles);
+      t->x1 = (int) ((long) (tx + 1) * s->x_size / d->x_tiles);
+      t->y0 = (int) ((long) ty * s->y_size / d->y_tiles);
+      t->y1 = (int) ((long) (ty + 1) * s->y_size / d->y_tiles);
+      t->interior_area = (long) (t->x1 - t->x0 - 2*r) * (t->y1 - t->y0 - 2*r);
+      t->frame_area = (long) (t->x1 - t->x0) * (t->y1 - t->y0) - t->interior_area;
+      simulation_stream (s, &t->rng);
+      t->interior_clock = exponential (&t->rng) / (double) t->interior_area;
+      t->frame_clock = exponential (&t->rng) / (double) t->frame_area;
+      }
+  s->domain = d;
+  return 0;
+  }
+
+
+/* State of a tile that checkpoints keep: its generator and clocks */
+struct tile_state
+  {
+  struct rng rng;
+  double interior_clock, frame_clock;
+  };
+
+size_t domain_state_bytes (const struct simulation *s)
+  {
+  const struct domain *d = s->domain;
+  if (d == NULL || d->x_size != s->x_size || d->y_size != s->y_size
+      || d->radius != ((s->Ising_neighboorhood == 2) ? 2 : 1))
+    return 0;
+  return (size_t) d->x_tiles * d->y_tiles * sizeof (struct tile_state);
+  }
+
+void domain_state_save (const struct simulation *s, void *data)
+  {
+  const struct domain *d = s->domain;
+  struct tile_state *state = data;
+  for (int k = 0; k < d->x_tiles * d->y_tiles; k++)
+    {
+    state[k].rng = d->tiles[k].rng;
+    state[k].interior_clock = d->tiles[k].interior_clock;
+    state[k].frame_clock = d->tiles[k].frame_clock;
+    }
+  }
+
+int domain_state_load (struct simulation *s, const void *data, size_t bytes)
+  {
+  const struct tile_state *state = data;
+  struct domain *d;
+  // The tiles follow from the geometry; their generators are then replaced
+  domain_free (s);
+  if (prepare_domain (s) != 0)
+    return -1;
+  d = s->domain;
+  if (bytes != (size_t) d->x_tiles * d->y_tiles * sizeof (struct tile_state))
+    {
+    domain_free (s);
+    return -1;
+    }
+  for (int k = 0; k < d->x_tiles * d->y_tiles; k++)
+    {
+    d->tiles[k].rng = state[k].rng;
+    d->tiles[k].interior_clock = state[k].interior_clock;
+    d->tiles[k].frame_clock = state[k].frame_clock;
+    }
+  return 0;
+  }
+
+
+/* Fire the events of the interior of tile t up to time end */
+static inline void run_interior (struct simulation *s, struct tile *t, double end,
+                                 struct site_counts *counts, const int wrap_mode, const int radius)
+  {
+  int width = t->x1 - t->x0 - 2*radius, height = t->y1 - t->y0 - 2*radius;
+  int x, y;
+  while (t->interior_clock < end)
+    {
+    x = t->x0 + radius + (int) draw_index (&t->rng, width);
+    y = t->y0 + radius + (int) draw_index (&t->rng, height);
+    update_site (s, &t->rng, x, y, site_index (s, x, y), counts, wrap_mode, radius);
+    t->interior_clock += exponential (&t->rng) / (double) t->interior_area;
+    }
+  }
+
+/* Fire the events of the frame of tile t up to time end. The frame is
+   stored as its top and bottom strips (width x r) followed by its left and
+   right strips (r x the height of the interior). */
+static inline void run_frame (struct simulation *s, struct tile *t, double end,
+                              struct site_counts *counts, const int wrap_mode, const int radius)
+  {
+  int width = t->x1 - t->x0, side = t->y1 - t->y0 - 2*radius;
+  long strip = (long) width * radius;
+  long k;
+  int x, y;
+  while (t->frame_clock < end)
+    {
+    k = (long) draw_index (&t->rng, t->frame_area);
+    if (k < 2*strip)
+      {
+      x = t->x0 + (int) (k % width);
+      y = (k < strip) ? t->y0 + (int) (k / width) : t->y1 - radius + (int) ((k - strip) / width);
+      }
+    else
+      {
+      k -= 2*strip;
+      y = t->y0 + radius + (int) ((k / radius) % side);
+      x = (k < (long) side * radius) ? t->x0 + (int) (k % radius) : t->x1 - radius + (int) (k % radius);
+      }
+    update_site (s, &t->rng, x, y, site_index (s, x, y), counts, wrap_mode, radius);
+    t->frame_clock += exponential (&t->rng) / (double) t->frame_area;
+    }
+  }
+
+
+static inline void domain_kernel (struct simulation *s, const int wrap_mode, const int radius)
+  {
+  struct domain *d = s->domain;
+  const int n_tiles = d->x_tiles * d->y_tiles;
+  const int half_x = d->x_tiles / 2, phase_tiles = n_tiles / 4;
+  const int rounds = s->domain_rounds > 0 ? s->domain_rounds : 1;
+  long occupancy = 0, vacancy = 0, up = 0, down = 0;
+#pragma omp parallel reduction(+:occupancy, vacancy, up, down)
+    {
+    struct site_counts counts = {0, 0, 0, 0};
+    for (int round = 0; round < rounds; round++)
+      {
+      double end = (double) (round + 1) / rounds;
+      // The implicit barrier at the end of each phase keeps phases apart
+#pragma omp for schedule(dynamic)
+      for (int k = 0; k < n_tiles; k++)
+        run_interior (s, &d->tiles[k], end, &counts, wrap_mode, radius);
+      for (int phase = 0; phase < 4; phase++)
+        {
+#pragma omp for schedule(dynamic)
+        for (int k = 0; k < phase_tiles; k++)
+          {
+          int tx = (phase & 1) + 2 * (k % half_x);
+          int ty = (phase >> 1) + 2 * (k / half_x);
+          run_frame (s, &d->tiles[ty * d->x_tiles + tx], end, &counts, wrap_mode, radius);
+          }
+        }
+      }
+    occupancy += counts.occupancy; vacancy += counts.vacancy;
+    up += counts.up; down += counts.down;
+    }
+  // Clocks count from the start of the next generation
+  for (int k = 0; k < n_tiles; k++)
+    {
+    d->tiles[k].interior_clock -= 1.0;
+    d->tiles[k].frame_clock -= 1.0;
+    }
+  s->occupancy += occupancy; s->vacancy += vacancy;
+  s->up += up; s->down += down;
+  s->generation_time ++;
+  }
+
+
+/* One generation of the domain decomposition schedule */
+int update_lattice_domain (struct simulation *s)
+  {
+  if (prepare_domain (s) != 0)
+    return -1;
+  prepare_rate_thresholds (s);
+#define SWEEP(wrap_mode, radius) domain_kernel (s, wrap_mode, radius)
+  DISPATCH_KERNEL (s, SWEEP);
+#undef SWEEP
+  return 0;
+  }
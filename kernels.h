@@ -0,0 +1,362 @@
+// Inline kernels of the simulation core, shared by the update schedules
+// (simulation.c, checkerboard.c, multispin.c, simd.c, domain.c, kmc.c,
+// active.c, cluster.c, replicas.c). Not part of the public interface.
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "rng.h"
+#include "simulation.h"
+
+
+/* How the kernels find the neighboors of a site. The mode is a compile
+   time constant in each kernel, so each kernel is specialized. */
+enum
+  {
+  WRAP_MODULO,  /* periodic boundaries with a modulo */
+  WRAP_MASK,    /* periodic boundaries with a mask (power-of-two sides) */
+  WRAP_HALO     /* halo-padded lattice: neighboors are plain offsets */
+  };
+
+static inline int wrap (int c, int size, int mask, const int wrap_mode)
+  {
+  return (wrap_mode == WRAP_MASK) ? (c & mask) : (size + c) % size;
+  }
+
+/* Index of the neighboor (x+dx, y+dy) of site i = site_index (s, x, y) */
+static inline long neighbor_index (const struct simulation *s, int x, int y, long i,
+                                   int dx, int dy, const int wrap_mode)
+  {
+  if (wrap_mode == WRAP_HALO)
+    return i + (long) dy * s->stride + dx;
+  return (long) wrap (y + dy, s->y_size, s->y_mask, wrap_mode) * s->stride
+         + wrap (x + dx, s->x_size, s->x_mask, wrap_mode);
+  }
+
+static inline int wrap_mode_of (const struct simulation *s)
+  {
+  if (s->halo > 0)
+    return WRAP_HALO;
+  return s->pow2 ? WRAP_MASK : WRAP_MODULO;
+  }
+
+
+/* Run the statement KERNEL (wrap_mode, radius) with the wrap mode and
+   Ising radius of s as compile time constants */
+#define DISPATCH_KERNEL(s, KERNEL)                                        \
+  switch (wrap_mode_of (s) * 2 + ((s)->Ising_neighboorhood == 2))         \
+    {                                                                     \
+    case WRAP_HALO*2 + 1:   KERNEL (WRAP_HALO, 2);   break;               \
+    case WRAP_HALO*2:       KERNEL (WRAP_HALO, 1);   break;               \
+    case WRAP_MASK*2 + 1:   KERNEL (WRAP_MASK, 2);   break;               \
+    case WRAP_MASK*2:       KERNEL (WRAP_MASK, 1);   break;               \
+    case WRAP_MODULO*2 + 1: KERNEL (WRAP_MODULO, 2); break;               \
+    default:                KERNEL (WRAP_MODULO, 1); break;               \
+    }
+
+
+/* Spin carried by a state, indexed by state & 3: vacancies (0) and
+   undifferentiated sites (2) carry no spin, -1 & 3 == 3 */
+static const int spin_of[4] = {0, 1, 0, -1};
+
+
+/* Write the ghost copies of border site (x,y) (periodic halo) */
+void write_ghosts (struct simulation *s, int x, int y, int state);
+
+/* Add delta to the cached field of the Ising neighboorhood of site (x,y) */
+void update_field_cache (struct simulation *s, int x, int y, int delta);
+
+/* Move site (x,y) from state old to state in the block counts */
+void update_block_counts (struct simulation *s, int x, int y, int old, int state);
+
+/* Set site i = site_index (s, x, y) to state, keeping the halo, the field
+   cache and the block counts in sync */
+static inline void change_site (struct simulation *s, int x, int y, long i, int state,
+                                const int wrap_mode)
+  {
+  int old;
+  if (s->field_cache != NULL || s->block_counts[BLOCK_COUNT_FIRST] != NULL)
+    {
+    old = get_site (s, i);
+    if (s->field_cache != NULL && spin_of[state & 3] != spin_of[old & 3])
+      update_field_cache (s, x, y, spin_of[state & 3] - spin_of[old & 3]);
+    if (s->block_counts[BLOCK_COUNT_FIRST] != NULL && state != old)
+      update_block_counts (s, x, y, old, state);
+    }
+  set_site (s, i, state);
+  if (wrap_mode == WRAP_HALO && s->boundary == BOUNDARY_HALO
+      && (x < s->halo || x >= s->x_size - s->halo || y < s->halo || y >= s->y_size - s->halo))
+    write_ghosts (s, x, y, state);
+  }
+
+
+/* Offsets of the Ising neighboorhood: the 4 NN sites (r=1) come first,
+   followed by the 8 extra sites of the NNN (r=2) */
+static const int neighbor_offsets[MAX_FIELD][2] =
+  {
+  { 0,  1}, /* South (S) neighboor (#1) */
+  { 0, -1}, /* North (N) neighboor (#2) */
+  {-1,  0}, /* West (W) neighboor (#3) */
+  { 1,  0}, /* East (E) neighboor (#4) */
+  { 0,  2}, /* South-South (SS) neighboor (#5) */
+  { 0, -2}, /* North-North (NN) neighboor (#6) */
+  {-2,  0}, /* West-West (WW) neighboor (#7) */
+  { 2,  0}, /* East-East (EE) neighboor (#8) */
+  {-1,  1}, /* South-West (SW) neighboor (#9) */
+  { 1, -1}, /* North-East (NE) neighboor (#10) */
+  {-1, -1}, /* North-West (NW) neighboor (#11) */
+  { 1,  1}  /* South-East (SE) neighboor (#12) */
+  };
+
+/* Coordinates of the neighboor (x+dx, y+dy) of a site, wrapped around
+   a torus; 0 if it falls outside an open lattice */
+static inline int lattice_neighbor (const struct simulation *s, int x, int y, int dx, int dy,
+                                    int *nx, int *ny)
+  {
+  *nx = x + dx;
+  *ny = y + dy;
+  if (*nx >= 0 && *nx < s->x_size && *ny >= 0 && *ny < s->y_size)
+    return 1;
+  if (s->boundary == BOUNDARY_OPEN)
+    return 0;
+  *nx = (*nx + s->x_size) % s->x_size;
+  *ny = (*ny + s->y_size) % s->y_size;
+  return 1;
+  }
+
+
+/* Local field (up - down) seen by the site at (x,y). Branch free: every
+   neighboor adds spin_of[state & 3]. radius is a compile time constant. */
+static inline int local_field_kernel (const struct simulation *s, int x, int y, long i,
+                                      const int wrap_mode, const int radius)
+  {
+  int field = 0;
+  int neighbors = (radius == 2) ? 12 : 4;
+  for (int k = 0; k < neighbors; k++)
+    field += spin_of[get_site (s, neighbor_index (s, x, y, i, neighbor_offsets[k][0],
+                                                  neighbor_offsets[k][1], wrap_mode)) & 3];
+  return field;
+  }
+
+
+/* Local field of the focal site: one read when the field cache is on */
+static inline int site_field (const struct simulation *s, int x, int y, long i,
+                              const int wrap_mode, const int radius)
+  {
+  if (s->field_cache != NULL)
+    return s->field_cache[i];
+  return local_field_kernel (s, x, y, i, wrap_mode, radius);
+  }
+
+
+/* The kernels consume the raw 64 bit outputs of the generator (rng.h):
+   - genrand64_real2 () < p  is  (r >> 11) < ceil (p * 2^53)  for the same
+     output r, so rates are compared as integer thresholds (same outcomes);
+   - a threshold above THRESHOLD_ONE means "always, without a draw";
+   - a pick among n is the high word of r * n (multiply-shift). */
+#define THRESHOLD_ONE (1ULL << 53)
+
+/* Threshold of probability p (see above) */
+static inline uint64_t rate_threshold (double p)
+  {
+  if (!(p > 0))
+    return 0;
+  if (p >= 1)
+    return THRESHOLD_ONE;
+  return (uint64_t) ceil (p * (double) THRESHOLD_ONE);
+  }
+
+/* True with the probability of threshold (<= THRESHOLD_ONE) */
+static inline int draw_below (struct rng *rng, uint64_t threshold)
+  {
+  return (rng_next (rng) >> 11) < threshold;
+  }
+
+/* Thresholds of the CP and differentiation rates, which can change
+   between generations (the GUI sliders); called at the start of a sweep */
+static inline void prepare_rate_thresholds (struct simulation *s)
+  {
+  s->birth_threshold = rate_threshold (s->birth_rate);
+  s->death_threshold = rate_threshold (s->death_rate);
+  s->differentiation_threshold = rate_threshold (s->differentiation_rate);
+  }
+
+/* Uniform integer in [0, n) */
+static inline uint64_t draw_index (struct rng *rng, uint64_t n)
+  {
+  return (uint64_t) (((unsigned __int128) rng_next (rng) * n) >> 64);
+  }
+
+
+/* Shared by the checkerboard engines (checkerboard.c, multispin.c, simd.c) */
+
+static inline int thread_count (void)
+  {
+#ifdef _OPENMP
+  return omp_get_max_threads ();
+#else
+  return 1;
+#endif
+  }
+
+static inline int thread_number (void)
+  {
+#ifdef _OPENMP
+  return omp_get_thread_num ();
+#else
+  return 0;
+#endif
+  }
+
+
+/* One generator per thread (the mt64 backend): 0 on success */
+int prepare_thread_generators (struct simulation *s);
+
+/* Stream of the sites of a color on row y, in the current generation.
+   The top bit keeps these apart from the streams of simulation_stream. */
+static inline uint64_t row_stream (const struct simulation *s, int color, int y)
+  {
+  return (1ULL << 63) | ((uint64_t) s->generation_time << 23) | ((uint64_t) color << 20) | (uint64_t) y;
+  }
+
+
+/* First x of the given color on row y (x advances by the number of colors) */
+static inline int first_x (int color, int y, const int radius)
+  {
+  if (radius == 2)
+    return (color - 2*y) & 7;
+  return (color - y) & 1;
+  }
+
+
+/* Changes of the lattice counters during a sweep */
+struct site_counts
+  {
+  long occupancy, vacancy, up, down;
+  };
+
+/* Monte Carlo step of the focal site i = site_index (s, x, y) */
+static inline void update_site (struct simulation *s, struct rng *rng, int x, int y, long focal,
+                                struct site_counts *c, const int wrap_mode, const int radius)
+  {
+  // int random_neighbor;
+  int random_neighbor_state = 0, random_neighbor;
+  int random_spin;
+  // Probability of reactions (as a threshold)
+  uint64_t transition_probability;
+  // For the Contact Process we always consider NN interactions
+  switch (get_site (s, focal))
+    {
+    case 0: /* Site is empty */
+      /* Chose a random neighbor from the num_neighbors posible ones */
+      random_neighbor = (int) (rng_next (rng) >> 62);
+      switch(random_neighbor)
+        {
+        case 0: // South
+          random_neighbor_state = get_site (s, neighbor_index (s, x, y, focal,  0, -1, wrap_mode));
+          break;
+        case 1: // North
+          random_neighbor_state = get_site (s, neighbor_index (s, x, y, focal,  0,  1, wrap_mode));
+          break;
+        case 2: // East
+          random_neighbor_state = get_site (s, neighbor_index (s, x, y, focal, -1,  0, wrap_mode));
+          break;
+        case 3: // West
+          random_neighbor_state = get_site (s, neighbor_index (s, x, y, focal,  1,  0, wrap_mode));
+          break;
+        }
+      /* If its random neighbor is occupied: put a copy at the focal site
+         with probability brith_rate * dt */
+      if (draw_below (rng, s->birth_threshold))
+         {
+         switch(random_neighbor_state)
+           {
+            case 2:
+              change_site (s, x, y, focal, 2, wrap_mode);
+              c->occupancy ++; c->vacancy --;
+             break;
+            case 1:
+              change_site (s, x, y, focal, 1, wrap_mode);
+              c->occupancy ++; c->vacancy --;
+              c->up ++;
+             break;
+            case -1:
+              change_site (s, x, y, focal, -1, wrap_mode);
+              c->occupancy ++;c->vacancy --;
+              c->down ++;
+             break;
+            case 0: /* the neighbor is empty too: nothing to copy */
+              break;
+           }
+        }
+      break; /* break case 0 */
+    case 2: /* Focal point is in the occupied, undifferentiated state */
+      // First we check if the site survives
+      // No need for Gillespie as cells are macroscopic compare to its
+      // inner components which can undertake reactions only if the cell
+      // indeed exists
+      if (draw_below (rng, s->death_threshold))
+                     {
+                      change_site (s, x, y, focal, 0, wrap_mode);
+                      c->occupancy --; c->vacancy ++;
+                     }
+           else if (draw_below (rng, s->differentiation_threshold))
+                    {
+                     /* Set an occupied site in the middle of the lattice */
+                     random_spin = (int) ((rng_next (rng) % 2) * 2) - 1;
+                    if (random_spin == 1)
+                        {
+                         change_site (s, x, y, focal, random_spin, wrap_mode);
+                         c->up ++;
+                         }
+                     else if (random_spin == -1)
+                         {
+                         change_site (s, x, y, focal, random_spin, wrap_mode);
+                         c->down ++;
+                         }
+                    }
+      break;
+    case 1: /* Focal point is in the up (+1) state */
+      // We skip Gillespie because of separation of scales
+      transition_probability = s->accept_threshold[MAX_FIELD +
+                               site_field (s, x, y, focal, wrap_mode, radius)];
+      if (draw_below (rng, s->death_threshold))
+                      {
+                      change_site (s, x, y, focal, 0, wrap_mode);
+                      c->occupancy --; c->vacancy ++;
+                      c->up --;
+                      }
+              else if (transition_probability > THRESHOLD_ONE ||
+                                            draw_below (rng, transition_probability))
+                      {
+                      change_site (s, x, y, focal, -1, wrap_mode);
+                      c->up --;
+                      c->down ++;
+                      }
+      break;
+    case -1: /* Focal point is in the down (-1) state */
+      // We skip Gillespie because of separation of scales
+      transition_probability = s->accept_threshold[MAX_FIELD -
+                               site_field (s, x, y, focal, wrap_mode, radius)];
+      if (draw_below (rng, s->death_threshold))
+                      {
+                      change_site (s, x, y, focal, 0, wrap_mode);
+                      c->occupancy --; c->vacancy ++;
+                      c->down --;
+                      }
+              else if (transition_probability > THRESHOLD_ONE ||
+                                            draw_below (rng, transition_probability))
+                      {
+                      change_site (s, x, y, focal, 1, wrap_mode);
+                      c->up ++;
+                      c->down --;
+                      }
+      break;
+    }
+  }
+
+#endif
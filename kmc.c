@@ -0,0 +1,372 @@
+// Event driven (rejection free, n-fold way) schedule for the Contact
+// Process Ising Model.
+//
+// In the random sequential update_lattice() every site is visited about
+// once per generation, and most visits do nothing: a vacancy colonizes
+// with probability birth_rate times the fraction of its NN that are
+// occupied, an occupied site dies with probability death_rate... In
+// continuous time, each site carries the rate (per generation) of the
+// events that can happen to it:
+//   vacancy with k occupied NN:  birth_rate * k/4 (copy of one of them)
+//   undifferentiated site:       death_rate + (1 - death_rate) * differentiation_rate
+//   spin s in a local field h:   death_rate + (1 - death_rate) * min (1, Metropolis (s*h))
+// These rates only depend on the state of the site and on k or s*h, so
+// the sites are kept in KMC_CLASSES lists, one per class (k, s*h). The
+// next event is drawn directly: its class with probability proportional
+// to (sites in class) * (rate of class), a uniform site of that class,
+// and the time to the event, exponential with the total rate. After an
+// event, only the site and its Ising neighboorhood change class.
+//
+// update_lattice() simulates one unit of continuous time (a generation):
+// the event that would overshoot the generation is dropped, which is
+// exact since the waiting times are memoryless. Compared with random
+// sequential updates, a site is updated a Poisson number of times per
+// generation instead of a binomial one; the rates are the same.
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "rng.h"
+#include "simulation.h"
+#include "kernels.h"
+
+/* Classes: vacancies with k = 0..4 occupied NN, undifferentiated sites,
+   and spins with s*h in [-MAX_FIELD, MAX_FIELD] */
+#define CLASS_UNDIFFERENTIATED 5
+#define CLASS_SPIN (CLASS_UNDIFFERENTIATED + 1 + MAX_FIELD)
+#define KMC_CLASSES (CLASS_SPIN + MAX_FIELD + 1)
+
+
+struct kmc
+  {
+  int x_size, y_size, radius; /* Geometry the tables were built for */
+  int lattice_epoch;          /* s->lattice_epoch the tables were built for */
+  int8_t *class_of;           /* Class of each site (y*x_size + x) */
+  int32_t *position;          /* Position of each site in the list of its class */
+  int32_t *sites[KMC_CLASSES];/* Sites of each class */
+  long count[KMC_CLASSES];    /* Sites in each class */
+  long capacity[KMC_CLASSES]; /* Allocated length of sites[] */
+  double rate[KMC_CLASSES];   /* Rate of the events of one site of each class */
+  };
+
+
+/* Can s be updated with the event driven schedule? 0 if so */
+int kmc_supported (const struct simulation *s)
+  {
+  // Sites are stored as 32 bit numbers
+  return s->n_sites < INT32_MAX ? 0 : -1;
+  }
+
+
+/* Release the tables of s */
+void kmc_free (struct simulation *s)
+  {
+  struct kmc *k = s->kmc;
+  if (k == NULL)
+    return;
+  for (int c = 0; c < KMC_CLASSES; c++)
+    free (k->sites[c]);
+  free (k->class_of);
+  free (k->position);
+  free (k);
+  s->kmc = NULL;
+  }
+
+
+void kmc_invalidate (struct simulation *s)
+  {
+  if (s->kmc != NULL)
+    s->kmc->lattice_epoch = s->lattice_epoch - 1;
+  }
+
+
+/* Class of site (x,y) from its state and neighboorhood */
+static int classify (const struct simulation *s, int x, int y, int radius)
+  {
+  int state = get_site (s, site_index (s, x, y));
+  int count = 0, nx, ny;
+  int neighbors = (state == 0) ? 4 : (radius == 2) ? 12 : 4;
+  if (state == 2)
+    return CLASS_UNDIFFERENTIATED;
+  for (int n = 0; n < neighbors; n++)
+    if (lattice_neighbor (s, x, y, neighbor_offsets[n][0], neighbor_offsets[n][1], &nx, &ny))
+      {
+      int neighbor_state = get_site (s, site_index (s, nx, ny));
+      // Occupied NN of a vacancy, or field of a spin
+      count += (state == 0) ? (neighbor_state != 0) : spin_of[neighbor_state & 3];
+      }
+  return (state == 0) ? count : CLASS_SPIN + state * count;
+  }
+
+
+/* Append site p to class c; 0 on success */
+static int class_add (struct kmc *k, int c, int32_t p)
+  {
+  if (k->count[c] == k->capacity[c])
+    {
+    long capacity = k->capacity[c] ? 2 * k->capacity[c] : 1024;
+    int32_t *sites = realloc (k->sites[c], (size_t) capacity * sizeof (int32_t));
+    if (sites == NULL)
+      return -1;
+    k->sites[c] = sites;
+    k->capacity[c] = capacity;
+    }
+  k->position[p] = (int32_t) k->count[c];
+  k->sites[c][k->count[c]++] = p;
+  k->class_of[p] = (int8_t) c;
+  return 0;
+  }
+
+/* Remove site p from its class (the last site of the class takes its place) */
+static void class_remove (struct kmc *k, int32_t p)
+  {
+  int c = k->class_of[p];
+  int32_t last = k->sites[c][--k->count[c]];
+  k->sites[c][k->position[p]] = last;
+  k->position[last] = k->position[p];
+  }
+
+
+/* Are the tables of s up to date? */
+static int kmc_current (const struct simulation *s)
+  {
+  const struct kmc *k = s->kmc;
+  return k != NULL && k->x_size == s->x_size && k->y_size == s->y_size
+         && k->radius == ((s->Ising_neighboorhood == 2) ? 2 : 1) && k->lattice_epoch == s->lattice_epoch;
+  }
+
+
+/* The order of the sites in their classes decides which site an event
+   picks, so checkpoints keep it: the counts of the classes (int64), then
+   the sites of each class (int32) */
+size_t kmc_state_bytes (const struct simulation *s)
+  {
+  if (!kmc_current (s))
+    return 0;
+  return KMC_CLASSES * sizeof (int64_t) + (size_t) s->n_sites * sizeof (int32_t);
+  }
+
+void kmc_state_save (const struct simulation *s, void *data)
+  {
+  const struct kmc *k = s->kmc;
+  int64_t *count = data;
+  int32_t *sites = (int32_t *) (count + KMC_CLASSES);
+  for (int c = 0; c < KMC_CLASSES; c++)
+    {
+    count[c] = k->count[c];
+    if (k->count[c] > 0)
+      memcpy (sites, k->sites[c], (size_t) k->count[c] * sizeof (int32_t));
+    sites += k->count[c];
+    }
+  }
+
+int kmc_state_load (struct simulation *s, const void *data, size_t bytes)
+  {
+  const int64_t *count = data;
+  const int32_t *sites = (const int32_t *) (count + KMC_CLASSES);
+  struct kmc *k;
+  int64_t total = 0;
+  if (bytes != KMC_CLASSES * sizeof (int64_t) + (size_t) s->n_sites * sizeof (int32_t))
+    return -1;
+  for (int c = 0; c < KMC_CLASSES; c++)
+    total += (count[c] >= 0) ? count[c] : s->n_sites + 1;
+  if (total != s->n_sites)
+    return -1;
+  kmc_free (s);
+  k = calloc (1, sizeof (struct kmc));
+  if (k == NULL)
+    return -1;
+  s->kmc = k;
+  k->x_size = s->x_size;
+  k->y_size = s->y_size;
+  k->radius = (s->Ising_neighboorhood == 2) ? 2 : 1;
+  k->lattice_epoch = s->lattice_epoch;
+  k->class_of = malloc ((size_t) s->n_sites * sizeof (int8_t));
+  k->position = malloc ((size_t) s->n_sites * sizeof (int32_t));
+  if (k->class_of == NULL || k->position == NULL)
+    {
+    kmc_free (s);
+    return -1;
+    }
+  for (long p = 0; p < s->n_sites; p++)
+    k->position[p] = -1;
+  // Every site once, in its saved place
+  for (int c = 0; c < KMC_CLASSES; c++)
+    {
+    for (long i = 0; i < count[c]; i++)
+      if (sites[i] < 0 || sites[i] >= s->n_sites || k->position[sites[i]] >= 0
+          || class_add (k, c, sites[i]) != 0)
+        {
+        kmc_free (s);
+        return -1;
+        }
+    sites += count[c];
+    }
+  return 0;
+  }
+
+
+/* (Re)build the tables of s if the lattice was changed from outside the
+   schedule; 0 on success */
+static int prepare_kmc (struct simulation *s)
+  {
+  struct kmc *k = s->kmc;
+  int radius = (s->Ising_neighboorhood == 2) ? 2 : 1;
+  if (k != NULL && k->x_size == s->x_size && k->y_size == s->y_size
+      && k->radius == radius && k->lattice_epoch == s->lattice_epoch)
+    return 0;
+  kmc_free (s);
+  k = calloc (1, sizeof (struct kmc));
+  if (k == NULL)
+    return -1;
+  s->kmc = k;
+  k->x_size = s->x_size;
+  k->y_size = s->y_size;
+  k->radius = radius;
+  k->lattice_epoch = s->lattice_epoch;
+  k->class_of = malloc ((size_t) s->n_sites * sizeof (int8_t));
+  k->position = malloc ((size_t) s->n_sites * sizeof (int32_t));
+  if (k->class_of == NULL || k->position == NULL)
+    {
+    kmc_free (s);
+    return -1;
+    }
+  for (int y = 0; y < s->y_size; y++)
+    for (int x = 0; x < s->x_size; x++)
+      if (class_add (k, classify (s, x, y, radius), (int32_t) y * s->x_size + x) != 0)
+        {
+        kmc_free (s);
+        return -1;
+        }
+  return 0;
+  }
+
+
+/* Rates of the classes with the current parameters */
+static void class_rates (const struct simulation *s, struct kmc *k)
+  {
+  double delta = s->death_rate, acceptance;
+  for (int c = 0; c <= 4; c++)
+    k->rate[c] = s->birth_rate * c / 4.0;
+  k->rate[CLASS_UNDIFFERENTIATED] = delta + (1 - delta) * s->differentiation_rate;
+  for (int field = -MAX_FIELD; field <= MAX_FIELD; field++)
+    {
+    acceptance = s->boltzmann[MAX_FIELD + field];
+    k->rate[CLASS_SPIN + field] = delta + (1 - delta) * (acceptance > 1 ? 1 : acceptance);
+    }
+  }
+
+
+/* Uniform number on [0,1) */
+static inline double uniform (struct rng *rng)
+  {
+  return (rng_next (rng) >> 11) * (1.0/9007199254740992.0);
+  }
+
+
+/* Set site (x,y) to state and move it, and its Ising neighboorhood, to
+   their new classes; 0 on success */
+static int kmc_change_site (struct simulation *s, struct kmc *k, int x, int y, int state)
+  {
+  int neighbors = (k->radius == 2) ? 12 : 4, nx, ny, c;
+  int32_t p;
+  change_site (s, x, y, site_index (s, x, y), state, wrap_mode_of (s));
+  for (int n = -1; n < neighbors; n++)
+    {
+    if (n < 0)
+      {
+      nx = x;
+      ny = y;
+      }
+    else if (!lattice_neighbor (s, x, y, neighbor_offsets[n][0], neighbor_offsets[n][1], &nx, &ny))
+      continue;
+    p = (int32_t) ny * s->x_size + nx;
+    c = classify (s, nx, ny, k->radius);
+    if (c == k->class_of[p])
+      continue;
+    class_remove (k, p);
+    if (class_add (k, c, p) != 0)
+      return -1;
+    }
+  return 0;
+  }
+
+
+/* Draw and perform one event of class c */
+static int kmc_event (struct simulation *s, struct kmc *k, int c)
+  {
+  int32_t p = k->sites[c][draw_index (&s->rng, (uint64_t) k->count[c])];
+  int x = p % s->x_size, y = p / s->x_size;
+  int state = get_site (s, site_index (s, x, y));
+  int nx, ny, pick;
+  if (state == 0)
+    {
+    // Colonization by one of the c occupied NN, at random
+    pick = (int) draw_index (&s->rng, (uint64_t) c);
+    for (int n = 0; n < 4; n++)
+      if (lattice_neighbor (s, x, y, neighbor_offsets[n][0], neighbor_offsets[n][1], &nx, &ny)
+          && get_site (s, site_index (s, nx, ny)) != 0 && pick-- == 0)
+        {
+        state = get_site (s, site_index (s, nx, ny));
+        break;
+        }
+    s->occupancy ++; s->vacancy --;
+    s->up += (state == 1); s->down += (state == -1);
+    return kmc_change_site (s, k, x, y, state);
+    }
+  s->up -= (state == 1); s->down -= (state == -1);
+  if (uniform (&s->rng) * k->rate[c] < s->death_rate)
+    {
+    s->occupancy --; s->vacancy ++;
+    return kmc_change_site (s, k, x, y, 0);
+    }
+  if (state == 2)
+    state = (int) ((rng_next (&s->rng) % 2) * 2) - 1;
+  else
+    state = -state;
+  s->up += (state == 1); s->down += (state == -1);
+  return kmc_change_site (s, k, x, y, state);
+  }
+
+
+/* One generation (one unit of continuous time) of the event driven schedule */
+int update_lattice_kmc (struct simulation *s)
+  {
+  struct kmc *k;
+  double time = 0, total;
+  int c;
+  if (prepare_kmc (s) != 0)
+    return -1;
+  k = s->kmc;
+  class_rates (s, k);
+  for (;;)
+    {
+    total = 0;
+    for (c = 0; c < KMC_CLASSES; c++)
+      total += k->count[c] * k->rate[c];
+    if (total <= 0)
+      break;                  /* absorbing state */
+    time -= log (1 - uniform (&s->rng)) / total;
+    if (time >= 1)
+      break;
+    // Class of the event
+    total *= uniform (&s->rng);
+    for (c = 0; c < KMC_CLASSES - 1; c++)
+      {
+      total -= k->count[c] * k->rate[c];
+      if (total < 0)
+        break;
+      }
+    while (k->count[c] == 0 || k->rate[c] <= 0)
+      c--;                    /* rounding left us past the last class */
+    // A class could not grow: the site moved is in none, so the tables
+    // are rebuilt from the lattice on next use
+    if (kmc_event (s, k, c) != 0)
+      {
+      kmc_free (s);
+      return -1;
+      }
+    }
+  s->generation_time ++;
+  return 0;
+  }
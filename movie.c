@@ -0,0 +1,403 @@
+// Time-lapse movies of the lattice.
+//
+// A frame is the lattice packed 2 bits per site (pack_lattice). The
+// simulation thread copies it into one of MOVIE_SLOTS slots of a single
+// producer, single consumer queue, as observables.c does with its
+// samples: that copy is all the sweep loop pays, and a frame is dropped
+// (and counted) rather than waited for when every slot is taken. The
+// writer thread compresses each frame against the one before it: between
+// two generations few sites change, so the XOR of consecutive frames is
+// mostly zero bytes, and runs of zeros and of literal bytes store it in a
+// fraction of the frame. Every keyframe_interval frames (and at the first
+// one) the frame is stored whole, with the same runs against an empty
+// lattice, so a reader seeks to a keyframe rather than to the start.
+//
+// Layout (version 1, in the byte order of the host):
+//   header  "CPIMMOV" '\0', uint32 version, int32 x_size, int32 y_size,
+//           int32 interval, int32 keyframe_interval, uint32 0
+//   frames  uint8 type ('K' keyframe, 'D' delta), uint8 coding (0: the
+//           (x_size*y_size + 3)/4 bytes as they are, 1: runs), uint16 0,
+//           int32 generation, uint64 bytes, then the bytes
+// Runs are pairs of unsigned LEB128 numbers, zeros then literals, the
+// literal bytes following the pair; they cover the frame (keyframes) or
+// its XOR with the previous frame (deltas). A frame cut short by a crash
+// ends the movie.
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "simulation.h"
+#include "movie.h"
+
+/* Zero bytes that end a run of literals: shorter runs of zeros cost less
+   as literals than as a new pair */
+#define MOVIE_ZEROS 4
+
+struct movie_header
+  {
+  char magic[8];              /* "CPIMMOV" */
+  uint32_t version;           /* MOVIE_VERSION */
+  int32_t x_size, y_size;
+  int32_t interval, keyframe_interval;
+  uint32_t reserved;
+  };
+
+struct movie_frame_header
+  {
+  uint8_t type;               /* 'K' or 'D' */
+  uint8_t coding;             /* 0: stored, 1: runs */
+  uint16_t reserved;
+  int32_t generation;
+  uint64_t bytes;             /* Bytes that follow */
+  };
+
+
+/* Append n to out as an unsigned LEB128 number; bytes written */
+static size_t put_number (uint8_t *out, size_t n)
+  {
+  size_t k = 0;
+  while (n >= 0x80)
+    {
+    out[k++] = (uint8_t) (n | 0x80);
+    n >>= 7;
+    }
+  out[k++] = (uint8_t) n;
+  return k;
+  }
+
+/* Read a LEB128 number of in[*k..bytes) into n; -1 if it is cut short */
+static int get_number (const uint8_t *in, size_t bytes, size_t *k, size_t *n)
+  {
+  *n = 0;
+  for (int shift = 0; *k < bytes && shift < 64; shift += 7)
+    {
+    uint8_t byte = in[(*k)++];
+    *n |= (size_t) (byte & 0x7f) << shift;
+    if (byte < 0x80)
+      return 0;
+    }
+  return -1;
+  }
+
+
+/* Runs of the n bytes of data into out (at most 2*n + 2 bytes); bytes written */
+static size_t encode_runs (const uint8_t *data, size_t n, uint8_t *out)
+  {
+  size_t i = 0, o = 0, start, end;
+  while (i < n)
+    {
+    start = i;
+    while (i < n && data[i] == 0)
+      i++;
+    o += put_number (out + o, i - start);
+    // Literals up to MOVIE_ZEROS zeros in a row
+    start = end = i;
+    for (; i < n && i - end < MOVIE_ZEROS; i++)
+      if (data[i] != 0)
+        end = i + 1;
+    i = end;
+    o += put_number (out + o, end - start);
+    memcpy (out + o, data + start, end - start);
+    o += end - start;
+    }
+  return o;
+  }
+
+/* XOR the runs of in (bytes long) into the n bytes of frame; -1 if they do
+   not fit */
+static int decode_runs (const uint8_t *in, size_t bytes, uint8_t *frame, size_t n)
+  {
+  size_t k = 0, p = 0, zeros, literals;
+  while (k < bytes)
+    {
+    if (get_number (in, bytes, &k, &zeros) != 0 || get_number (in, bytes, &k, &literals) != 0
+        || zeros > n - p || literals > n - p - zeros || literals > bytes - k)
+      return -1;
+    p += zeros;
+    for (size_t j = 0; j < literals; j++)
+      frame[p + j] ^= in[k + j];
+    p += literals;
+    k += literals;
+    }
+  return 0;
+  }
+
+
+/* Compress and append the frame in slot (the writer keeps the last frame
+   in m->previous) */
+static void write_frame (struct movie *m, const uint8_t *slot, int generation)
+  {
+  struct movie_frame_header header;
+  const uint8_t *data = slot;
+  size_t n = m->frame_bytes, bytes;
+  memset (&header, 0, sizeof (header));
+  header.type = (m->written % m->keyframe_interval == 0) ? 'K' : 'D';
+  header.generation = generation;
+  if (header.type == 'D')
+    {
+    // previous becomes the difference, then the frame again below
+    for (size_t i = 0; i < n; i++)
+      m->previous[i] ^= slot[i];
+    data = m->previous;
+    }
+  bytes = encode_runs (data, n, m->encoded);
+  header.coding = bytes < n;
+  header.bytes = header.coding ? bytes : n;
+  if (fwrite (&header, sizeof (header), 1, m->file) != 1
+      || fwrite (header.coding ? m->encoded : data, 1, header.bytes, m->file) != header.bytes)
+    m->error = 1;
+  memcpy (m->previous, slot, n);
+  m->written ++;
+  }
+
+
+/* Writer thread: drain the queue until it is closed and empty */
+static void *writer (void *data)
+  {
+  struct movie *m = data;
+  const struct timespec pause = {0, 1000000};
+  uint64_t head, tail;
+  int closing;
+  for (;;)
+    {
+    // Read closing first: a frame pushed before closing is then seen in head
+    closing = atomic_load_explicit (&m->closing, memory_order_acquire);
+    head = atomic_load_explicit (&m->head, memory_order_acquire);
+    tail = atomic_load_explicit (&m->tail, memory_order_relaxed);
+    if (head != tail)
+      {
+      int slot = (int) (tail & (MOVIE_SLOTS - 1));
+      write_frame (m, m->slots + (size_t) slot * m->frame_bytes, m->generation[slot]);
+      atomic_store_explicit (&m->tail, tail + 1, memory_order_release);
+      continue;
+      }
+    fflush (m->file);
+    if (closing)
+      break;
+    nanosleep (&pause, NULL);
+    }
+  return NULL;
+  }
+
+
+static void movie_release (struct movie *m)
+  {
+  if (m->file != NULL)
+    fclose (m->file);
+  free (m->slots);
+  free (m->previous);
+  free (m->encoded);
+  memset (m, 0, sizeof (*m));
+  }
+
+
+int movie_open (struct movie *m, const char *path, const struct simulation *s,
+                int interval, int keyframe_interval)
+  {
+  struct movie_header header;
+  memset (m, 0, sizeof (*m));
+  if (interval < 1 || keyframe_interval < 1)
+    return -1;
+  m->x_size = s->x_size;
+  m->y_size = s->y_size;
+  m->frame_bytes = (size_t) (s->n_sites + 3) / 4;
+  m->interval = interval;
+  m->keyframe_interval = keyframe_interval;
+  m->last_generation = -1;
+  m->slots = malloc (MOVIE_SLOTS * m->frame_bytes);
+  m->previous = malloc (m->frame_bytes);
+  m->encoded = malloc (2 * m->frame_bytes + 16);
+  m->file = fopen (path, "wb");
+  if (m->slots == NULL || m->previous == NULL || m->encoded == NULL || m->file == NULL)
+    {
+    movie_release (m);
+    return -1;
+    }
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, "CPIMMOV", 8);
+  header.version = MOVIE_VERSION;
+  header.x_size = m->x_size;
+  header.y_size = m->y_size;
+  header.interval = interval;
+  header.keyframe_interval = keyframe_interval;
+  atomic_init (&m->head, 0);
+  atomic_init (&m->tail, 0);
+  atomic_init (&m->closing, 0);
+  atomic_init (&m->dropped, 0);
+  if (fwrite (&header, sizeof (header), 1, m->file) != 1
+      || pthread_create (&m->writer, NULL, writer, m) != 0)
+    {
+    movie_release (m);
+    return -1;
+    }
+  return 0;
+  }
+
+
+void movie_frame (struct movie *m, const struct simulation *s)
+  {
+  uint64_t head, tail;
+  int slot;
+  if (m->slots == NULL || s->generation_time % m->interval != 0 || s->generation_time == m->last_generation)
+    return;
+  m->last_generation = s->generation_time;
+  head = atomic_load_explicit (&m->head, memory_order_relaxed);
+  tail = atomic_load_explicit (&m->tail, memory_order_acquire);
+  if (head - tail == MOVIE_SLOTS)
+    {
+    atomic_fetch_add_explicit (&m->dropped, 1, memory_order_relaxed);
+    return;
+    }
+  slot = (int) (head & (MOVIE_SLOTS - 1));
+  pack_lattice (s, m->slots + (size_t) slot * m->frame_bytes);
+  m->generation[slot] = s->generation_time;
+  atomic_store_explicit (&m->head, head + 1, memory_order_release);
+  }
+
+
+void movie_restart (struct movie *m)
+  {
+  m->last_generation = -1;
+  }
+
+
+long movie_dropped (struct movie *m)
+  {
+  return atomic_load_explicit (&m->dropped, memory_order_relaxed);
+  }
+
+
+int movie_close (struct movie *m)
+  {
+  int status;
+  if (m->slots == NULL)
+    return 0;
+  atomic_store_explicit (&m->closing, 1, memory_order_release);
+  pthread_join (m->writer, NULL);
+  status = (m->error || ferror (m->file)) ? -1 : 0;
+  if (fclose (m->file) != 0)
+    status = -1;
+  m->file = NULL;
+  movie_release (m);
+  return status;
+  }
+
+
+int movie_reader_open (struct movie_reader *r, const char *path)
+  {
+  struct movie_header header;
+  struct movie_frame_header frame;
+  long capacity = 0;
+  off_t offset, file_bytes;
+  memset (r, 0, sizeof (*r));
+  r->current = -1;
+  r->file = fopen (path, "rb");
+  if (r->file == NULL)
+    return -1;
+  if (fread (&header, sizeof (header), 1, r->file) != 1 || memcmp (header.magic, "CPIMMOV", 8) != 0
+      || header.version != MOVIE_VERSION || header.x_size < 1 || header.y_size < 1
+      || fseeko (r->file, 0, SEEK_END) != 0 || (file_bytes = ftello (r->file)) < 0)
+    {
+    movie_reader_close (r);
+    return -1;
+    }
+  r->x_size = header.x_size;
+  r->y_size = header.y_size;
+  r->frame_bytes = ((size_t) header.x_size * (size_t) header.y_size + 3) / 4;
+  r->interval = header.interval;
+  r->frame = malloc (r->frame_bytes);
+  r->buffer = malloc (2 * r->frame_bytes + 16);
+  if (r->frame == NULL || r->buffer == NULL)
+    {
+    movie_reader_close (r);
+    return -1;
+    }
+  // Index the frames from their headers; a frame cut short ends the movie
+  for (offset = (off_t) sizeof (header);; r->frames++)
+    {
+    if (fseeko (r->file, offset, SEEK_SET) != 0 || fread (&frame, sizeof (frame), 1, r->file) != 1
+        || (frame.type != 'K' && frame.type != 'D') || frame.bytes > 2 * r->frame_bytes + 16
+        || (frame.coding == 0 && frame.bytes != r->frame_bytes)
+        || (uint64_t) (file_bytes - offset) - sizeof (frame) < frame.bytes)
+      break;
+    if (r->frames == capacity)
+      {
+      struct movie_entry *index;
+      capacity = capacity ? 2 * capacity : 1024;
+      index = realloc (r->index, (size_t) capacity * sizeof (struct movie_entry));
+      if (index == NULL)
+        {
+        movie_reader_close (r);
+        return -1;
+        }
+      r->index = index;
+      }
+    r->index[r->frames].offset = offset;
+    r->index[r->frames].bytes = frame.bytes;
+    r->index[r->frames].generation = frame.generation;
+    r->index[r->frames].keyframe = frame.type == 'K';
+    offset += (off_t) (sizeof (frame) + frame.bytes);
+    }
+  return 0;
+  }
+
+
+/* XOR frame k into r->frame */
+static int apply_frame (struct movie_reader *r, long k)
+  {
+  struct movie_frame_header frame;
+  if (fseeko (r->file, r->index[k].offset, SEEK_SET) != 0 || fread (&frame, sizeof (frame), 1, r->file) != 1
+      || fread (r->buffer, 1, frame.bytes, r->file) != frame.bytes)
+    return -1;
+  if (frame.coding == 0)
+    {
+    for (size_t i = 0; i < r->frame_bytes; i++)
+      r->frame[i] ^= r->buffer[i];
+    return 0;
+    }
+  return decode_runs (r->buffer, frame.bytes, r->frame, r->frame_bytes);
+  }
+
+
+int movie_reader_frame (struct movie_reader *r, long k)
+  {
+  long key = k, first;
+  if (k < 0 || k >= r->frames)
+    return -1;
+  if (k == r->current)
+    return 0;
+  while (key > 0 && !r->index[key].keyframe)
+    key --;
+  if (!r->index[key].keyframe)
+    return -1;
+  // Go on from the frame held when it lies between the keyframe and k
+  if (r->current >= key && r->current < k)
+    first = r->current + 1;
+  else
+    {
+    memset (r->frame, 0, r->frame_bytes);
+    first = key;
+    }
+  r->current = -1;
+  for (long j = first; j <= k; j++)
+    {
+    if (r->index[j].keyframe)
+      memset (r->frame, 0, r->frame_bytes);
+    if (apply_frame (r, j) != 0)
+      return -1;
+    }
+  r->current = k;
+  return 0;
+  }
+
+
+void movie_reader_close (struct movie_reader *r)
+  {
+  if (r->file != NULL)
+    fclose (r->file);
+  free (r->index);
+  free (r->frame);
+  free (r->buffer);
+  memset (r, 0, sizeof (*r));
+  r->current = -1;
+  }
@@ -0,0 +1,106 @@
+// Time-lapse movies of the lattice: the simulation thread copies a frame
+// (2 bits per site) every N generations into a queue, and a writer thread
+// compresses it against the previous frame and appends it to the file; a
+// reader decodes any frame back; see movie.c.
+
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "simulation.h"
+
+/* Version of the file format */
+#define MOVIE_VERSION 1
+
+/* Frames the queue holds (a power of 2): when the writer falls this far
+   behind, new frames are dropped (and counted) rather than waiting */
+#define MOVIE_SLOTS 4
+
+/* Default frames between two keyframes (frames stored whole, where the
+   reader can start decoding) */
+#define MOVIE_KEYFRAME 64
+
+
+/* A movie being written. The simulation thread only calls movie_frame ();
+   it never takes a lock nor waits for the writer. */
+struct movie
+  {
+  FILE *file;                 /* Output */
+  int x_size, y_size;         /* Lattice of the frames */
+  size_t frame_bytes;         /* (x_size*y_size + 3)/4 */
+  int interval;               /* Generations between two frames */
+  int keyframe_interval;      /* Frames between two keyframes */
+  uint8_t *slots;             /* MOVIE_SLOTS frames of frame_bytes */
+  int generation[MOVIE_SLOTS];/* Generation of each frame of the queue */
+  _Atomic uint64_t head;      /* Frames pushed (by the simulation thread) */
+  _Atomic uint64_t tail;      /* Frames written (by the writer thread) */
+  _Atomic int closing;        /* Set by movie_close () */
+  _Atomic long dropped;       /* Frames lost to a full queue */
+  int last_generation;        /* Generation of the last frame, -1: none */
+  uint8_t *previous;          /* Writer: last frame written */
+  uint8_t *encoded;           /* Writer: the frame being compressed */
+  long written;               /* Writer: frames written */
+  int error;                  /* Writer: has a write failed? */
+  pthread_t writer;           /* Writer thread */
+  };
+
+/* Where a frame of a movie is */
+struct movie_entry
+  {
+  off_t offset;               /* File offset of the header of the frame */
+  uint64_t bytes;             /* Compressed size */
+  int generation;
+  int keyframe;               /* Is it a keyframe? */
+  };
+
+/* A movie being read */
+struct movie_reader
+  {
+  FILE *file;
+  int x_size, y_size;         /* Lattice of the frames */
+  size_t frame_bytes;         /* (x_size*y_size + 3)/4 */
+  int interval;               /* Generations between two frames (as recorded) */
+  long frames;                /* Frames of the movie */
+  struct movie_entry *index;  /* Where each frame is */
+  uint8_t *frame;             /* The decoded frame: sites as pack_lattice () stores them */
+  long current;               /* Frame held in frame, -1: none */
+  uint8_t *buffer;            /* Compressed frame being decoded */
+  };
+
+
+/* Create path for frames of s every interval generations, a keyframe every
+   keyframe_interval frames, and start the writer. 0 on success */
+int movie_open (struct movie *m, const char *path, const struct simulation *s,
+                int interval, int keyframe_interval);
+
+/* Queue a frame of s if its generation is a multiple of the interval (call
+   it after every generation; the lattice is copied on sampled ones only) */
+void movie_frame (struct movie *m, const struct simulation *s);
+
+/* The lattice was initialized again: its generations start over, and the
+   next frame of generation 0 is taken again */
+void movie_restart (struct movie *m);
+
+/* Write the frames left, stop the writer and close the file. 0 on
+   success, -1 if a write failed */
+int movie_close (struct movie *m);
+
+/* Frames lost to a full queue so far */
+long movie_dropped (struct movie *m);
+
+/* Open the movie at path and index its frames. 0 on success, -1 if it can
+   not be read or is not a movie of this version */
+int movie_reader_open (struct movie_reader *r, const char *path);
+
+/* Decode frame k into r->frame (from the last keyframe before it, or
+   from the frame held if that is closer). 0 on success */
+int movie_reader_frame (struct movie_reader *r, long k);
+
+/* Close the movie */
+void movie_reader_close (struct movie_reader *r);
+
+#endif
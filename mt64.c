@@ -55,36 +55,46 @@
 
 
 #include <stdio.h>
+#include <string.h>
 #include "mt64.h"
 
-#define NN 312
+#define NN MT64_NN
 #define MM 156
 #define MATRIX_A 0xB5026F5AA96619E9ULL
 #define UM 0xFFFFFFFF80000000ULL /* Most significant 33 bits */
 #define LM 0x7FFFFFFFULL /* Least significant 31 bits */
 
 
-/* The array for the state vector */
-static unsigned long long mt[NN]; 
+/* The state used by the non re-entrant functions */
 /* mti==NN+1 means mt[NN] is not initialized */
-static int mti=NN+1; 
+static mt64_state global_state = {{0ULL}, NN+1, {0ULL}};
 
-/* initializes mt[NN] with a seed */
-void init_genrand64(unsigned long long seed)
+/* state of the non re-entrant functions */
+mt64_state *genrand64_global_state(void)
+{
+    return &global_state;
+}
+
+/* initializes state->mt[NN] with a seed */
+void init_genrand64_r(mt64_state *state, unsigned long long seed)
 {
+    unsigned long long *mt = state->mt;
+    int mti;
     mt[0] = seed;
     for (mti=1; mti<NN; mti++) 
         mt[mti] =  (6364136223846793005ULL * (mt[mti-1] ^ (mt[mti-1] >> 62)) + mti);
+    state->mti = mti;
 }
 
 /* initialize by an array with array-length */
 /* init_key is the array for initializing keys */
 /* key_length is its length */
-void init_by_array64(unsigned long long init_key[],
-		     unsigned long long key_length)
+void init_by_array64_r(mt64_state *state, unsigned long long init_key[],
+		       unsigned long long key_length)
 {
     unsigned long long i, j, k;
-    init_genrand64(19650218ULL);
+    unsigned long long *mt = state->mt;
+    init_genrand64_r(state, 19650218ULL);
     i=1; j=0;
     k = (NN>key_length ? NN : key_length);
     for (; k; k--) {
@@ -104,64 +114,144 @@ void init_by_array64(unsigned long long init_key[],
     mt[0] = 1ULL << 63; /* MSB is 1; assuring non-zero initial array */ 
 }
 
-/* generates a random number on [0, 2^64-1]-interval */
-unsigned long long genrand64_int64(void)
+/* initializes state with stream number `stream` of the master seed */
+void init_genrand64_stream_r(mt64_state *state, unsigned long long seed,
+			     unsigned long long stream)
+{
+    unsigned long long init_key[2];
+    init_key[0] = seed;
+    init_key[1] = stream;
+    init_by_array64_r(state, init_key, 2);
+}
+
+/* generates the next NN outputs into state->out at one time. Both loops
+   are branch free (the MATRIX_A term is masked in rather than looked up),
+   so the compiler can vectorise them. */
+void genrand64_refill_r(mt64_state *state)
 {
     int i;
     unsigned long long x;
-    static unsigned long long mag01[2]={0ULL, MATRIX_A};
-
-    if (mti >= NN) { /* generate NN words at one time */
-
-        /* if init_genrand64() has not been called, */
-        /* a default initial seed is used     */
-        if (mti == NN+1) 
-            init_genrand64(5489ULL); 
-
-        for (i=0;i<NN-MM;i++) {
-            x = (mt[i]&UM)|(mt[i+1]&LM);
-            mt[i] = mt[i+MM] ^ (x>>1) ^ mag01[(int)(x&1ULL)];
-        }
-        for (;i<NN-1;i++) {
-            x = (mt[i]&UM)|(mt[i+1]&LM);
-            mt[i] = mt[i+(MM-NN)] ^ (x>>1) ^ mag01[(int)(x&1ULL)];
-        }
-        x = (mt[NN-1]&UM)|(mt[0]&LM);
-        mt[NN-1] = mt[MM-1] ^ (x>>1) ^ mag01[(int)(x&1ULL)];
-
-        mti = 0;
+    unsigned long long *mt = state->mt;
+    unsigned long long *out = state->out;
+
+    /* if init_genrand64() has not been called, */
+    /* a default initial seed is used     */
+    if (state->mti == NN+1) 
+        init_genrand64_r(state, 5489ULL); 
+
+    for (i=0;i<NN-MM;i++) {
+        x = (mt[i]&UM)|(mt[i+1]&LM);
+        mt[i] = mt[i+MM] ^ (x>>1) ^ (-(x&1ULL) & MATRIX_A);
+    }
+    for (;i<NN-1;i++) {
+        x = (mt[i]&UM)|(mt[i+1]&LM);
+        mt[i] = mt[i+(MM-NN)] ^ (x>>1) ^ (-(x&1ULL) & MATRIX_A);
     }
-  
-    x = mt[mti++];
+    x = (mt[NN-1]&UM)|(mt[0]&LM);
+    mt[NN-1] = mt[MM-1] ^ (x>>1) ^ (-(x&1ULL) & MATRIX_A);
+
+    /* tempering */
+    for (i=0;i<NN;i++) {
+        x = mt[i];
+        x ^= (x >> 29) & 0x5555555555555555ULL;
+        x ^= (x << 17) & 0x71D67FFFEDA60000ULL;
+        x ^= (x << 37) & 0xFFF7EEE000000000ULL;
+        x ^= (x >> 43);
+        out[i] = x;
+    }
+
+    state->mti = 0;
+}
+
+/* generates a random number on [0, 2^64-1]-interval */
+unsigned long long genrand64_int64_r(mt64_state *state)
+{
+    return genrand64_next_r(state);
+}
+
+/* fills out[0..n-1] with the next n numbers on [0, 2^64-1]-interval */
+void genrand64_fill_r(mt64_state *state, unsigned long long *out, size_t n)
+{
+    size_t m;
+    while (n > 0) {
+        if (state->mti >= NN)
+            genrand64_refill_r(state);
+        m = (size_t)(NN - state->mti);
+        if (m > n)
+            m = n;
+        memcpy(out, state->out + state->mti, m * sizeof(unsigned long long));
+        state->mti += (int)m;
+        out += m;
+        n -= m;
+    }
+}
+
+/* generates a random number on [0, 2^63-1]-interval */
+long long genrand64_int63_r(mt64_state *state)
+{
+    return (long long)(genrand64_int64_r(state) >> 1);
+}
+
+/* generates a random number on [0,1]-real-interval */
+double genrand64_real1_r(mt64_state *state)
+{
+    return (genrand64_int64_r(state) >> 11) * (1.0/9007199254740991.0);
+}
+
+/* generates a random number on [0,1)-real-interval */
+double genrand64_real2_r(mt64_state *state)
+{
+    return (genrand64_int64_r(state) >> 11) * (1.0/9007199254740992.0);
+}
+
+/* generates a random number on (0,1)-real-interval */
+double genrand64_real3_r(mt64_state *state)
+{
+    return ((genrand64_int64_r(state) >> 12) + 0.5) * (1.0/4503599627370496.0);
+}
+
 
-    x ^= (x >> 29) & 0x5555555555555555ULL;
-    x ^= (x << 17) & 0x71D67FFFEDA60000ULL;
-    x ^= (x << 37) & 0xFFF7EEE000000000ULL;
-    x ^= (x >> 43);
+/* The original, non re-entrant, interface: thin wrappers on one global state */
 
-    return x;
+/* initializes mt[NN] with a seed */
+void init_genrand64(unsigned long long seed)
+{
+    init_genrand64_r(&global_state, seed);
+}
+
+/* initialize by an array with array-length */
+void init_by_array64(unsigned long long init_key[],
+		     unsigned long long key_length)
+{
+    init_by_array64_r(&global_state, init_key, key_length);
+}
+
+/* generates a random number on [0, 2^64-1]-interval */
+unsigned long long genrand64_int64(void)
+{
+    return genrand64_int64_r(&global_state);
 }
 
 /* generates a random number on [0, 2^63-1]-interval */
 long long genrand64_int63(void)
 {
-    return (long long)(genrand64_int64() >> 1);
+    return genrand64_int63_r(&global_state);
 }
 
 /* generates a random number on [0,1]-real-interval */
 double genrand64_real1(void)
 {
-    return (genrand64_int64() >> 11) * (1.0/9007199254740991.0);
+    return genrand64_real1_r(&global_state);
 }
 
 /* generates a random number on [0,1)-real-interval */
 double genrand64_real2(void)
 {
-    return (genrand64_int64() >> 11) * (1.0/9007199254740992.0);
+    return genrand64_real2_r(&global_state);
 }
 
 /* generates a random number on (0,1)-real-interval */
 double genrand64_real3(void)
 {
-    return ((genrand64_int64() >> 12) + 0.5) * (1.0/4503599627370496.0);
+    return genrand64_real3_r(&global_state);
 }
@@ -53,6 +53,59 @@
    email: m-mat @ math.sci.hiroshima-u.ac.jp (remove spaces)
 */
 
+#ifndef MT64_H
+#define MT64_H
+
+#include <stddef.h>
+
+#define MT64_NN 312
+
+/* State of one generator, for the re-entrant (_r) functions below.
+   Several states can be used from different threads at the same time.
+   The outputs are generated (and tempered) NN at a time into out[]. */
+typedef struct {
+    unsigned long long mt[MT64_NN]; /* The array for the state vector */
+    int mti;                        /* mti==NN+1 means mt[NN] is not initialized,
+                                       otherwise the next output is out[mti] */
+    unsigned long long out[MT64_NN];/* Tempered outputs of the current block */
+} mt64_state;
+
+/* Re-entrant interface: same generator, explicit state */
+void init_genrand64_r(mt64_state *state, unsigned long long seed);
+void init_by_array64_r(mt64_state *state, unsigned long long init_key[],
+		       unsigned long long key_length);
+unsigned long long genrand64_int64_r(mt64_state *state);
+/* out[0..n-1] = the next n outputs of genrand64_int64_r */
+void genrand64_fill_r(mt64_state *state, unsigned long long *out, size_t n);
+long long genrand64_int63_r(mt64_state *state);
+double genrand64_real1_r(mt64_state *state);
+double genrand64_real2_r(mt64_state *state);
+double genrand64_real3_r(mt64_state *state);
+
+/* Independent streams: stream number `stream` of a master seed. Streams
+   are seeded through init_by_array64 with the key {seed, stream}, so each
+   one starts at an unrelated point of the period; the same (seed, stream)
+   always gives the same sequence. */
+void init_genrand64_stream_r(mt64_state *state, unsigned long long seed,
+			     unsigned long long stream);
+
+/* Generates the next block of NN outputs (used by genrand64_next_r) */
+void genrand64_refill_r(mt64_state *state);
+
+/* Inline genrand64_int64_r, for hot loops: a load from the output block
+   and, once every NN calls, a refill */
+static inline unsigned long long genrand64_next_r(mt64_state *state)
+{
+    if (state->mti >= MT64_NN)
+        genrand64_refill_r(state);
+    return state->out[state->mti++];
+}
+
+/* The state behind the functions below */
+mt64_state *genrand64_global_state(void);
+
+
+/* Original interface: one global state (not thread safe) */
 
 /* initializes mt[NN] with a seed */
 void init_genrand64(unsigned long long seed);
@@ -78,3 +131,5 @@ double genrand64_real2(void);
 
 /* generates a random number on (0,1)-real-interval */
 double genrand64_real3(void);
+
+#endif
@@ -0,0 +1,393 @@
+// Multispin coded (bit-plane) engine of the checkerboard schedule.
+//
+// A site takes 4 states, stored here in 3 bit planes: occupied (state != 0),
+// differentiated (state = +-1) and up (state = +1). Each row is split in
+// `period` sub-rows, x mod period (2 colors for r=1, 8 for r=2, see
+// checkerboard.c), and bit i of word w of sub-row m is the site
+// x = period*(64w + i) + m. All the sites of a word then have the same
+// color, and one pass of bitwise logic updates 64 sites:
+//  - the neighboors of a word are words of other sub-rows (x +- 1 and
+//    x +- 2 cross into the next period one lane up or down, a shift) or of
+//    the same sub-row on rows y +- 1 and y +- 2;
+//  - s*h is counted in bit-sliced adders over the Ising neighboorhood;
+//  - a Bernoulli(p) draw for a set of lanes compares each lane's uniform
+//    53 bit number with the threshold of p one bit at a time, from the
+//    top, one 64 bit output per bit; lanes drop out as soon as they differ
+//    from the threshold, so a mask costs a few outputs for all 64 lanes.
+// The rules and their probabilities are those of update_site() (the same
+// integer thresholds), so the dynamics is the one of the checkerboard
+// schedule; the random numbers are consumed differently, so trajectories
+// are not the same.
+//
+// The planes are the working copy of the lattice, built from it when it
+// is rewritten (lattice_epoch); the sites that change are written back
+// to the lattice after each word, so the rest of the code still reads it.
+
+#include <stdlib.h>
+#include "rng.h"
+#include "simulation.h"
+#include "kernels.h"
+
+/* Bit planes; up implies differentiated, which implies occupied */
+enum
+  {
+  PLANE_OCCUPIED,
+  PLANE_DIFFERENTIATED,
+  PLANE_UP,
+  PLANES
+  };
+
+
+struct multispin
+  {
+  int x_size, y_size, radius, boundary; /* Geometry the planes were built for */
+  int lattice_epoch;          /* s->lattice_epoch the planes were built for */
+  int period;                 /* Sub-rows per row (the number of colors) */
+  int words;                  /* Words per sub-row */
+  int last;                   /* Lanes of the last word of a sub-row (1 to 64) */
+  uint64_t last_mask;         /* Those lanes */
+  uint64_t *plane[PLANES];    /* Word w of sub-row m of row y at (y*period + m)*words + w */
+  };
+
+
+/* Can s be updated with the multispin engine? 0 if so */
+int multispin_supported (const struct simulation *s)
+  {
+  int period = (s->Ising_neighboorhood == 2) ? 8 : 2;
+  if (checkerboard_supported (s) != 0)
+    return -1;
+  // Every sub-row has the same length
+  return s->x_size % period == 0 ? 0 : -1;
+  }
+
+
+/* Release the planes of s */
+void multispin_free (struct simulation *s)
+  {
+  if (s->multispin == NULL)
+    return;
+  for (int p = 0; p < PLANES; p++)
+    free (s->multispin->plane[p]);
+  free (s->multispin);
+  s->multispin = NULL;
+  }
+
+
+void multispin_invalidate (struct simulation *s)
+  {
+  if (s->multispin != NULL)
+    s->multispin->lattice_epoch = s->lattice_epoch - 1;
+  }
+
+
+static inline long word_index (const struct multispin *b, int y, int m, int w)
+  {
+  return ((long) y * b->period + m) * b->words + w;
+  }
+
+
+/* (Re)build the planes of s from its lattice if they are stale; 0 on success */
+static int prepare_multispin (struct simulation *s)
+  {
+  struct multispin *b = s->multispin;
+  int radius = (s->Ising_neighboorhood == 2) ? 2 : 1;
+  int lanes, lane, state;
+  long k;
+  if (b != NULL && b->x_size == s->x_size && b->y_size == s->y_size && b->radius == radius
+      && b->boundary == s->boundary && b->lattice_epoch == s->lattice_epoch)
+    return 0;
+  multispin_free (s);
+  b = calloc (1, sizeof (struct multispin));
+  if (b == NULL)
+    return -1;
+  s->multispin = b;
+  b->x_size = s->x_size;
+  b->y_size = s->y_size;
+  b->radius = radius;
+  b->boundary = s->boundary;
+  b->lattice_epoch = s->lattice_epoch;
+  b->period = (radius == 2) ? 8 : 2;
+  lanes = s->x_size / b->period;
+  b->words = (lanes + 63) / 64;
+  b->last = lanes - 64 * (b->words - 1);
+  b->last_mask = (b->last == 64) ? ~0ULL : (1ULL << b->last) - 1;
+  for (int p = 0; p < PLANES; p++)
+    {
+    b->plane[p] = calloc ((size_t) s->y_size * b->period * b->words, sizeof (uint64_t));
+    if (b->plane[p] == NULL)
+      {
+      multispin_free (s);
+      return -1;
+      }
+    }
+  for (int y = 0; y < s->y_size; y++)
+    for (int x = 0; x < s->x_size; x++)
+      {
+      state = get_site (s, site_index (s, x, y));
+      k = word_index (b, y, x % b->period, x / b->period / 64);
+      lane = x / b->period % 64;
+      b->plane[PLANE_OCCUPIED][k] |= (uint64_t) (state != 0) << lane;
+      b->plane[PLANE_DIFFERENTIATED][k] |= (uint64_t) (state == 1 || state == -1) << lane;
+      b->plane[PLANE_UP][k] |= (uint64_t) (state == 1) << lane;
+      }
+  return 0;
+  }
+
+
+/* Word of plane p holding the neighboors (x+dx, y+dy) of the sites of word
+   w of sub-row m of row y */
+static inline uint64_t neighbor_word (const struct multispin *b, int p, int y, int m, int w,
+                                      int dx, int dy)
+  {
+  const int open = (b->boundary == BOUNDARY_OPEN);
+  const uint64_t *row;
+  uint64_t word;
+  int ny = y + dy, nm = m + dx;
+  if (ny < 0 || ny >= b->y_size)
+    {
+    if (open)
+      return 0;
+    ny = (ny + b->y_size) % b->y_size;
+    }
+  if (nm >= 0 && nm < b->period)
+    return b->plane[p][word_index (b, ny, nm, w)];
+  // Into the next (previous) period: the same sub-row one lane up (down)
+  row = &b->plane[p][word_index (b, ny, (nm + b->period) & (b->period - 1), 0)];
+  if (nm >= b->period)
+    {
+    word = row[w] >> 1;
+    if (w + 1 < b->words)
+      word |= row[w + 1] << 63;
+    else if (!open)
+      word |= (row[0] & 1) << (b->last - 1);
+    return word;
+    }
+  word = row[w] << 1;
+  if (w + 1 == b->words)
+    word &= b->last_mask;
+  if (w > 0)
+    word |= row[w - 1] >> 63;
+  else if (!open)
+    word |= (row[b->words - 1] >> (b->last - 1)) & 1;
+  return word;
+  }
+
+
+/* Bernoulli draws of the lanes of n classes: class k holds the lanes
+   lanes[k] (disjoint sets) and has the probability of threshold[k]. Each
+   lane compares its uniform 53 bit number with its threshold from the top
+   bit down and drops out at the first difference; the lanes of all the
+   classes are independent, so they share one output per bit. Returns the
+   lanes whose number is below their threshold. */
+static inline uint64_t bernoulli_mask (struct rng *rng, int n, const uint64_t *lanes,
+                                       const uint64_t *threshold)
+  {
+  uint64_t below = 0, tied = 0, ones, r;
+  for (int k = 0; k < n; k++)
+    if (threshold[k] >= THRESHOLD_ONE)
+      below |= lanes[k];
+    else if (threshold[k] > 0)
+      tied |= lanes[k];
+  for (int bit = 52; bit >= 0 && tied != 0; bit--)
+    {
+    // Lanes whose threshold has this bit set
+    ones = 0;
+    for (int k = 0; k < n; k++)
+      if ((threshold[k] >> bit) & 1)
+        ones |= lanes[k];
+    r = rng_next (rng);
+    below |= tied & ones & ~r;
+    tied &= ~(ones ^ r);
+    }
+  return below;
+  }
+
+
+/* Per lane count of the n <= 15 words x, bit-sliced: bit i of the count in
+   sum[i] (carry-save adders) */
+static inline void sliced_count (const uint64_t *x, int n, uint64_t sum[4])
+  {
+  uint64_t ones = 0, twos = 0, fours = 0, eights = 0, a, b, u, carry;
+  for (int i = 0; i < n; i += 2)
+    {
+    a = x[i];
+    b = (i + 1 < n) ? x[i + 1] : 0;
+    u = ones ^ a;
+    carry = (ones & a) | (u & b);
+    ones = u ^ b;
+    u = twos & carry;
+    twos ^= carry;
+    carry = fours & u;
+    fours ^= u;
+    eights ^= carry;
+    }
+  sum[0] = ones; sum[1] = twos; sum[2] = fours; sum[3] = eights;
+  }
+
+
+/* State of a site from its bits (occupied | differentiated << 1 | up << 2) */
+static const int8_t plane_state[8] = {0, 2, 0, -1, 0, 0, 0, 1};
+
+
+/* Update the sites of word w of sub-row m of row y */
+static inline void update_word (struct simulation *s, struct multispin *b, struct rng *rng,
+                                int y, int m, int w, struct site_counts *counts,
+                                const int wrap_mode, const int radius)
+  {
+  const int neighbors = (radius == 2) ? 12 : 4;
+  const long k = word_index (b, y, m, w);
+  const uint64_t lanes = (w + 1 == b->words) ? b->last_mask : ~0ULL;
+  const uint64_t occupied = b->plane[PLANE_OCCUPIED][k];
+  const uint64_t differentiated = b->plane[PLANE_DIFFERENTIATED][k];
+  const uint64_t up = b->plane[PLANE_UP][k];
+  uint64_t n_occupied[4], n_differentiated[MAX_FIELD], n_up[MAX_FIELD];
+  uint64_t no_spin[MAX_FIELD], aligned[MAX_FIELD], no_spins[4], alignments[4], sum[5];
+  uint64_t low[4], high[8], class_lanes[2*MAX_FIELD + 2], class_threshold[2*MAX_FIELD + 2];
+  uint64_t r1, r2, source[PLANES], first, second, born, dead, new_spins, sign, spins, flip;
+  uint64_t changed, next_occupied, next_differentiated, next_up, carry, a, c;
+  long row = site_index (s, 0, y);
+  int classes, x;
+
+  for (int n = 0; n < neighbors; n++)
+    {
+    int dx = neighbor_offsets[n][0], dy = neighbor_offsets[n][1];
+    if (n < 4)
+      n_occupied[n] = neighbor_word (b, PLANE_OCCUPIED, y, m, w, dx, dy);
+    n_differentiated[n] = neighbor_word (b, PLANE_DIFFERENTIATED, y, m, w, dx, dy);
+    n_up[n] = neighbor_word (b, PLANE_UP, y, m, w, dx, dy);
+    }
+
+  // Vacancies copy a random NN (picked by 2 bits)
+  r1 = rng_next (rng);
+  r2 = rng_next (rng);
+#define PICK(a) (((a)[0] & ~r1 & ~r2) | ((a)[1] & ~r1 & r2) | ((a)[2] & r1 & ~r2) | ((a)[3] & r1 & r2))
+  source[PLANE_OCCUPIED] = PICK (n_occupied);
+  source[PLANE_DIFFERENTIATED] = PICK (n_differentiated);
+  source[PLANE_UP] = PICK (n_up);
+#undef PICK
+
+  // First draw of a site: birth (vacancies) or death (occupied sites)
+  class_lanes[0] = lanes & ~occupied & source[PLANE_OCCUPIED];
+  class_threshold[0] = s->birth_threshold;
+  class_lanes[1] = occupied;
+  class_threshold[1] = s->death_threshold;
+  first = bernoulli_mask (rng, 2, class_lanes, class_threshold);
+  born = first & ~occupied;
+  dead = first & occupied;
+
+  // Second draw: differentiation (undifferentiated sites) or a Metropolis
+  // flip (spins, one class per value of s*h)
+  class_lanes[0] = occupied & ~differentiated;
+  class_threshold[0] = s->differentiation_threshold;
+  classes = 1;
+  spins = differentiated;
+  if (spins != 0)
+    {
+    // s*h + neighbors = (neighboors without a spin) + 2 (aligned neighboors)
+    for (int n = 0; n < neighbors; n++)
+      {
+      no_spin[n] = ~n_differentiated[n];
+      aligned[n] = n_differentiated[n] & ~(n_up[n] ^ up);
+      }
+    sliced_count (no_spin, neighbors, no_spins);
+    sliced_count (aligned, neighbors, alignments);
+    sum[0] = no_spins[0];
+    carry = 0;
+    for (int i = 1; i < 5; i++)
+      {
+      a = (i < 4) ? no_spins[i] : 0;
+      c = alignments[i - 1];
+      sum[i] = a ^ c ^ carry;
+      carry = (a & c) | (carry & (a ^ c));
+      }
+    for (int i = 0; i < 4; i++)
+      low[i] = ((i & 1) ? sum[0] : ~sum[0]) & ((i & 2) ? sum[1] : ~sum[1]) & spins;
+    for (int i = 0; i < 8; i++)
+      high[i] = ((i & 1) ? sum[2] : ~sum[2]) & ((i & 2) ? sum[3] : ~sum[3])
+                & ((i & 4) ? sum[4] : ~sum[4]);
+    for (int value = 0; value <= 2 * neighbors; value++)
+      {
+      class_lanes[classes] = low[value & 3] & high[value >> 2];
+      class_threshold[classes] = s->accept_threshold[MAX_FIELD + value - neighbors];
+      if (class_lanes[classes] != 0 && class_threshold[classes] != 0)
+        classes ++;
+      }
+    }
+  second = bernoulli_mask (rng, classes, class_lanes, class_threshold);
+  new_spins = second & ~differentiated & ~dead;
+  flip = second & spins & ~dead;
+  sign = (new_spins != 0) ? rng_next (rng) : 0;
+
+  next_occupied = (occupied & ~dead) | born;
+  next_differentiated = (differentiated & ~dead) | new_spins | (born & source[PLANE_DIFFERENTIATED]);
+  next_up = ((up & ~dead) ^ flip) | (new_spins & sign) | (born & source[PLANE_UP]);
+  changed = (occupied ^ next_occupied) | (differentiated ^ next_differentiated) | (up ^ next_up);
+  if (changed == 0)
+    return;
+  b->plane[PLANE_OCCUPIED][k] = next_occupied;
+  b->plane[PLANE_DIFFERENTIATED][k] = next_differentiated;
+  b->plane[PLANE_UP][k] = next_up;
+  counts->occupancy += __builtin_popcountll (next_occupied) - __builtin_popcountll (occupied);
+  counts->vacancy -= __builtin_popcountll (next_occupied) - __builtin_popcountll (occupied);
+  counts->up += __builtin_popcountll (next_up) - __builtin_popcountll (up);
+  counts->down += __builtin_popcountll (next_differentiated & ~next_up)
+                  - __builtin_popcountll (differentiated & ~up);
+  // Write the changed sites back to the lattice
+  for (; changed != 0; changed &= changed - 1)
+    {
+    int i = __builtin_ctzll (changed);
+    x = b->period * (64 * w + i) + m;
+    change_site (s, x, y, row + x,
+                 plane_state[((next_occupied >> i) & 1) | (((next_differentiated >> i) & 1) << 1)
+                             | (((next_up >> i) & 1) << 2)],
+                 wrap_mode);
+    }
+  }
+
+
+static inline void multispin_kernel (struct simulation *s, const int wrap_mode, const int radius)
+  {
+  struct multispin *b = s->multispin;
+  const int colors = b->period;
+  const int per_row = rng_cheap_streams (s->rng_backend);
+  long occupancy = 0, vacancy = 0, up = 0, down = 0;
+#pragma omp parallel reduction(+:occupancy, vacancy, up, down)
+    {
+    struct rng row_rng;
+    struct rng *rng = per_row ? &row_rng : &s->thread_rng[thread_number ()];
+    struct site_counts counts = {0, 0, 0, 0};
+    for (int color = 0; color < colors; color++)
+      {
+      // The implicit barrier at the end of each color keeps colors apart
+#pragma omp for schedule(static)
+      for (int y = 0; y < s->y_size; y++)
+        {
+        int m = first_x (color, y, radius);
+        if (per_row)
+          rng_seed_stream (rng, s->rng_backend, s->seed, row_stream (s, color, y));
+        for (int w = 0; w < b->words; w++)
+          update_word (s, b, rng, y, m, w, &counts, wrap_mode, radius);
+        }
+      }
+    occupancy += counts.occupancy; vacancy += counts.vacancy;
+    up += counts.up; down += counts.down;
+    }
+  s->occupancy += occupancy; s->vacancy += vacancy;
+  s->up += up; s->down += down;
+  s->generation_time ++;
+  }
+
+
+/* One generation of the checkerboard schedule with the multispin engine */
+int update_lattice_multispin (struct simulation *s)
+  {
+  if (!rng_cheap_streams (s->rng_backend) && prepare_thread_generators (s) != 0)
+    return -1;
+  if (prepare_multispin (s) != 0)
+    return -1;
+  prepare_rate_thresholds (s);
+#define SWEEP(wrap_mode, radius) multispin_kernel (s, wrap_mode, radius)
+  DISPATCH_KERNEL (s, SWEEP);
+#undef SWEEP
+  return 0;
+  }
@@ -0,0 +1,320 @@
+// Streaming time series of the observables of a simulation.
+//
+// The simulation thread must not wait on I/O, so observables_sample ()
+// only copies the counters, and the lattice at 2 bits per site, into a
+// single producer, single consumer ring: it publishes a sample by
+// advancing head (release), and the writer thread consumes up to head
+// (acquire) and advances tail. Neither side takes a lock. The Ising energy
+// is a pass over the lattice, so the writer sums it from the copy rather
+// than the simulation thread from the lattice. When the ring is full the
+// sample is dropped and counted; the writer polls an empty ring every
+// millisecond, and flushes the file when it catches up.
+//
+// Formats (columns: generation, occupancy, vacancy, up, down, energy,
+// magnetization):
+//   csv     a header line, then one line per sample
+//   ndjson  one JSON object per sample and line
+//   binary  the header
+//             "CPIMOBS" '\0', uint32 version (1), uint32 columns (7),
+//             then per column a name (15 bytes, '\0' padded) and its type
+//             ('q': int64, 'd': double)
+//           then blocks of up to OBSERVABLES_BLOCK samples: uint32 rows,
+//           uint32 0, and each column as rows values, one column after the
+//           other. Numbers are in the byte order of the host.
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "simulation.h"
+#include "observables.h"
+
+/* Samples of a block of the binary format */
+#define OBSERVABLES_BLOCK 1024
+#define OBSERVABLES_COLUMNS 7
+
+static const char *format_names[OBSERVABLES_FORMATS] = {"csv", "ndjson", "binary"};
+
+static const char *column_names[OBSERVABLES_COLUMNS] =
+  {"generation", "occupancy", "vacancy", "up", "down", "energy", "magnetization"};
+
+
+int observables_format_from_name (const char *name)
+  {
+  for (int format = 0; format < OBSERVABLES_FORMATS; format++)
+    if (strcmp (name, format_names[format]) == 0)
+      return format;
+  return -1;
+  }
+
+const char *observables_format_name (int format)
+  {
+  if (format < 0 || format >= OBSERVABLES_FORMATS)
+    return "unknown";
+  return format_names[format];
+  }
+
+
+/* Header of the file */
+static void write_header (struct observables *o)
+  {
+  if (o->format == OBSERVABLES_CSV)
+    fprintf (o->file, "generation,occupancy,vacancy,up,down,energy,magnetization\n");
+  else if (o->format == OBSERVABLES_BINARY)
+    {
+    uint32_t header[2] = {1, OBSERVABLES_COLUMNS};
+    char column[16];
+    fwrite ("CPIMOBS", 1, 8, o->file);
+    fwrite (header, sizeof (uint32_t), 2, o->file);
+    for (int c = 0; c < OBSERVABLES_COLUMNS; c++)
+      {
+      memset (column, 0, sizeof (column));
+      strncpy (column, column_names[c], 15);
+      column[15] = (c < 5) ? 'q' : 'd';
+      fwrite (column, 1, sizeof (column), o->file);
+      }
+    }
+  }
+
+
+/* Write samples [first, last) of the ring, all of them available */
+static void write_samples (struct observables *o, uint64_t first, uint64_t last)
+  {
+  const struct observable_sample *sample;
+  if (o->format == OBSERVABLES_BINARY)
+    {
+    // Columns of a block: the samples are read once per column
+    int64_t integers[OBSERVABLES_BLOCK];
+    double reals[OBSERVABLES_BLOCK];
+    while (first < last)
+      {
+      uint32_t rows = (last - first < OBSERVABLES_BLOCK) ? (uint32_t) (last - first) : OBSERVABLES_BLOCK;
+      uint32_t block[2] = {rows, 0};
+      fwrite (block, sizeof (uint32_t), 2, o->file);
+      for (int c = 0; c < OBSERVABLES_COLUMNS; c++)
+        {
+        for (uint32_t k = 0; k < rows; k++)
+          {
+          sample = &o->ring[(first + k) & (OBSERVABLES_RING - 1)];
+          switch (c)
+            {
+            case 0: integers[k] = sample->generation; break;
+            case 1: integers[k] = sample->occupancy; break;
+            case 2: integers[k] = sample->vacancy; break;
+            case 3: integers[k] = sample->up; break;
+            case 4: integers[k] = sample->down; break;
+            case 5: reals[k] = sample->energy; break;
+            default: reals[k] = sample->magnetization; break;
+            }
+          }
+        if (c < 5)
+          fwrite (integers, sizeof (int64_t), rows, o->file);
+        else
+          fwrite (reals, sizeof (double), rows, o->file);
+        }
+      first += rows;
+      }
+    return;
+    }
+  for (; first < last; first++)
+    {
+    sample = &o->ring[first & (OBSERVABLES_RING - 1)];
+    if (o->format == OBSERVABLES_NDJSON)
+      fprintf (o->file, "{\"generation\":%lld,\"occupancy\":%lld,\"vacancy\":%lld,\"up\":%lld,"
+               "\"down\":%lld,\"energy\":%.17g,\"magnetization\":%.17g}\n",
+               (long long) sample->generation, (long long) sample->occupancy,
+               (long long) sample->vacancy, (long long) sample->up, (long long) sample->down,
+               sample->energy, sample->magnetization);
+    else
+      fprintf (o->file, "%lld,%lld,%lld,%lld,%lld,%.17g,%.17g\n",
+               (long long) sample->generation, (long long) sample->occupancy,
+               (long long) sample->vacancy, (long long) sample->up, (long long) sample->down,
+               sample->energy, sample->magnetization);
+    }
+  }
+
+
+/* Ising energy of the lattice of sample k: J times the sum of s_i*s_j over
+   the pairs of the neighboorhood. Each pair is seen once, from the site
+   before the other in the half of the stencil below. */
+static double lattice_energy (struct observables *o, uint64_t k)
+  {
+  static const int8_t spin_of[4] = {0, 1, 0, -1};
+  static const int half[6][2] = {{1, 0}, {0, 1}, {2, 0}, {0, 2}, {1, 1}, {-1, 1}};
+  const struct observable_sample *sample = &o->ring[k & (OBSERVABLES_RING - 1)];
+  const uint8_t *codes = o->lattices + (k & (uint64_t) (o->capacity - 1)) * o->lattice_bytes;
+  const int x_size = o->x_size, y_size = o->y_size;
+  const long n = (long) x_size * y_size;
+  int8_t *spin = o->spins;
+  long pairs = 0;
+  for (long p = 0; p < n; p++)
+    spin[p] = spin_of[(codes[p >> 2] >> ((p & 3) << 1)) & 3];
+  for (int j = 0; j < ((sample->radius == 2) ? 6 : 2); j++)
+    {
+    const int dx = half[j][0], dy = half[j][1];
+    // Columns whose neighboor is on the same row of the lattice
+    const int first = (dx < 0) ? -dx : 0, last = (dx > 0) ? x_size - dx : x_size;
+    for (int y = 0; y < y_size; y++)
+      {
+      int ny = y + dy, sum = 0;
+      if (ny >= y_size)
+        {
+        if (sample->open)
+          continue;
+        ny -= y_size;
+        }
+      const int8_t *row = spin + (long) y * x_size, *next = spin + (long) ny * x_size;
+      for (int x = first; x < last; x++)
+        sum += row[x] * next[x + dx];
+      // and across the sides of a torus
+      if (!sample->open)
+        {
+        for (int x = 0; x < first; x++)
+          sum += row[x] * next[x + dx + x_size];
+        for (int x = last; x < x_size; x++)
+          sum += row[x] * next[x + dx - x_size];
+        }
+      pairs += sum;
+      }
+    }
+  // + 0.0: no pairs gives 0, not the -0 of a ferro J
+  return sample->J * (double) pairs + 0.0;
+  }
+
+
+/* Writer thread: drain the ring until it is closed and empty */
+static void *writer (void *data)
+  {
+  struct observables *o = data;
+  const struct timespec pause = {0, 1000000};
+  uint64_t head, tail;
+  int closing;
+  for (;;)
+    {
+    // Read closing first: a sample pushed before closing is then seen in head
+    closing = atomic_load_explicit (&o->closing, memory_order_acquire);
+    head = atomic_load_explicit (&o->head, memory_order_acquire);
+    tail = atomic_load_explicit (&o->tail, memory_order_relaxed);
+    if (head != tail)
+      {
+      for (uint64_t k = tail; k < head; k++)
+        o->ring[k & (OBSERVABLES_RING - 1)].energy = lattice_energy (o, k);
+      write_samples (o, tail, head);
+      atomic_store_explicit (&o->tail, head, memory_order_release);
+      continue;
+      }
+    fflush (o->file);
+    if (closing)
+      break;
+    nanosleep (&pause, NULL);
+    }
+  return NULL;
+  }
+
+
+int observables_open (struct observables *o, const char *path, const struct simulation *s,
+                      int format, int interval)
+  {
+  memset (o, 0, sizeof (*o));
+  if (format < 0 || format >= OBSERVABLES_FORMATS || interval < 1)
+    return -1;
+  o->format = format;
+  o->interval = interval;
+  o->last_generation = -1;
+  o->x_size = s->x_size;
+  o->y_size = s->y_size;
+  o->lattice_bytes = (size_t) (s->n_sites + 3) / 4;
+  o->capacity = OBSERVABLES_RING;
+  while (o->capacity > 2 && (size_t) o->capacity * o->lattice_bytes > OBSERVABLES_LATTICE_BYTES)
+    o->capacity /= 2;
+  o->ring = malloc (OBSERVABLES_RING * sizeof (struct observable_sample));
+  o->lattices = malloc ((size_t) o->capacity * o->lattice_bytes);
+  o->spins = malloc ((size_t) s->n_sites);
+  o->file = (o->ring && o->lattices && o->spins) ? fopen (path, (format == OBSERVABLES_BINARY) ? "wb" : "w") : NULL;
+  if (o->file == NULL)
+    {
+    free (o->ring);
+    free (o->lattices);
+    free (o->spins);
+    memset (o, 0, sizeof (*o));
+    return -1;
+    }
+  // Touch the copies now, not on the first round of samples
+  memset (o->lattices, 0, (size_t) o->capacity * o->lattice_bytes);
+  atomic_init (&o->head, 0);
+  atomic_init (&o->tail, 0);
+  atomic_init (&o->closing, 0);
+  atomic_init (&o->dropped, 0);
+  write_header (o);
+  if (pthread_create (&o->writer, NULL, writer, o) != 0)
+    {
+    fclose (o->file);
+    free (o->ring);
+    free (o->lattices);
+    free (o->spins);
+    memset (o, 0, sizeof (*o));
+    return -1;
+    }
+  return 0;
+  }
+
+
+void observables_sample (struct observables *o, const struct simulation *s)
+  {
+  struct observable_sample *sample;
+  uint64_t head, tail;
+  if (o->ring == NULL || s->generation_time % o->interval != 0 || s->generation_time == o->last_generation)
+    return;
+  o->last_generation = s->generation_time;
+  head = atomic_load_explicit (&o->head, memory_order_relaxed);
+  tail = atomic_load_explicit (&o->tail, memory_order_acquire);
+  if (head - tail == (uint64_t) o->capacity)
+    {
+    atomic_fetch_add_explicit (&o->dropped, 1, memory_order_relaxed);
+    return;
+    }
+  sample = &o->ring[head & (OBSERVABLES_RING - 1)];
+  sample->generation = s->generation_time;
+  sample->occupancy = s->occupancy;
+  sample->vacancy = s->vacancy;
+  sample->up = s->up;
+  sample->down = s->down;
+  sample->magnetization = s->occupancy ? (double) (s->up - s->down) / (double) s->occupancy : 0;
+  sample->J = s->J;
+  sample->radius = s->Ising_neighboorhood;
+  sample->open = (s->boundary == BOUNDARY_OPEN);
+  pack_lattice (s, o->lattices + (head & (uint64_t) (o->capacity - 1)) * o->lattice_bytes);
+  atomic_store_explicit (&o->head, head + 1, memory_order_release);
+  }
+
+
+void observables_restart (struct observables *o)
+  {
+  o->last_generation = -1;
+  }
+
+
+long observables_dropped (struct observables *o)
+  {
+  return atomic_load_explicit (&o->dropped, memory_order_relaxed);
+  }
+
+
+int observables_close (struct observables *o)
+  {
+  int status;
+  if (o->ring == NULL)
+    return 0;
+  atomic_store_explicit (&o->closing, 1, memory_order_release);
+  pthread_join (o->writer, NULL);
+  status = ferror (o->file) ? -1 : 0;
+  if (fclose (o->file) != 0)
+    status = -1;
+  free (o->ring);
+  free (o->lattices);
+  free (o->spins);
+  o->ring = NULL;
+  o->lattices = NULL;
+  o->spins = NULL;
+  o->file = NULL;
+  return status;
+  }
@@ -0,0 +1,94 @@
+// Streaming time series of the observables of a simulation: the
+// simulation thread pushes samples (and a copy of the lattice) into a
+// lock-free ring, and a writer thread sums the Ising energy and formats
+// them (CSV, NDJSON or binary columns); see observables.c.
+
+#ifndef OBSERVABLES_H
+#define OBSERVABLES_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "simulation.h"
+
+/* Output formats */
+enum
+  {
+  OBSERVABLES_CSV,            /* Header line, then one line per sample */
+  OBSERVABLES_NDJSON,         /* One JSON object per line */
+  OBSERVABLES_BINARY,         /* Blocks of columns (layout in observables.c) */
+  OBSERVABLES_FORMATS
+  };
+
+/* Samples the ring holds (a power of 2): when the writer falls this far
+   behind, new samples are dropped (and counted) rather than waiting */
+#define OBSERVABLES_RING 4096
+
+/* Bytes of the copies of the lattice in the ring: on large lattices it
+   holds fewer samples (down to 2) */
+#define OBSERVABLES_LATTICE_BYTES (16 << 20)
+
+
+/* One sample of the observables */
+struct observable_sample
+  {
+  int64_t generation;         /* generation_time */
+  int64_t occupancy, vacancy; /* Occupied and vacant sites */
+  int64_t up, down;           /* Spins */
+  double energy;              /* Ising energy of the lattice (ising_energy), summed by the writer */
+  double magnetization;       /* (up - down) / occupancy, 0 on an empty lattice */
+  double J;                   /* Coupling, radius and boundary of the lattice copy */
+  int radius;
+  int open;
+  };
+
+/* A stream. The simulation thread only calls observables_sample (); it never
+   takes a lock nor waits for the writer. */
+struct observables
+  {
+  FILE *file;                 /* Output */
+  int format;                 /* OBSERVABLES_CSV, ... */
+  int interval;               /* Generations between two samples */
+  struct observable_sample *ring; /* OBSERVABLES_RING samples */
+  int capacity;               /* Samples the ring holds: OBSERVABLES_RING, or fewer to
+                                 fit their lattices in OBSERVABLES_LATTICE_BYTES */
+  int x_size, y_size;         /* Lattice of the samples */
+  size_t lattice_bytes;       /* (x_size*y_size + 3)/4 */
+  uint8_t *lattices;          /* Lattice of each sample of the ring, as pack_lattice () stores it */
+  int8_t *spins;              /* Writer: spins of the lattice being summed */
+  _Atomic uint64_t head;      /* Samples pushed (by the simulation thread) */
+  _Atomic uint64_t tail;      /* Samples written (by the writer thread) */
+  _Atomic int closing;        /* Set by observables_close () */
+  _Atomic long dropped;       /* Samples lost to a full ring */
+  int last_generation;        /* Generation of the last sample, -1: none */
+  pthread_t writer;           /* Writer thread */
+  };
+
+
+/* Open path and start the writer: a sample of (the lattice of) s every
+   interval generations, in the given format. 0 on success */
+int observables_open (struct observables *o, const char *path, const struct simulation *s,
+                      int format, int interval);
+
+/* Sample s if its generation is a multiple of the interval (call it after
+   every generation; the lattice is copied on sampled ones only, and its
+   Ising energy summed by the writer) */
+void observables_sample (struct observables *o, const struct simulation *s);
+
+/* The lattice was initialized again: its generations start over, and the
+   next sample of generation 0 is taken again */
+void observables_restart (struct observables *o);
+
+/* Write the samples left, stop the writer and close the file. 0 on
+   success, -1 if a write failed */
+int observables_close (struct observables *o);
+
+/* Samples lost to a full ring so far */
+long observables_dropped (struct observables *o);
+
+/* Format from its name (csv, ndjson or binary), -1 if unknown, and back */
+int observables_format_from_name (const char *name);
+const char *observables_format_name (int format);
+
+#endif
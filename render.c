@@ -0,0 +1,299 @@
+// Rendering of the lattice into RGBA pixels.
+//
+// The Gtk app keeps one image of the lattice and repaints it in place on
+// every display tick, so a frame costs no allocation. The image is a
+// viewport of a fixed size: zoomed in, only the sites in view are read,
+// one per 2^zoom x 2^zoom pixels; zoomed out, a pixel is the mean colour
+// of its block of sites (so domains smaller than a pixel still show, as
+// a blend, where picking one site per block would alias). Either way sites
+// are read row by row, in the order they are stored and the pixels are
+// laid out: zoomed in, the colour of each site is picked by selects that
+// vectorize (omp simd) on the byte layouts; zoomed out, the sites of a
+// block add up their state counts, three to a 64 bit word, in a register.
+// From 2^BLOCK_COUNT_FIRST sites per pixel side, the simulation can keep
+// those counts itself (block_count_last), updated by every site that
+// changes, and a pixel is one read of them: a frame of the whole lattice
+// then costs as much as its pixels, whatever the size of the lattice.
+//
+// With the simulation on its own thread, frames go through a triple
+// buffer: three frames, one painted by the simulation thread (back), one
+// on display (front), and the last published one in between (middle).
+// Either side swaps its frame with middle in one atomic exchange, so the
+// simulation never waits for the display, and the display always shows
+// the latest frame; the frames it had no time for are skipped.
+
+#include <stdlib.h>
+#include <string.h>
+#include "simulation.h"
+#include "render.h"
+
+/* Colours of the states, by 2 bit code (state & 3): vacant, spin up,
+   undifferentiated, spin down */
+static const uint8_t palette[4][RENDER_CHANNELS] =
+  {{0, 0, 0, 255}, {255, 0, 255, 255}, {255, 255, 255, 255}, {0, 255, 0, 255}};
+
+/* Colour beyond the lattice */
+static const uint8_t background[RENDER_CHANNELS] = {48, 48, 48, 255};
+
+
+/* 2 bit code of site (x, y), in any layout */
+static inline int site_code (const struct simulation *s, int x, int y)
+  {
+  return get_site (s, site_index (s, x, y)) & 3;
+  }
+
+
+/* Zoomed in: paint the sites x... of row y into the width pixels of out,
+   2^zoom pixels each */
+static void paint_row (const struct simulation *s, int x, int y, int zoom,
+                       uint32_t *out, int width, const uint32_t *colour, uint32_t outside)
+  {
+  int n = (width + (1 << zoom) - 1) >> zoom, painted;
+  if (n > s->x_size - x)
+    n = s->x_size - x;
+#if defined(CPIM_PACKED_LATTICE)
+  for (int k = 0; k < n; k++)
+    out[k] = colour[site_code (s, x + k, y)];
+#else
+  const site_t *row = s->lattice_configuration + site_index (s, x, y);
+  const uint32_t c0 = colour[0], c1 = colour[1], c2 = colour[2], c3 = colour[3];
+#pragma omp simd
+  for (int k = 0; k < n; k++)
+    {
+    int code = row[k] & 3;
+    out[k] = (code == 0) ? c0 : (code == 1) ? c1 : (code == 2) ? c2 : c3;
+    }
+#endif
+  // Spread the sites over their pixels, from the right: out[p >> zoom] is
+  // not overwritten before pixel p reads it
+  painted = (n << zoom < width) ? n << zoom : width;
+  if (zoom > 0)
+    for (int p = painted - 1; p >= 0; p--)
+      out[p] = out[p >> zoom];
+  for (int p = painted; p < width; p++)
+    out[p] = outside;
+  }
+
+
+/* Mean colour, into pixel, of the area sites whose state counts are
+   packed in count (see BLOCK_COUNT_BITS) */
+static void blend_pixel (uint64_t count, uint64_t area, uint8_t *pixel)
+  {
+  const uint64_t mask = ((uint64_t) 1 << BLOCK_COUNT_BITS) - 1;
+  uint64_t number[4];
+  // Whole blocks are powers of two: a shift for the division
+  int shift = ((area & (area - 1)) == 0) ? __builtin_ctzll (area) : -1;
+  number[3] = count >> (2 * BLOCK_COUNT_BITS);
+  number[1] = (count & mask) - number[3];
+  number[2] = ((count >> BLOCK_COUNT_BITS) & mask) - number[3];
+  number[0] = area - number[1] - number[2] - number[3];
+  for (int channel = 0; channel < RENDER_CHANNELS; channel++)
+    {
+    uint64_t sum = area / 2;
+    for (int code = 0; code < 4; code++)
+      sum += number[code] * palette[code][channel];
+    pixel[channel] = (uint8_t) ((shift >= 0) ? sum >> shift : sum / area);
+    }
+  }
+
+
+/* Zoomed out: paint the blocks of 2^-zoom x 2^-zoom sites from (x, y) into
+   the width pixels of out, each the mean colour of its sites */
+static void blend_row (const struct simulation *s, int x, int y, int zoom,
+                       uint32_t *out, int width, uint64_t *counts, uint32_t outside)
+  {
+  // Per site, in fields of BLOCK_COUNT_BITS: whether its code has bit 0
+  // set (spin up or down), bit 1 set (undifferentiated or down), and both
+  // (down); summed over a block, the number of sites in each state
+  static const uint64_t fields[4] =
+    {0, 1, (uint64_t) 1 << BLOCK_COUNT_BITS,
+     1 | (uint64_t) 1 << BLOCK_COUNT_BITS | (uint64_t) 1 << (2 * BLOCK_COUNT_BITS)};
+  const int shift = -zoom, block = 1 << shift;
+  int rows = (s->y_size - y < block) ? s->y_size - y : block;
+  int n = (s->x_size - x + block - 1) >> shift, sites;
+  if (n > width)
+    n = width;
+  sites = (s->x_size - x < n << shift) ? s->x_size - x : n << shift;
+  memset (counts, 0, (size_t) n * sizeof (*counts));
+  for (int r = 0; r < rows; r++)
+    {
+#if defined(CPIM_PACKED_LATTICE)
+    for (int k = 0; k < sites; k++)
+      counts[k >> shift] += fields[get_site (s, site_index (s, x + k, y + r)) & 3];
+#else
+    const site_t *row = s->lattice_configuration + site_index (s, x, y + r);
+    for (int p = 0, k = 0; k < sites; p++)
+      {
+      uint64_t sum = 0;
+      for (int last = (k + block < sites) ? k + block : sites; k < last; k++)
+        sum += fields[row[k] & 3];
+      counts[p] += sum;
+      }
+#endif
+    }
+  for (int p = 0; p < n; p++)
+    {
+    int columns = (sites - (p << shift) < block) ? sites - (p << shift) : block;
+    blend_pixel (counts[p], (uint64_t) columns * (uint64_t) rows, (uint8_t *) (out + p));
+    }
+  for (int p = n; p < width; p++)
+    out[p] = outside;
+  }
+
+
+/* Zoomed out, with (x, y) the corner of a block of the block counts of
+   level -zoom: as blend_row, from one word of the counts per pixel */
+static void count_row (const struct simulation *s, int x, int y, int zoom,
+                       uint32_t *out, int width, uint32_t outside)
+  {
+  const int level = -zoom, block = 1 << level;
+  const _Atomic uint64_t *row = s->block_counts[level]
+                                + (long) (y >> level) * block_count_width (s, level) + (x >> level);
+  int rows = (s->y_size - y < block) ? s->y_size - y : block;
+  int n = (s->x_size - x + block - 1) >> level;
+  if (n > width)
+    n = width;
+  for (int p = 0; p < n; p++)
+    {
+    int columns = (s->x_size - x - (p << level) < block) ? s->x_size - x - (p << level) : block;
+    blend_pixel (atomic_load_explicit (&row[p], memory_order_relaxed),
+                 (uint64_t) columns * (uint64_t) rows, (uint8_t *) (out + p));
+    }
+  for (int p = n; p < width; p++)
+    out[p] = outside;
+  }
+
+
+void render_view (const struct simulation *s, const struct render_view *view,
+                  uint8_t *pixels, int width, int height, int rowstride, uint64_t *counts)
+  {
+  uint32_t colour[4], outside;
+  // The block counts serve views of their levels at a block corner
+  int counted = view->zoom <= -BLOCK_COUNT_FIRST && view->zoom >= -BLOCK_COUNT_LAST
+                && s->block_counts[-view->zoom] != NULL && s->block_counts_epoch == s->lattice_epoch
+                && ((view->x | view->y) & ((1 << -view->zoom) - 1)) == 0;
+  // The palette as 32 bit pixels, in the byte order of the host
+  memcpy (colour, palette, sizeof (colour));
+  memcpy (&outside, background, sizeof (outside));
+  for (int py = 0; py < height; py++)
+    {
+    uint32_t *out = (uint32_t *) (pixels + (size_t) py * (size_t) rowstride);
+    int y = (view->zoom >= 0) ? view->y + (py >> view->zoom) : view->y + (py << -view->zoom);
+    if (view->x >= s->x_size || y >= s->y_size)
+      for (int p = 0; p < width; p++)
+        out[p] = outside;
+    else if (counted)
+      count_row (s, view->x, y, view->zoom, out, width, outside);
+    else if (view->zoom < 0)
+      blend_row (s, view->x, y, view->zoom, out, width, counts, outside);
+    // The pixel rows of a site row after the first are copies of it
+    else if ((py & ((1 << view->zoom) - 1)) != 0)
+      memcpy (out, pixels + (size_t) (py - 1) * (size_t) rowstride, (size_t) width * RENDER_CHANNELS);
+    else
+      paint_row (s, view->x, y, view->zoom, out, width, colour, outside);
+    }
+  }
+
+
+void render_view_fit (struct render_view *view, int x_size, int y_size, int width, int height)
+  {
+  int zoom = RENDER_MAX_ZOOM;
+  // Sites in view along a side: width << -zoom, or width >> zoom rounded up
+  while (zoom > RENDER_MIN_ZOOM
+         && ((zoom >= 0) ? ((long) x_size << zoom > width || (long) y_size << zoom > height)
+                         : ((long) width << -zoom < x_size || (long) height << -zoom < y_size)))
+    zoom --;
+  view->x = 0;
+  view->y = 0;
+  view->zoom = zoom;
+  }
+
+
+void render_view_clamp (struct render_view *view, int x_size, int y_size, int width, int height)
+  {
+  long x_view, y_view;
+  if (view->zoom > RENDER_MAX_ZOOM)
+    view->zoom = RENDER_MAX_ZOOM;
+  if (view->zoom < RENDER_MIN_ZOOM)
+    view->zoom = RENDER_MIN_ZOOM;
+  x_view = (view->zoom >= 0) ? (width + (1 << view->zoom) - 1) >> view->zoom : (long) width << -view->zoom;
+  y_view = (view->zoom >= 0) ? (height + (1 << view->zoom) - 1) >> view->zoom : (long) height << -view->zoom;
+  if (view->x > x_size - x_view)
+    view->x = (int) (x_size - x_view);
+  if (view->y > y_size - y_view)
+    view->y = (int) (y_size - y_view);
+  if (view->x < 0)
+    view->x = 0;
+  if (view->y < 0)
+    view->y = 0;
+  // Zoomed out, at the corner of a block
+  if (view->zoom < 0)
+    {
+    view->x &= ~((1 << -view->zoom) - 1);
+    view->y &= ~((1 << -view->zoom) - 1);
+    }
+  }
+
+
+int render_frames_alloc (struct render_frames *f, int width, int height)
+  {
+  void *pixels;
+  size_t bytes;
+  memset (f, 0, sizeof (*f));
+  f->width = width;
+  f->height = height;
+  // Rows of whole cache lines
+  f->rowstride = (width * RENDER_CHANNELS + 63) / 64 * 64;
+  bytes = (size_t) f->rowstride * (size_t) height;
+  f->counts = malloc ((size_t) width * sizeof (*f->counts));
+  if (f->counts == NULL)
+    return -1;
+  for (int k = 0; k < 3; k++)
+    {
+    if (posix_memalign (&pixels, 64, bytes) != 0)
+      {
+      render_frames_free (f);
+      return -1;
+      }
+    memset (pixels, 0, bytes);
+    f->frame[k].pixels = pixels;
+    }
+  f->back = 0;
+  f->front = 1;
+  atomic_init (&f->middle, 2);
+  return 0;
+  }
+
+
+void render_frames_free (struct render_frames *f)
+  {
+  for (int k = 0; k < 3; k++)
+    free (f->frame[k].pixels);
+  free (f->counts);
+  memset (f, 0, sizeof (*f));
+  }
+
+
+void render_frames_publish (struct render_frames *f, const struct simulation *s,
+                            const struct render_view *view)
+  {
+  struct render_frame *frame = &f->frame[f->back];
+  render_view (s, view, frame->pixels, f->width, f->height, f->rowstride, f->counts);
+  frame->generation = s->generation_time;
+  frame->occupancy = s->occupancy;
+  frame->vacancy = s->vacancy;
+  frame->up = s->up;
+  frame->down = s->down;
+  // Release the frame, acquire the one the display gave back
+  f->back = atomic_exchange_explicit (&f->middle, f->back | RENDER_FRESH, memory_order_acq_rel)
+            & ~RENDER_FRESH;
+  }
+
+
+struct render_frame *render_frames_take (struct render_frames *f)
+  {
+  if (!(atomic_load_explicit (&f->middle, memory_order_relaxed) & RENDER_FRESH))
+    return NULL;
+  f->front = atomic_exchange_explicit (&f->middle, f->front, memory_order_acq_rel) & ~RENDER_FRESH;
+  return &f->frame[f->front];
+  }
@@ -0,0 +1,91 @@
+// Rendering of the lattice into RGBA pixels for the Gtk app, without Gtk:
+// a viewport (the whole lattice downsampled, or a region zoomed in) painted
+// row by row, and a triple buffer of frames from the simulation thread to
+// the display; see render.c.
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "simulation.h"
+
+/* Bytes per pixel of the images (red, green, blue, alpha) */
+#define RENDER_CHANNELS 4
+
+/* Zoom levels: from 2^RENDER_MIN_ZOOM sites per pixel to 2^RENDER_MAX_ZOOM
+   pixels per site */
+#define RENDER_MIN_ZOOM (-BLOCK_COUNT_LAST)
+#define RENDER_MAX_ZOOM 5
+
+/* Bit of render_frames.middle: a frame was published and not taken yet */
+#define RENDER_FRESH 4
+
+
+/* The part of the lattice an image shows */
+struct render_view
+  {
+  int x, y;                   /* Site at the top left corner */
+  int zoom;                   /* 2^zoom pixels per site (zoom >= 0), or
+                                 2^-zoom sites per pixel side (zoom < 0) */
+  };
+
+/* A frame of the lattice, and the counters of the generation it shows */
+struct render_frame
+  {
+  uint8_t *pixels;            /* RGBA rows of rowstride bytes */
+  int generation;
+  long occupancy, vacancy, up, down;
+  };
+
+/* Frames handed from one producer (the simulation thread) to one consumer
+   (the display) without locks: the producer paints back and swaps it with
+   middle; the consumer swaps front with middle when middle is fresh. The
+   producer never waits, and frames the consumer does not take in time are
+   painted over (dropped). */
+struct render_frames
+  {
+  struct render_frame frame[3];
+  int width, height, rowstride;/* Pixels of the frames */
+  uint64_t *counts;           /* Producer: per pixel counts of a downsampled row */
+  int back;                   /* Producer: the frame being painted */
+  int front;                  /* Consumer: the frame on display */
+  _Atomic int middle;         /* The third frame, | RENDER_FRESH if published */
+  };
+
+
+/* Paint the view of s into width*height pixels, RGBA rows rowstride bytes
+   apart (a multiple of 4): vacant black, spin down green, spin up magenta,
+   undifferentiated white, and grey beyond the lattice. Downsampled, a
+   pixel has the mean colour of its 2^-zoom x 2^-zoom sites, read from the
+   block counts of s when they are up to date and the corner of the view is
+   that of a block (see render_view_clamp), else summed from the sites into
+   counts, width numbers */
+void render_view (const struct simulation *s, const struct render_view *view,
+                  uint8_t *pixels, int width, int height, int rowstride, uint64_t *counts);
+
+/* The view of the whole x_size*y_size lattice in width*height pixels: the
+   largest zoom at which it fits, at the top left corner */
+void render_view_fit (struct render_view *view, int x_size, int y_size, int width, int height);
+
+/* Keep the view over the lattice: zoom in the RENDER_ limits, and the
+   corner such that the view does not go past the lattice when it does
+   not need to, zoomed out at the corner of a block of 2^-zoom sites */
+void render_view_clamp (struct render_view *view, int x_size, int y_size, int width, int height);
+
+/* Allocate three frames of width*height pixels; 0 on success */
+int render_frames_alloc (struct render_frames *f, int width, int height);
+
+/* Release the frames */
+void render_frames_free (struct render_frames *f);
+
+/* Producer: paint the view of s and its counters into the back frame, and
+   publish it */
+void render_frames_publish (struct render_frames *f, const struct simulation *s,
+                            const struct render_view *view);
+
+/* Consumer: the last frame published, now the front frame (the consumer
+   owns it until the next call), or NULL if none was published since */
+struct render_frame *render_frames_take (struct render_frames *f);
+
+#endif
@@ -0,0 +1,293 @@
+// Batched replicas of the Contact Process Ising Model.
+//
+// Survival probabilities and other averages over seeds need thousands of
+// runs of small lattices (64x64, 128x128), which fit in the caches: one
+// thread per lattice then leaves the vector units idle. Here the replicas
+// are stored interleaved, site major (the replicas of a site are
+// contiguous), and every replica visits the same site at the same time:
+// the update of a site is a loop over the replicas, vectorized by the
+// compiler (omp simd) for AVX-512, AVX2 or the baseline instruction set.
+//
+// Sites are visited in the order of the checkerboard schedule (colors one
+// after the other, see checkerboard.c), so every replica follows the
+// dynamics of that schedule, with the rules and integer thresholds of
+// update_site(). Each replica has its own generator, the state of the
+// xoshiro backend seeded as stream r+1 of the seed with the xoshiro256++
+// output (no 64 bit multiply, so it vectorizes too), kept as arrays; a
+// site update draws two outputs:
+//   first   bits 62-63: NN picked by a vacancy (as update_site),
+//           bit 61: sign of a new spin, bits 0-52: birth or death uniform
+//   second  bits 11-63: differentiation or flip uniform
+// Threads take blocks of REPLICA_BLOCK replicas (a cache line of sites).
+
+#include <stdlib.h>
+#include <string.h>
+#include "rng.h"
+#include "simulation.h"
+#include "kernels.h"
+#include "replicas.h"
+
+#define UNIFORM_MASK ((1ULL << 53) - 1)
+
+/* Sites in the order of the sweep, and their neighboors (-1: outside an
+   open lattice); built by replicas_alloc */
+struct replica_tables
+  {
+  int32_t *order;             /* Sites y*x_size + x, color after color */
+  int32_t *neighbor;          /* MAX_FIELD neighboors of each site, as neighbor_offsets */
+  };
+
+
+int replicas_supported (const struct simulation *s)
+  {
+  if (s->n_sites >= INT32_MAX / MAX_FIELD)
+    return -1;
+  return checkerboard_supported (s);
+  }
+
+
+void replicas_free (struct replicas *b)
+  {
+  free (b->state);
+  free (b->vacant);
+  for (int k = 0; k < 4; k++)
+    free (b->rng[k]);
+  free (b->occupancy);
+  free (b->up);
+  free (b->down);
+  if (b->tables != NULL)
+    {
+    free (b->tables->order);
+    free (b->tables->neighbor);
+    free (b->tables);
+    }
+  memset (b, 0, sizeof (*b));
+  }
+
+
+void replicas_parameters (struct replicas *b, const struct simulation *s)
+  {
+  struct simulation parameters = *s;
+  build_boltzmann_table (&parameters);
+  b->birth_threshold = rate_threshold (s->birth_rate);
+  b->death_threshold = rate_threshold (s->death_rate);
+  b->differentiation_threshold = rate_threshold (s->differentiation_rate);
+  memcpy (b->accept_threshold, parameters.accept_threshold, sizeof (b->accept_threshold));
+  }
+
+
+/* Sweep order and neighboor tables of the lattice of b; 0 on success */
+static int build_tables (struct replicas *b, const struct simulation *s)
+  {
+  const int colors = (b->radius == 2) ? 8 : 2;
+  struct replica_tables *t = calloc (1, sizeof (struct replica_tables));
+  long position = 0;
+  int nx, ny;
+  if (t == NULL)
+    return -1;
+  b->tables = t;
+  t->order = malloc ((size_t) b->n_sites * sizeof (int32_t));
+  t->neighbor = malloc ((size_t) b->n_sites * MAX_FIELD * sizeof (int32_t));
+  if (t->order == NULL || t->neighbor == NULL)
+    return -1;
+  for (int color = 0; color < colors; color++)
+    for (int y = 0; y < b->y_size; y++)
+      for (int x = first_x (color, y, b->radius); x < b->x_size; x += colors)
+        t->order[position++] = y * b->x_size + x;
+  for (int y = 0; y < b->y_size; y++)
+    for (int x = 0; x < b->x_size; x++)
+      for (int n = 0; n < MAX_FIELD; n++)
+        t->neighbor[((long) y * b->x_size + x) * MAX_FIELD + n] =
+          lattice_neighbor (s, x, y, neighbor_offsets[n][0], neighbor_offsets[n][1], &nx, &ny)
+          ? ny * b->x_size + nx : -1;
+  return 0;
+  }
+
+
+int replicas_alloc (struct replicas *b, const struct simulation *s, int count)
+  {
+  struct simulation replica;
+  struct rng rng;
+  size_t bytes;
+  void *state;
+  memset (b, 0, sizeof (*b));
+  if (count < 1 || replicas_supported (s) != 0)
+    return -1;
+  count = (count + REPLICA_BLOCK - 1) / REPLICA_BLOCK * REPLICA_BLOCK;
+  b->count = count;
+  b->x_size = s->x_size;
+  b->y_size = s->y_size;
+  b->boundary = s->boundary;
+  b->radius = (s->Ising_neighboorhood == 2) ? 2 : 1;
+  b->n_sites = s->n_sites;
+  b->simd = (s->simd == SIMD_OFF || s->simd == SIMD_AUTO)
+            ? (simd_available (SIMD_AVX512) ? SIMD_AVX512 : simd_available (SIMD_AVX2) ? SIMD_AVX2 : SIMD_SCALAR)
+            : s->simd;
+  bytes = (size_t) b->n_sites * (size_t) count;
+  if (posix_memalign (&state, REPLICA_BLOCK, bytes) != 0)
+    return -1;
+  b->state = state;
+  b->vacant = calloc ((size_t) count, 1);
+  for (int k = 0; k < 4; k++)
+    b->rng[k] = malloc ((size_t) count * sizeof (uint64_t));
+  b->occupancy = malloc ((size_t) count * sizeof (int32_t));
+  b->up = malloc ((size_t) count * sizeof (int32_t));
+  b->down = malloc ((size_t) count * sizeof (int32_t));
+  if (b->vacant == NULL || b->rng[0] == NULL || b->rng[1] == NULL || b->rng[2] == NULL
+      || b->rng[3] == NULL || b->occupancy == NULL || b->up == NULL || b->down == NULL
+      || build_tables (b, s) != 0 || simulation_clone (&replica, s) != 0)
+    {
+    replicas_free (b);
+    return -1;
+    }
+  replicas_parameters (b, s);
+
+  // Each replica: its generator, and a lattice of its own from init_lattice ()
+  for (int r = 0; r < count; r++)
+    {
+    rng_seed_stream (&rng, RNG_XOSHIRO, s->seed, (uint64_t) r + 1);
+    for (int k = 0; k < 4; k++)
+      b->rng[k][r] = rng.state.xoshiro[k];
+    simulation_seed (&replica, rng_next (&rng));
+    init_lattice (&replica);
+    for (int y = 0; y < b->y_size; y++)
+      for (int x = 0; x < b->x_size; x++)
+        b->state[((long) y * b->x_size + x) * count + r] = (int8_t) get_site (&replica, site_index (&replica, x, y));
+    b->occupancy[r] = (int32_t) replica.occupancy;
+    b->up[r] = (int32_t) replica.up;
+    b->down[r] = (int32_t) replica.down;
+    }
+  simulation_free (&replica);
+  return 0;
+  }
+
+
+static inline uint64_t rotl (uint64_t x, int k)
+  {
+  return (x << k) | (x >> (64 - k));
+  }
+
+/* Output of xoshiro256++ (AVX2 and AVX-512F have no 64 bit multiply
+   for the scrambler of xoshiro256**) */
+static inline uint64_t scramble (uint64_t s0, uint64_t s3)
+  {
+  return rotl (s0 + s3, 23) + s0;
+  }
+
+/* Update one site of the replicas [r0, r1): focal points to the site of
+   replica 0, neighbor[] to its neighboors (neighbor_offsets order) */
+static inline __attribute__ ((always_inline))
+void site_kernel (struct replicas *b, int8_t *focal, const int8_t *const *neighbor,
+                  int r0, int r1, const int radius)
+  {
+  const int neighbors = (radius == 2) ? 12 : 4;
+  const uint64_t birth = b->birth_threshold, death = b->death_threshold;
+  const uint64_t differentiation = b->differentiation_threshold;
+  const uint64_t *accept = b->accept_threshold;
+  uint64_t *s0 = b->rng[0], *s1 = b->rng[1], *s2 = b->rng[2], *s3 = b->rng[3];
+  int32_t *occupancy = b->occupancy, *up = b->up, *down = b->down;
+#pragma omp simd
+  for (int r = r0; r < r1; r++)
+    {
+    uint64_t a = s0[r], c = s1[r], e = s2[r], d = s3[r], t, first, second;
+    uint64_t flip, spin;
+    int state = focal[r], south, north, west, east, pick, source, field, sh, next, occupied, neighbor_state;
+    int first_hit, second_hit, changed, negative;
+    // Two outputs of xoshiro256++
+    first = scramble (a, d);
+    t = c << 17; e ^= a; d ^= c; c ^= e; a ^= d; e ^= t; d = rotl (d, 45);
+    second = scramble (a, d);
+    t = c << 17; e ^= a; d ^= c; c ^= e; a ^= d; e ^= t; d = rotl (d, 45);
+    s0[r] = a; s1[r] = c; s2[r] = e; s3[r] = d;
+
+    // Branch free: the rules of update_site () as selects
+    south = neighbor[0][r]; north = neighbor[1][r]; west = neighbor[2][r]; east = neighbor[3][r];
+    field = (south == 2 ? 0 : south) + (north == 2 ? 0 : north)
+            + (west == 2 ? 0 : west) + (east == 2 ? 0 : east);
+#pragma GCC unroll 8
+    for (int n = 4; n < neighbors; n++)
+      {
+      neighbor_state = neighbor[n][r];
+      field += (neighbor_state == 2) ? 0 : neighbor_state;
+      }
+    // NN picked by a vacancy: y-1, y+1, x-1, x+1 (neighbor_offsets 1, 0, 2, 3)
+    pick = (int) (first >> 62);
+    source = (pick == 0) ? north : (pick == 1) ? south : (pick == 2) ? west : east;
+    negative = -(state == -1);
+    sh = (field ^ negative) - negative;
+    occupied = state != 0;
+    // (masks rather than ?: keep the table lookup out of a branch)
+    spin = -(uint64_t) (state != 2);
+    flip = (accept[MAX_FIELD + sh] & spin) | (differentiation & ~spin);
+    first_hit = (first & UNIFORM_MASK) < (occupied ? death : birth);
+    second_hit = (second >> 11) < flip;
+    changed = (state == 2) ? (((first >> 61) & 1) ? 1 : -1) : -state;
+    next = !occupied ? (first_hit ? source : 0)
+           : first_hit ? 0 : second_hit ? changed : state;
+    focal[r] = (int8_t) next;
+    occupancy[r] += (next != 0) - occupied;
+    up[r] += (next == 1) - (state == 1);
+    down[r] += (next == -1) - (state == -1);
+    }
+  }
+
+
+/* One generation of the replicas [r0, r1) */
+static inline __attribute__ ((always_inline))
+void sweep (struct replicas *b, int r0, int r1, const int radius)
+  {
+  const int neighbors = (radius == 2) ? 12 : 4;
+  const int32_t *order = b->tables->order, *table;
+  const int8_t *neighbor[MAX_FIELD];
+  long count = b->count;
+  for (long k = 0; k < b->n_sites; k++)
+    {
+    table = &b->tables->neighbor[(long) order[k] * MAX_FIELD];
+    for (int n = 0; n < neighbors; n++)
+      neighbor[n] = (table[n] < 0) ? b->vacant : b->state + table[n] * count;
+    site_kernel (b, b->state + order[k] * count, neighbor, r0, r1, radius);
+    }
+  }
+
+// One copy of the sweep per instruction set
+#if defined(__x86_64__) && defined(__GNUC__)
+#define REPLICAS_X86 1
+#endif
+
+#define SWEEP(name, radius) \
+  static void name (struct replicas *b, int r0, int r1) { sweep (b, r0, r1, radius); }
+
+SWEEP (sweep_nn, 1)
+SWEEP (sweep_nnn, 2)
+#ifdef REPLICAS_X86
+__attribute__ ((target ("avx2"))) SWEEP (sweep_nn_avx2, 1)
+__attribute__ ((target ("avx2"))) SWEEP (sweep_nnn_avx2, 2)
+__attribute__ ((target ("avx512f,avx512bw"))) SWEEP (sweep_nn_avx512, 1)
+__attribute__ ((target ("avx512f,avx512bw"))) SWEEP (sweep_nnn_avx512, 2)
+#endif
+
+
+void replicas_update (struct replicas *b)
+  {
+  int blocks = b->count / REPLICA_BLOCK;
+  void (*sweep_block) (struct replicas *, int, int) = (b->radius == 2) ? sweep_nnn : sweep_nn;
+#ifdef REPLICAS_X86
+  if (b->simd == SIMD_AVX512 && simd_available (SIMD_AVX512))
+    sweep_block = (b->radius == 2) ? sweep_nnn_avx512 : sweep_nn_avx512;
+  else if (b->simd == SIMD_AVX2 && simd_available (SIMD_AVX2))
+    sweep_block = (b->radius == 2) ? sweep_nnn_avx2 : sweep_nn_avx2;
+#endif
+#pragma omp parallel for schedule(static)
+  for (int block = 0; block < blocks; block++)
+    sweep_block (b, block * REPLICA_BLOCK, (block + 1) * REPLICA_BLOCK);
+  b->generation_time ++;
+  }
+
+
+long replicas_surviving (const struct replicas *b)
+  {
+  long surviving = 0;
+  for (int r = 0; r < b->count; r++)
+    surviving += b->occupancy[r] > 0;
+  return surviving;
+  }
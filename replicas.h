@@ -0,0 +1,61 @@
+// Batched replicas of the Contact Process Ising Model: many small lattices
+// advanced in lockstep, vectorized across replicas; see replicas.c.
+
+#ifndef REPLICAS_H
+#define REPLICAS_H
+
+#include <stdint.h>
+#include "simulation.h"
+
+/* Replicas per thread block (a cache line of int8 sites) */
+#define REPLICA_BLOCK 64
+
+
+/* Replicas of one parameter point. Site (x,y) of replica r is stored at
+   (y*x_size + x)*count + r: the replicas of a site are contiguous. */
+struct replicas
+  {
+  int count;                  /* Replicas (a multiple of REPLICA_BLOCK) */
+  int x_size, y_size;         /* Lattice of every replica */
+  int boundary;               /* BOUNDARY_PERIODIC (or HALO: a torus) or BOUNDARY_OPEN */
+  int radius;                 /* Ising neighboorhood: 1 (NN) or 2 (NNN) */
+  long n_sites;               /* x_size*y_size */
+  int simd;                   /* Instruction set of the sweeps: SIMD_SCALAR, SIMD_AVX2 or SIMD_AVX512 */
+  int8_t *state;              /* Sites of the replicas */
+  int8_t *vacant;             /* count vacancies: the outside of open lattices */
+  uint64_t *rng[4];           /* xoshiro256 state of each replica (++ output) */
+  int32_t *occupancy;         /* Occupied sites of each replica */
+  int32_t *up, *down;         /* Spins of each replica */
+  int generation_time;        /* Generations simulated */
+  uint64_t birth_threshold;   /* Rates as thresholds (see kernels.h) */
+  uint64_t death_threshold;
+  uint64_t differentiation_threshold;
+  uint64_t accept_threshold[2*MAX_FIELD+1];
+  struct replica_tables *tables; /* Sweep order and neighboors (replicas.c) */
+  };
+
+
+/* Can s be run as batched replicas? 0 if so (the sides must suit the
+   checkerboard colors, as the checkerboard schedule) */
+int replicas_supported (const struct simulation *s);
+
+/* Set up count replicas (rounded up to a multiple of REPLICA_BLOCK) of s:
+   its parameters, lattice size and boundary. Replica r draws from stream
+   r+1 of the seed of s and starts from its own init_lattice () with
+   s->init_option. The sweeps use the s->simd kernel, or the best this CPU
+   runs for SIMD_OFF and SIMD_AUTO (all give the same results). 0 on success */
+int replicas_alloc (struct replicas *b, const struct simulation *s, int count);
+
+/* Take the parameters (rates, T, J) of s, e.g. after changing them */
+void replicas_parameters (struct replicas *b, const struct simulation *s);
+
+/* One generation of every replica */
+void replicas_update (struct replicas *b);
+
+/* Replicas with at least one occupied site */
+long replicas_surviving (const struct replicas *b);
+
+/* Release the replicas */
+void replicas_free (struct replicas *b);
+
+#endif
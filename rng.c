@@ -0,0 +1,183 @@
+// Random number generator backends of the simulation core (see rng.h).
+
+#include <string.h>
+#include "mt64.h"
+#include "rng.h"
+
+static const char *backend_names[RNG_BACKENDS] = {"mt64", "xoshiro", "pcg64", "philox"};
+
+
+/* SplitMix64 (Vigna): expands a seed into well mixed state words */
+static uint64_t splitmix64 (uint64_t *x)
+  {
+  uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+  }
+
+static inline uint64_t rotl (uint64_t x, int k)
+  {
+  return (x << k) | (x >> (64 - k));
+  }
+
+
+/* xoshiro256** */
+static void xoshiro_block (uint64_t *s, uint64_t *out)
+  {
+  uint64_t t;
+  for (int i = 0; i < RNG_BLOCK; i++)
+    {
+    out[i] = rotl (s[1] * 5, 7) * 9;
+    t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl (s[3], 45);
+    }
+  }
+
+
+/* PCG64: state = state * PCG_MULTIPLIER + increment, XSL-RR output */
+#define PCG_MULTIPLIER (((unsigned __int128) 2549297995355413924ULL << 64) + 4865540595714422341ULL)
+
+static void pcg_block (struct rng *r)
+  {
+  unsigned __int128 state = r->state.pcg.state;
+  const unsigned __int128 increment = r->state.pcg.increment;
+  uint64_t x;
+  int rotation;
+  for (int i = 0; i < RNG_BLOCK; i++)
+    {
+    state = state * PCG_MULTIPLIER + increment;
+    x = (uint64_t) (state >> 64) ^ (uint64_t) state;
+    rotation = (int) (state >> 122);
+    r->out[i] = (x >> rotation) | (x << ((-rotation) & 63));
+    }
+  r->state.pcg.state = state;
+  }
+
+/* pcg64 srandom: initial state and sequence (stream) */
+static void pcg_seed (struct rng *r, unsigned __int128 initial_state, unsigned __int128 sequence)
+  {
+  r->state.pcg.increment = (sequence << 1) | 1;
+  r->state.pcg.state = r->state.pcg.increment;    /* 0 * multiplier + increment */
+  r->state.pcg.state += initial_state;
+  r->state.pcg.state = r->state.pcg.state * PCG_MULTIPLIER + r->state.pcg.increment;
+  }
+
+
+/* Philox4x64-10: the outputs are a keyed bijection of a 256 bit counter */
+static inline void philox_round (uint64_t c[4], const uint64_t k[2])
+  {
+  unsigned __int128 p0 = (unsigned __int128) 0xD2E7470EE14C6C93ULL * c[0];
+  unsigned __int128 p1 = (unsigned __int128) 0xCA5A826395121157ULL * c[2];
+  uint64_t c1 = c[1], c3 = c[3];
+  c[0] = (uint64_t) (p1 >> 64) ^ c1 ^ k[0];
+  c[1] = (uint64_t) p1;
+  c[2] = (uint64_t) (p0 >> 64) ^ c3 ^ k[1];
+  c[3] = (uint64_t) p0;
+  }
+
+/* Counters encrypted side by side: the rounds of one counter are a chain
+   of dependent multiplications, those of different counters overlap */
+#define PHILOX_LANES 4
+
+static void philox_block (struct rng *r)
+  {
+  uint64_t *counter = r->state.philox.counter;
+  uint64_t c[PHILOX_LANES][4], k[2];
+  for (int i = 0; i < RNG_BLOCK; i += 4 * PHILOX_LANES)
+    {
+    for (int lane = 0; lane < PHILOX_LANES; lane++)
+      {
+      memcpy (c[lane], counter, sizeof (c[lane]));
+      if (++counter[0] == 0)
+        counter[1] ++;
+      }
+    k[0] = r->state.philox.key[0];
+    k[1] = r->state.philox.key[1];
+    for (int round = 0; round < 10; round++)
+      {
+      if (round > 0)
+        {
+        k[0] += 0x9E3779B97F4A7C15ULL;
+        k[1] += 0xBB67AE8584CAA73BULL;
+        }
+      for (int lane = 0; lane < PHILOX_LANES; lane++)
+        philox_round (c[lane], k);
+      }
+    memcpy (&r->out[i], c, sizeof (c));
+    }
+  }
+
+
+void rng_seed_stream (struct rng *r, int backend, uint64_t seed, uint64_t stream)
+  {
+  uint64_t x = stream, mixed;
+  r->backend = backend;
+  r->next = RNG_BLOCK;
+  switch (backend)
+    {
+    case RNG_XOSHIRO:
+      mixed = seed ^ splitmix64 (&x);
+      for (int i = 0; i < 4; i++)
+        r->state.xoshiro[i] = splitmix64 (&mixed);
+      break;
+    case RNG_PCG64:
+      // PCG has streams of its own: the stream selects the increment
+      x = seed;
+      mixed = splitmix64 (&x);
+      pcg_seed (r, ((unsigned __int128) mixed << 64) | splitmix64 (&x), stream);
+      break;
+    case RNG_PHILOX:
+      memset (r->state.philox.counter, 0, sizeof (r->state.philox.counter));
+      r->state.philox.key[0] = seed;
+      r->state.philox.key[1] = stream;
+      break;
+    default:
+      r->backend = RNG_MT64;
+      if (stream == 0)
+        init_genrand64_r (&r->state.mt, seed);
+      else
+        init_genrand64_stream_r (&r->state.mt, seed, stream);
+      break;
+    }
+  }
+
+
+int rng_cheap_streams (int backend)
+  {
+  return backend != RNG_MT64;
+  }
+
+
+void rng_refill (struct rng *r)
+  {
+  switch (r->backend)
+    {
+    case RNG_XOSHIRO: xoshiro_block (r->state.xoshiro, r->out); break;
+    case RNG_PCG64:   pcg_block (r); break;
+    case RNG_PHILOX:  philox_block (r); break;
+    default:          genrand64_fill_r (&r->state.mt, (unsigned long long *) r->out, RNG_BLOCK); break;
+    }
+  r->next = 0;
+  }
+
+
+int rng_from_name (const char *name)
+  {
+  for (int backend = 0; backend < RNG_BACKENDS; backend++)
+    if (strcmp (name, backend_names[backend]) == 0)
+      return backend;
+  return -1;
+  }
+
+const char *rng_name (int backend)
+  {
+  if (backend < 0 || backend >= RNG_BACKENDS)
+    return "unknown";
+  return backend_names[backend];
+  }
@@ -0,0 +1,70 @@
+// Random number generators of the simulation core.
+// One interface, several backends chosen at run time (--rng NAME):
+//   mt64      MT19937-64 (mt64.c), the original generator
+//   xoshiro   xoshiro256** (Blackman & Vigna)
+//   pcg64     PCG64, 128 bit LCG with XSL-RR output (O'Neill)
+//   philox    Philox4x64-10, counter based (Salmon et al., Random123)
+// The outputs are generated RNG_BLOCK at a time, so the backend is only
+// dispatched once per block and rng_next() is an inline load.
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+#include "mt64.h"
+
+/* Backends */
+enum
+  {
+  RNG_MT64,
+  RNG_XOSHIRO,
+  RNG_PCG64,
+  RNG_PHILOX,
+  RNG_BACKENDS
+  };
+
+/* Outputs generated at a time */
+#define RNG_BLOCK 64
+
+
+/* One generator */
+struct rng
+  {
+  uint64_t out[RNG_BLOCK];    /* Current block of outputs */
+  int next;                   /* Next output in out[] (RNG_BLOCK: refill) */
+  int backend;                /* RNG_MT64, RNG_XOSHIRO, RNG_PCG64 or RNG_PHILOX */
+  union
+    {
+    mt64_state mt;
+    uint64_t xoshiro[4];
+    struct { unsigned __int128 state, increment; } pcg;
+    struct { uint64_t counter[4], key[2]; } philox;
+    } state;
+  };
+
+
+/* Seed r with stream number `stream` of a master seed. The same (backend,
+   seed, stream) always gives the same sequence, and different streams are
+   independent. Stream 0 of mt64 is init_genrand64 (seed). */
+void rng_seed_stream (struct rng *r, int backend, uint64_t seed, uint64_t stream);
+
+/* Seeding a stream is cheap (no state initialization loop): 1 for every
+   backend but mt64 */
+int rng_cheap_streams (int backend);
+
+/* Generate the next block (used by rng_next) */
+void rng_refill (struct rng *r);
+
+/* Next 64 bit output */
+static inline uint64_t rng_next (struct rng *r)
+  {
+  if (r->next >= RNG_BLOCK)
+    rng_refill (r);
+  return r->out[r->next++];
+  }
+
+/* Backend by name (-1 if unknown), and name of a backend */
+int rng_from_name (const char *name);
+const char *rng_name (int backend);
+
+#endif
@@ -0,0 +1,586 @@
+// Vectorized (SIMD) engine of the checkerboard schedule.
+//
+// update_site() draws a variable number of random numbers per site, one
+// site after the other. A vector kernel needs a fixed pattern, so this
+// engine consumes the generator per chunk of 64 consecutive sites of a
+// row (lane i is the site x0 + i):
+//   output 0, 1    bit i: low and high bit of the NN a vacancy copies
+//                  (0: y-1, 1: y+1, 2: x-1, 3: x+1, as update_site)
+//   output 2..9    byte i: top 8 bits of the first uniform of lane i
+//                  (birth of a vacancy, death of an occupied site)
+//   output 10..17  byte i: top 8 bits of the second uniform (differentiation
+//                  of an undifferentiated site, flip of a spin)
+//   output 18      bit i: sign of a new spin (1: up)
+// A 53 bit uniform U is below the threshold t = high*2^45 + low (kernels.h)
+// if its top byte is below high, or equal to it and its 45 low bits are
+// below low. The top bytes decide all but 1 in 256 of the draws; the others
+// (ties) take their low bits from one more output each, in lane order, the
+// ties of the first uniforms before those of the second. The probabilities
+// are exactly those of update_site() and so are the rules; only the sites
+// of the color being updated change.
+//
+// Each chunk is scanned by a kernel (the states, the local fields and the
+// NN copied, with the top byte comparisons), its ties are resolved, and the
+// kernel blends the new states. The scalar kernel is the reference; the
+// AVX2 and AVX-512 kernels (x86-64, chosen at run time) give the same
+// lattice byte for byte (cpim-bench --check compares them). Neighboors are
+// plain offsets, so the engine needs the int8 layout and a halo.
+
+#include <stdlib.h>
+#include <string.h>
+#include "rng.h"
+#include "simulation.h"
+#include "kernels.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define SIMD_X86 1
+#endif
+
+/* Sites (lanes) of a chunk */
+#define CHUNK 64
+/* Generator outputs at the start of each chunk (see above) */
+#define CHUNK_DRAWS 19
+
+static const char *simd_names[] = {"off", "scalar", "avx2", "avx512", "auto"};
+
+
+/* Thresholds (kernels.h) split in their top byte and 45 low bits; always
+   is 0xFF for "always, without a draw" */
+struct split_threshold
+  {
+  uint8_t high, always;
+  uint64_t low;
+  };
+
+struct simd_thresholds
+  {
+  struct split_threshold birth, death, differentiation;
+  uint8_t accept_high[32], accept_always[32]; /* By s*h + MAX_FIELD */
+  uint64_t accept_low[32];
+  };
+
+/* A scanned chunk */
+struct chunk
+  {
+  uint64_t occupied;          /* Lanes that are occupied */
+  uint64_t undifferentiated;  /* Lanes in state 2 */
+  uint64_t source_occupied;   /* Lanes whose picked NN is occupied */
+  uint64_t below1, tied1;     /* Top byte of the first uniform below (equal to) its threshold */
+  uint64_t below2, tied2;     /* The same for the second uniform */
+  int8_t state[CHUNK];        /* States of the lanes */
+  int8_t source[CHUNK];       /* State of the NN picked by each lane */
+  uint8_t value[CHUNK];       /* s*h + MAX_FIELD of each lane */
+  };
+
+/* Outcome of a chunk */
+struct outcome
+  {
+  uint64_t born, dead, new_spin, flip, sign;
+  };
+
+
+int simd_from_name (const char *name)
+  {
+  for (int kernel = SIMD_OFF; kernel <= SIMD_AUTO; kernel++)
+    if (strcmp (name, simd_names[kernel]) == 0)
+      return kernel;
+  return -1;
+  }
+
+const char *simd_name (int kernel)
+  {
+  if (kernel < SIMD_OFF || kernel > SIMD_AUTO)
+    return "unknown";
+  return simd_names[kernel];
+  }
+
+
+/* Does this CPU run the kernel? */
+int simd_available (int kernel)
+  {
+#ifdef SIMD_X86
+  if (kernel == SIMD_AVX2)
+    return __builtin_cpu_supports ("avx2");
+  if (kernel == SIMD_AVX512)
+    return __builtin_cpu_supports ("avx512f") && __builtin_cpu_supports ("avx512bw");
+#endif
+  return kernel == SIMD_SCALAR || kernel == SIMD_AUTO;
+  }
+
+
+/* Kernel that runs for s->simd: SIMD_AUTO is the best this CPU runs, and
+   a kernel it does not run is replaced by the reference (same results) */
+static int chosen_kernel (const struct simulation *s)
+  {
+  if (s->simd == SIMD_AUTO)
+    {
+    if (simd_available (SIMD_AVX512))
+      return SIMD_AVX512;
+    if (simd_available (SIMD_AVX2))
+      return SIMD_AVX2;
+    return SIMD_SCALAR;
+    }
+  return simd_available (s->simd) ? s->simd : SIMD_SCALAR;
+  }
+
+
+/* Can s be updated with the vector engine? 0 if so */
+int simd_supported (const struct simulation *s)
+  {
+#if defined(CPIM_PACKED_LATTICE) || defined(CPIM_INT_LATTICE)
+  (void) s;
+  return -1;
+#else
+  if (s->halo == 0)
+    return -1;
+  return checkerboard_supported (s);
+#endif
+  }
+
+
+static void split (uint64_t threshold, struct split_threshold *t)
+  {
+  if (threshold >= THRESHOLD_ONE)
+    {
+    t->high = 0xFF;
+    t->always = 0xFF;
+    t->low = 0;
+    return;
+    }
+  t->high = (uint8_t) (threshold >> 45);
+  t->always = 0;
+  t->low = threshold & ((1ULL << 45) - 1);
+  }
+
+static void prepare_simd_thresholds (const struct simulation *s, struct simd_thresholds *t)
+  {
+  struct split_threshold accept;
+  memset (t, 0, sizeof (*t));
+  split (s->birth_threshold, &t->birth);
+  split (s->death_threshold, &t->death);
+  split (s->differentiation_threshold, &t->differentiation);
+  for (int value = 0; value <= 2 * MAX_FIELD; value++)
+    {
+    split (s->accept_threshold[value], &accept);
+    t->accept_high[value] = accept.high;
+    t->accept_always[value] = accept.always;
+    t->accept_low[value] = accept.low;
+    }
+  }
+
+
+/* Offsets of the NN a vacancy copies, by the 2 bits of its lane */
+static inline long source_offset (const struct simulation *s, int pick)
+  {
+  switch (pick)
+    {
+    case 0:  return -s->stride;
+    case 1:  return s->stride;
+    case 2:  return -1;
+    default: return 1;
+    }
+  }
+
+
+/* Scalar kernel: scan the first `lanes` lanes of the chunk at p */
+static void scan_scalar (const struct simulation *s, const int8_t *p, int lanes,
+                         const uint64_t *draws, const struct simd_thresholds *t,
+                         struct chunk *c, const int radius)
+  {
+  const int neighbors = (radius == 2) ? 12 : 4;
+  const struct split_threshold *first;
+  int state, pick, field;
+  uint8_t top, high, always;
+  memset (c, 0, sizeof (*c));
+  for (int i = 0; i < lanes; i++)
+    {
+    const uint64_t bit = 1ULL << i;
+    state = p[i];
+    c->state[i] = (int8_t) state;
+    c->occupied |= (state != 0) ? bit : 0;
+    c->undifferentiated |= (state == 2) ? bit : 0;
+    pick = (int) (((draws[0] >> i) & 1) | (((draws[1] >> i) & 1) << 1));
+    c->source[i] = p[i + source_offset (s, pick)];
+    c->source_occupied |= (c->source[i] != 0) ? bit : 0;
+    first = (state != 0) ? &t->death : &t->birth;
+    top = (uint8_t) (draws[2 + i / 8] >> (8 * (i % 8)));
+    c->below1 |= (first->always || top < first->high) ? bit : 0;
+    c->tied1 |= (!first->always && top == first->high) ? bit : 0;
+    field = 0;
+    for (int n = 0; n < neighbors; n++)
+      field += spin_of[p[i + neighbor_offsets[n][1] * s->stride + neighbor_offsets[n][0]] & 3];
+    c->value[i] = (uint8_t) (MAX_FIELD + (state == 0 ? 0 : state == -1 ? -field : field));
+    high = (state == 2) ? t->differentiation.high : t->accept_high[c->value[i]];
+    always = (state == 2) ? t->differentiation.always : t->accept_always[c->value[i]];
+    top = (uint8_t) (draws[10 + i / 8] >> (8 * (i % 8)));
+    c->below2 |= (always || top < high) ? bit : 0;
+    c->tied2 |= (!always && top == high) ? bit : 0;
+    }
+  }
+
+/* Scalar kernel: new states of the lanes */
+static void blend_scalar (const struct chunk *c, const struct outcome *o, int lanes, int8_t *next)
+  {
+  for (int i = 0; i < lanes; i++)
+    {
+    next[i] = c->state[i];
+    if ((o->born >> i) & 1)
+      next[i] = c->source[i];
+    if ((o->dead >> i) & 1)
+      next[i] = 0;
+    if ((o->new_spin >> i) & 1)
+      next[i] = ((o->sign >> i) & 1) ? 1 : -1;
+    if ((o->flip >> i) & 1)
+      next[i] = (int8_t) -c->state[i];
+    }
+  }
+
+
+#ifdef SIMD_X86
+
+/* 32 bits to 32 byte masks */
+__attribute__ ((target ("avx2")))
+static inline __m256i expand_avx2 (uint32_t bits)
+  {
+  const __m256i select = _mm256_setr_epi8 (0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                           2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+  const __m256i bit = _mm256_set1_epi64x ((long long) 0x8040201008040201ULL);
+  __m256i v = _mm256_shuffle_epi8 (_mm256_set1_epi32 ((int) bits), select);
+  return _mm256_cmpeq_epi8 (_mm256_and_si256 (v, bit), bit);
+  }
+
+__attribute__ ((target ("avx2")))
+static inline uint64_t mask_avx2 (__m256i v, int half)
+  {
+  return (uint64_t) (uint32_t) _mm256_movemask_epi8 (v) << (32 * half);
+  }
+
+__attribute__ ((target ("avx2")))
+static inline __m256i load_avx2 (const void *p)
+  {
+  return _mm256_loadu_si256 ((const __m256i *) p);
+  }
+
+/* AVX2 kernel: scan the chunk at p, 32 lanes at a time */
+__attribute__ ((target ("avx2")))
+static void scan_avx2 (const struct simulation *s, const int8_t *p, const uint64_t *draws,
+                       const struct simd_thresholds *t, struct chunk *c, const int radius)
+  {
+  const int neighbors = (radius == 2) ? 12 : 4;
+  const __m256i zero = _mm256_setzero_si256 (), two = _mm256_set1_epi8 (2);
+  const __m256i bias = _mm256_set1_epi8 ((char) 0x80), fifteen = _mm256_set1_epi8 (15);
+  const __m256i offset = _mm256_set1_epi8 (MAX_FIELD), sixteen = _mm256_set1_epi8 (16);
+  const __m256i high_low = _mm256_broadcastsi128_si256 (_mm_loadu_si128 ((const __m128i *) t->accept_high));
+  const __m256i high_high = _mm256_broadcastsi128_si256 (_mm_loadu_si128 ((const __m128i *) (t->accept_high + 16)));
+  const __m256i always_low = _mm256_broadcastsi128_si256 (_mm_loadu_si128 ((const __m128i *) t->accept_always));
+  const __m256i always_high = _mm256_broadcastsi128_si256 (_mm_loadu_si128 ((const __m128i *) (t->accept_always + 16)));
+  __m256i state, field, v, vacant, undifferentiated, source, pick_low, pick_high;
+  __m256i top, high, always, value, upper;
+  memset (c, 0, offsetof (struct chunk, state));
+  for (int half = 0; half < 2; half++)
+    {
+    const int8_t *q = p + 32 * half;
+    state = load_avx2 (q);
+    vacant = _mm256_cmpeq_epi8 (state, zero);
+    undifferentiated = _mm256_cmpeq_epi8 (state, two);
+    c->occupied |= ~mask_avx2 (vacant, half) & (0xFFFFFFFFULL << (32 * half));
+    c->undifferentiated |= mask_avx2 (undifferentiated, half);
+
+    // NN copied by a vacancy
+    pick_low = expand_avx2 ((uint32_t) (draws[0] >> (32 * half)));
+    pick_high = expand_avx2 ((uint32_t) (draws[1] >> (32 * half)));
+    source = _mm256_blendv_epi8 (
+               _mm256_blendv_epi8 (load_avx2 (q - s->stride), load_avx2 (q + s->stride), pick_low),
+               _mm256_blendv_epi8 (load_avx2 (q - 1), load_avx2 (q + 1), pick_low), pick_high);
+    c->source_occupied |= ~mask_avx2 (_mm256_cmpeq_epi8 (source, zero), half)
+                          & (0xFFFFFFFFULL << (32 * half));
+
+    // First uniform: birth or death; unsigned compare of the top bytes
+    top = load_avx2 ((const uint8_t *) &draws[2] + 32 * half);
+    high = _mm256_blendv_epi8 (_mm256_set1_epi8 ((char) t->death.high),
+                               _mm256_set1_epi8 ((char) t->birth.high), vacant);
+    always = _mm256_blendv_epi8 (_mm256_set1_epi8 ((char) t->death.always),
+                                 _mm256_set1_epi8 ((char) t->birth.always), vacant);
+    c->below1 |= mask_avx2 (_mm256_or_si256 (always, _mm256_cmpgt_epi8 (_mm256_xor_si256 (high, bias),
+                                                                         _mm256_xor_si256 (top, bias))), half);
+    c->tied1 |= mask_avx2 (_mm256_andnot_si256 (always, _mm256_cmpeq_epi8 (top, high)), half);
+
+    // Local field: every neighboor adds its spin (state, or 0 for state 2)
+    field = zero;
+    for (int n = 0; n < neighbors; n++)
+      {
+      v = load_avx2 (q + neighbor_offsets[n][1] * s->stride + neighbor_offsets[n][0]);
+      field = _mm256_add_epi8 (field, _mm256_andnot_si256 (_mm256_cmpeq_epi8 (v, two), v));
+      }
+    value = _mm256_add_epi8 (_mm256_sign_epi8 (field, state), offset);
+
+    // Second uniform: differentiation, or a flip with the threshold of s*h
+    upper = _mm256_cmpgt_epi8 (value, fifteen);
+    high = _mm256_blendv_epi8 (_mm256_shuffle_epi8 (high_low, value),
+                               _mm256_shuffle_epi8 (high_high, _mm256_sub_epi8 (value, sixteen)), upper);
+    always = _mm256_blendv_epi8 (_mm256_shuffle_epi8 (always_low, value),
+                                 _mm256_shuffle_epi8 (always_high, _mm256_sub_epi8 (value, sixteen)), upper);
+    high = _mm256_blendv_epi8 (high, _mm256_set1_epi8 ((char) t->differentiation.high), undifferentiated);
+    always = _mm256_blendv_epi8 (always, _mm256_set1_epi8 ((char) t->differentiation.always), undifferentiated);
+    top = load_avx2 ((const uint8_t *) &draws[10] + 32 * half);
+    c->below2 |= mask_avx2 (_mm256_or_si256 (always, _mm256_cmpgt_epi8 (_mm256_xor_si256 (high, bias),
+                                                                         _mm256_xor_si256 (top, bias))), half);
+    c->tied2 |= mask_avx2 (_mm256_andnot_si256 (always, _mm256_cmpeq_epi8 (top, high)), half);
+
+    _mm256_storeu_si256 ((__m256i *) (c->state + 32 * half), state);
+    _mm256_storeu_si256 ((__m256i *) (c->source + 32 * half), source);
+    _mm256_storeu_si256 ((__m256i *) (c->value + 32 * half), value);
+    }
+  }
+
+/* AVX2 kernel: new states of the lanes */
+__attribute__ ((target ("avx2")))
+static void blend_avx2 (const struct chunk *c, const struct outcome *o, int8_t *next)
+  {
+  __m256i state, spin, result;
+  for (int half = 0; half < 2; half++)
+    {
+    state = load_avx2 (c->state + 32 * half);
+    spin = _mm256_blendv_epi8 (_mm256_set1_epi8 (-1), _mm256_set1_epi8 (1),
+                               expand_avx2 ((uint32_t) (o->sign >> (32 * half))));
+    result = _mm256_blendv_epi8 (state, load_avx2 (c->source + 32 * half),
+                                 expand_avx2 ((uint32_t) (o->born >> (32 * half))));
+    result = _mm256_andnot_si256 (expand_avx2 ((uint32_t) (o->dead >> (32 * half))), result);
+    result = _mm256_blendv_epi8 (result, spin, expand_avx2 ((uint32_t) (o->new_spin >> (32 * half))));
+    result = _mm256_blendv_epi8 (result, _mm256_sub_epi8 (_mm256_setzero_si256 (), state),
+                                 expand_avx2 ((uint32_t) (o->flip >> (32 * half))));
+    _mm256_storeu_si256 ((__m256i *) (next + 32 * half), result);
+    }
+  }
+
+
+/* AVX-512 kernel: scan the chunk at p, 64 lanes at a time */
+__attribute__ ((target ("avx512f,avx512bw")))
+static void scan_avx512 (const struct simulation *s, const int8_t *p, const uint64_t *draws,
+                         const struct simd_thresholds *t, struct chunk *c, const int radius)
+  {
+  const int neighbors = (radius == 2) ? 12 : 4;
+  const __m512i zero = _mm512_setzero_si512 (), two = _mm512_set1_epi8 (2);
+  const __m512i offset = _mm512_set1_epi8 (MAX_FIELD), sixteen = _mm512_set1_epi8 (16);
+  const __m512i high_low = _mm512_broadcast_i32x4 (_mm_loadu_si128 ((const __m128i *) t->accept_high));
+  const __m512i high_high = _mm512_broadcast_i32x4 (_mm_loadu_si128 ((const __m128i *) (t->accept_high + 16)));
+  const __m512i always_low = _mm512_broadcast_i32x4 (_mm_loadu_si128 ((const __m128i *) t->accept_always));
+  const __m512i always_high = _mm512_broadcast_i32x4 (_mm_loadu_si128 ((const __m128i *) (t->accept_always + 16)));
+  const __mmask64 pick_low = draws[0], pick_high = draws[1];
+  __m512i state, field, v, source, top, high, value;
+  __mmask64 occupied, undifferentiated, always, upper;
+
+  state = _mm512_loadu_si512 (p);
+  occupied = _mm512_test_epi8_mask (state, state);
+  undifferentiated = _mm512_cmpeq_epi8_mask (state, two);
+  c->occupied = occupied;
+  c->undifferentiated = undifferentiated;
+
+  // NN copied by a vacancy
+  source = _mm512_mask_blend_epi8 (pick_high,
+             _mm512_mask_blend_epi8 (pick_low, _mm512_loadu_si512 (p - s->stride),
+                                     _mm512_loadu_si512 (p + s->stride)),
+             _mm512_mask_blend_epi8 (pick_low, _mm512_loadu_si512 (p - 1), _mm512_loadu_si512 (p + 1)));
+  c->source_occupied = _mm512_test_epi8_mask (source, source);
+
+  // First uniform: birth or death
+  top = _mm512_loadu_si512 (&draws[2]);
+  high = _mm512_mask_blend_epi8 (occupied, _mm512_set1_epi8 ((char) t->birth.high),
+                                 _mm512_set1_epi8 ((char) t->death.high));
+  always = (occupied & (t->death.always ? ~0ULL : 0)) | (~occupied & (t->birth.always ? ~0ULL : 0));
+  c->below1 = always | _mm512_cmplt_epu8_mask (top, high);
+  c->tied1 = ~always & _mm512_cmpeq_epi8_mask (top, high);
+
+  // Local field: every neighboor adds its spin (state, or 0 for state 2)
+  field = zero;
+  for (int n = 0; n < neighbors; n++)
+    {
+    v = _mm512_loadu_si512 (p + neighbor_offsets[n][1] * s->stride + neighbor_offsets[n][0]);
+    field = _mm512_mask_add_epi8 (field, ~_mm512_cmpeq_epi8_mask (v, two), field, v);
+    }
+  field = _mm512_mask_sub_epi8 (field, _mm512_cmpeq_epi8_mask (state, _mm512_set1_epi8 (-1)), zero, field);
+  value = _mm512_add_epi8 (_mm512_maskz_mov_epi8 (occupied, field), offset);
+
+  // Second uniform: differentiation, or a flip with the threshold of s*h
+  upper = _mm512_cmpgt_epu8_mask (value, _mm512_set1_epi8 (15));
+  high = _mm512_mask_blend_epi8 (upper, _mm512_shuffle_epi8 (high_low, value),
+                                 _mm512_shuffle_epi8 (high_high, _mm512_sub_epi8 (value, sixteen)));
+  always = _mm512_test_epi8_mask (_mm512_mask_blend_epi8 (upper, _mm512_shuffle_epi8 (always_low, value),
+                                  _mm512_shuffle_epi8 (always_high, _mm512_sub_epi8 (value, sixteen))),
+                                  _mm512_set1_epi8 (-1));
+  high = _mm512_mask_blend_epi8 (undifferentiated, high, _mm512_set1_epi8 ((char) t->differentiation.high));
+  always = (undifferentiated & (t->differentiation.always ? ~0ULL : 0)) | (~undifferentiated & always);
+  top = _mm512_loadu_si512 (&draws[10]);
+  c->below2 = always | _mm512_cmplt_epu8_mask (top, high);
+  c->tied2 = ~always & _mm512_cmpeq_epi8_mask (top, high);
+
+  _mm512_storeu_si512 (c->state, state);
+  _mm512_storeu_si512 (c->source, source);
+  _mm512_storeu_si512 (c->value, value);
+  }
+
+/* AVX-512 kernel: new states of the lanes */
+__attribute__ ((target ("avx512f,avx512bw")))
+static void blend_avx512 (const struct chunk *c, const struct outcome *o, int8_t *next)
+  {
+  __m512i state = _mm512_loadu_si512 (c->state), result;
+  __m512i spin = _mm512_mask_blend_epi8 (o->sign, _mm512_set1_epi8 (-1), _mm512_set1_epi8 (1));
+  result = _mm512_mask_blend_epi8 (o->born, state, _mm512_loadu_si512 (c->source));
+  result = _mm512_maskz_mov_epi8 (~o->dead, result);
+  result = _mm512_mask_blend_epi8 (o->new_spin, result, spin);
+  result = _mm512_mask_blend_epi8 (o->flip, result, _mm512_sub_epi8 (_mm512_setzero_si512 (), state));
+  _mm512_storeu_si512 (next, result);
+  }
+
+#endif
+
+
+/* Decide the outcome of the lanes `lanes` of a scanned chunk, drawing the
+   low bits of the ties (the same for every kernel) */
+static inline void decide (struct rng *rng, const struct chunk *c, uint64_t lanes, const uint64_t *draws,
+                           const struct simd_thresholds *t, struct outcome *o)
+  {
+  uint64_t relevant, first, second, ties, low;
+  int i;
+  // Occupied sites may die, vacancies copy an occupied NN
+  relevant = lanes & (c->occupied | c->source_occupied);
+  first = relevant & c->below1;
+  for (ties = relevant & c->tied1; ties != 0; ties &= ties - 1)
+    {
+    i = __builtin_ctzll (ties);
+    low = ((c->occupied >> i) & 1) ? t->death.low : t->birth.low;
+    if ((rng_next (rng) >> 19) < low)
+      first |= 1ULL << i;
+    }
+  o->born = first & ~c->occupied;
+  o->dead = first & c->occupied;
+  // Survivors differentiate or flip
+  relevant = lanes & c->occupied & ~o->dead;
+  second = relevant & c->below2;
+  for (ties = relevant & c->tied2; ties != 0; ties &= ties - 1)
+    {
+    i = __builtin_ctzll (ties);
+    low = ((c->undifferentiated >> i) & 1) ? t->differentiation.low : t->accept_low[c->value[i]];
+    if ((rng_next (rng) >> 19) < low)
+      second |= 1ULL << i;
+    }
+  o->new_spin = second & c->undifferentiated;
+  o->flip = second & ~c->undifferentiated;
+  o->sign = draws[18];
+  }
+
+
+/* Write the lanes that changed back to the lattice */
+static inline void commit (struct simulation *s, const struct chunk *c, const struct outcome *o,
+                           const int8_t *next, int x0, int y, struct site_counts *counts)
+  {
+  uint64_t changed = o->born | o->dead | o->new_spin | o->flip;
+  int i, old, state;
+  for (; changed != 0; changed &= changed - 1)
+    {
+    i = __builtin_ctzll (changed);
+    old = c->state[i];
+    state = next[i];
+    change_site (s, x0 + i, y, site_index (s, x0 + i, y), state, WRAP_HALO);
+    counts->occupancy += (state != 0) - (old != 0);
+    counts->vacancy -= (state != 0) - (old != 0);
+    counts->up += (state == 1) - (old == 1);
+    counts->down += (state == -1) - (old == -1);
+    }
+  }
+
+
+/* Lanes of the given color in the chunk at x0 of row y */
+static inline uint64_t color_lanes (int color, int x0, int y, const int radius)
+  {
+  int first = (first_x (color, y, radius) - x0) & ((radius == 2) ? 7 : 1);
+  if (radius == 2)
+    return 0x0101010101010101ULL << first;
+  return 0x5555555555555555ULL << first;
+  }
+
+
+static inline void simd_kernel (struct simulation *s, const struct simd_thresholds *t,
+                                const int kernel, const int radius)
+  {
+  const int colors = (radius == 2) ? 8 : 2;
+  const int per_row = rng_cheap_streams (s->rng_backend);
+  long occupancy = 0, vacancy = 0, up = 0, down = 0;
+#pragma omp parallel reduction(+:occupancy, vacancy, up, down)
+    {
+    struct rng row_rng;
+    struct rng *rng = per_row ? &row_rng : &s->thread_rng[thread_number ()];
+    struct site_counts counts = {0, 0, 0, 0};
+    struct chunk c;
+    struct outcome o;
+    uint64_t draws[CHUNK_DRAWS], lanes;
+    int8_t next[CHUNK];
+    for (int color = 0; color < colors; color++)
+      {
+      // The implicit barrier at the end of each color keeps colors apart
+#pragma omp for schedule(static)
+      for (int y = 0; y < s->y_size; y++)
+        {
+        const int8_t *row = (const int8_t *) s->lattice_configuration + site_index (s, 0, y);
+        if (per_row)
+          rng_seed_stream (rng, s->rng_backend, s->seed, row_stream (s, color, y));
+        for (int x0 = 0; x0 < s->x_size; x0 += CHUNK)
+          {
+          int width = (s->x_size - x0 < CHUNK) ? s->x_size - x0 : CHUNK;
+          for (int k = 0; k < CHUNK_DRAWS; k++)
+            draws[k] = rng_next (rng);
+          lanes = color_lanes (color, x0, y, radius);
+          if (width < CHUNK)
+            lanes &= (1ULL << width) - 1;
+#ifdef SIMD_X86
+          // A partial chunk at the end of the row goes through the reference
+          if (kernel == SIMD_AVX512 && width == CHUNK)
+            {
+            scan_avx512 (s, row + x0, draws, t, &c, radius);
+            decide (rng, &c, lanes, draws, t, &o);
+            blend_avx512 (&c, &o, next);
+            }
+          else if (kernel == SIMD_AVX2 && width == CHUNK)
+            {
+            scan_avx2 (s, row + x0, draws, t, &c, radius);
+            decide (rng, &c, lanes, draws, t, &o);
+            blend_avx2 (&c, &o, next);
+            }
+          else
+#endif
+            {
+            scan_scalar (s, row + x0, width, draws, t, &c, radius);
+            decide (rng, &c, lanes, draws, t, &o);
+            blend_scalar (&c, &o, width, next);
+            }
+          commit (s, &c, &o, next, x0, y, &counts);
+          }
+        }
+      }
+    occupancy += counts.occupancy; vacancy += counts.vacancy;
+    up += counts.up; down += counts.down;
+    }
+  s->occupancy += occupancy; s->vacancy += vacancy;
+  s->up += up; s->down += down;
+  s->generation_time ++;
+  }
+
+
+/* One generation of the checkerboard schedule with the vector engine */
+int update_lattice_simd (struct simulation *s)
+  {
+  struct simd_thresholds t;
+  int kernel = chosen_kernel (s);
+  if (simd_supported (s) != 0)
+    return -1;
+  if (!rng_cheap_streams (s->rng_backend) && prepare_thread_generators (s) != 0)
+    return -1;
+  prepare_rate_thresholds (s);
+  prepare_simd_thresholds (s, &t);
+  if (s->Ising_neighboorhood == 2)
+    simd_kernel (s, &t, kernel, 2);
+  else
+    simd_kernel (s, &t, kernel, 1);
+  return 0;
+  }
@@ -0,0 +1,634 @@
+// Contact Process Ising Model (CPIM) simulation core.
+// C code to expand the Contact Process (CP) code to incorporate
+// a basic Ising Model into the occupancy states of the CP
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>    /* Math to transform random n from continuous to discrete */
+#include <sys/mman.h> /* Large lattices are mapped straight from the kernel */
+#include "rng.h"     /* Pseudo-random number generators */
+#include "simulation.h"
+#include "kernels.h"
+
+/* Lattices bigger than this are mmap-ed (and may use huge pages) */
+#define MMAP_THRESHOLD (1 << 21)
+/* Alignment of heap allocated lattices (a cache line) */
+#define LATTICE_ALIGNMENT 64
+
+
+/* Set default parameters of the simulation */
+void simulation_defaults (struct simulation *s)
+  {
+  //initial condition option
+  s->init_option = (int) INIT;
+
+  // Contact Process
+  s->birth_rate = (double) BETA;
+  s->death_rate = (double) DELTA;
+
+  // Cell differenciation
+  s->differentiation_rate = (double) ALPHA;
+
+  // Ising Model
+  // interaction radius
+  s->Ising_neighboorhood = (int) RADIUS;
+  // Temperature
+  s->T = (double) TEMPERATURE;
+  // Spin coupling
+  s->J = -1 * (double) COUPLING;
+  build_boltzmann_table (s);
+  // Update schedule
+  s->schedule = SCHEDULE_RANDOM;
+  s->domain_rounds = (int) DOMAIN_ROUNDS;
+  s->rng_backend = RNG_MT64;
+  simulation_seed (s, 5489ULL);
+  /* Set simulation flags */
+  s->initialized = 0;
+  s->generation_time = 0;
+  }
+
+
+/* Seed the generator of the simulation: stream 0 of the seed (with mt64,
+   the same sequence as init_genrand64 (seed)) */
+void simulation_seed (struct simulation *s, unsigned long long seed)
+  {
+  rng_seed_stream (&s->rng, s->rng_backend, seed, 0);
+  s->seed = seed;
+  s->streams = 0;
+  // Generators derived from the previous seed are drawn again on next use
+  free (s->thread_rng);
+  s->thread_rng = NULL;
+  s->n_thread_rng = 0;
+  domain_free (s);
+  }
+
+
+/* Seed state with the next independent stream of the seed of s */
+void simulation_stream (struct simulation *s, struct rng *state)
+  {
+  rng_seed_stream (state, s->rng_backend, s->seed, ++s->streams);
+  }
+
+
+/* Allocate the lattice of the simulation */
+int simulation_alloc (struct simulation *s, int x_size, int y_size, int boundary)
+  {
+  size_t bytes;
+  void *lattice;
+  int halo = (boundary == BOUNDARY_PERIODIC) ? 0 : HALO;
+  if (x_size < MIN_SIZE || y_size < MIN_SIZE)
+    return -1;
+  if (boundary != BOUNDARY_PERIODIC && boundary != BOUNDARY_HALO && boundary != BOUNDARY_OPEN)
+    return -1;
+  bytes = lattice_size_bytes ((long) (x_size + 2*halo) * (long) (y_size + 2*halo));
+  if (bytes >= MMAP_THRESHOLD)
+    {
+    lattice = mmap (NULL, bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (lattice == MAP_FAILED)
+      return -1;
+#ifdef MADV_HUGEPAGE
+    madvise (lattice, bytes, MADV_HUGEPAGE);
+#endif
+    }
+  else
+    {
+    if (posix_memalign (&lattice, LATTICE_ALIGNMENT, bytes) != 0)
+      return -1;
+    memset (lattice, 0, bytes);
+    }
+  s->lattice_configuration = lattice;
+  s->lattice_bytes = bytes;
+  s->x_size = x_size;
+  s->y_size = y_size;
+  s->n_sites = (long) x_size * (long) y_size;
+  // Power-of-two sides wrap around with a mask instead of a modulo
+  s->pow2 = (x_size & (x_size - 1)) == 0 && (y_size & (y_size - 1)) == 0;
+  s->x_mask = x_size - 1;
+  s->y_mask = y_size - 1;
+  s->boundary = boundary;
+  s->halo = halo;
+  s->stride = x_size + 2*halo;
+  s->initialized = 0;
+  return 0;
+  }
+
+
+/* Boundary conditions by name: periodic, halo or open (-1 if unknown) */
+int boundary_from_name (const char *name)
+  {
+  if (strcmp (name, "periodic") == 0)
+    return BOUNDARY_PERIODIC;
+  if (strcmp (name, "halo") == 0)
+    return BOUNDARY_HALO;
+  if (strcmp (name, "open") == 0)
+    return BOUNDARY_OPEN;
+  return -1;
+  }
+
+
+/* Update schedule by name: random, checkerboard, domain, kmc or active
+   (-1 if unknown) */
+int schedule_from_name (const char *name)
+  {
+  if (strcmp (name, "random") == 0)
+    return SCHEDULE_RANDOM;
+  if (strcmp (name, "checkerboard") == 0)
+    return SCHEDULE_CHECKERBOARD;
+  if (strcmp (name, "domain") == 0)
+    return SCHEDULE_DOMAIN;
+  if (strcmp (name, "kmc") == 0)
+    return SCHEDULE_KMC;
+  if (strcmp (name, "active") == 0)
+    return SCHEDULE_ACTIVE;
+  return -1;
+  }
+
+
+/* Release the lattice of the simulation */
+void simulation_free (struct simulation *s)
+  {
+  if (s->lattice_configuration == NULL)
+    return;
+  if (s->lattice_bytes >= MMAP_THRESHOLD)
+    munmap (s->lattice_configuration, s->lattice_bytes);
+  else
+    free (s->lattice_configuration);
+  s->lattice_configuration = NULL;
+  s->lattice_bytes = 0;
+  free (s->thread_rng);
+  s->thread_rng = NULL;
+  s->n_thread_rng = 0;
+  domain_free (s);
+  kmc_free (s);
+  active_free (s);
+  multispin_free (s);
+  free (s->field_cache);
+  s->field_cache = NULL;
+  for (int level = BLOCK_COUNT_FIRST; level <= BLOCK_COUNT_LAST; level++)
+    {
+    free (s->block_counts[level]);
+    s->block_counts[level] = NULL;
+    }
+  s->initialized = 0;
+  }
+
+
+/* Allocate copy as a simulation with the parameters and lattice of s */
+int simulation_clone (struct simulation *copy, const struct simulation *s)
+  {
+  *copy = *s;
+  // The tables and generators of the engines are built again on first use
+  copy->lattice_configuration = NULL;
+  copy->thread_rng = NULL;
+  copy->n_thread_rng = 0;
+  copy->domain = NULL;
+  copy->kmc = NULL;
+  copy->active = NULL;
+  copy->multispin = NULL;
+  copy->field_cache = NULL;
+  for (int level = BLOCK_COUNT_FIRST; level <= BLOCK_COUNT_LAST; level++)
+    copy->block_counts[level] = NULL;
+  if (simulation_alloc (copy, s->x_size, s->y_size, s->boundary) != 0)
+    return -1;
+  memcpy (copy->lattice_configuration, s->lattice_configuration, s->lattice_bytes);
+  copy->initialized = s->initialized;
+  return 0;
+  }
+
+
+/* Copy every site of the inner frame of width s->halo into the halo: the
+   opposite side for periodic boundaries, vacancies for open boundaries
+   (cells at the edge of the agar plate can not colonize beyond it). */
+void halo_exchange (struct simulation *s)
+  {
+  int x, y, source_x, source_y;
+  int h = s->halo;
+  s->lattice_epoch ++;
+  if (h == 0)
+    return;
+  for (y = -h; y < s->y_size + h; y++)
+    for (x = -h; x < s->x_size + h; x++)
+      {
+      if (x >= 0 && x < s->x_size && y >= 0 && y < s->y_size)
+        continue;
+      if (s->boundary == BOUNDARY_OPEN)
+        {
+        set_site (s, site_index (s, x, y), 0);
+        continue;
+        }
+      source_x = (x + s->x_size) % s->x_size;
+      source_y = (y + s->y_size) % s->y_size;
+      set_site (s, site_index (s, x, y), get_site (s, site_index (s, source_x, source_y)));
+      }
+  }
+
+
+/* Sites of s row by row, 2 bits each: the states modulo 4, as the packed
+   layout stores them, whatever the layout of the build */
+void pack_lattice (const struct simulation *s, uint8_t *codes)
+  {
+  long p = 0;
+#if defined(CPIM_PACKED_LATTICE)
+  // Without a halo the packed lattice is already in this order
+  if (s->halo == 0)
+    {
+    memcpy (codes, s->lattice_configuration, (size_t) (s->n_sites + 3) / 4);
+    return;
+    }
+#else
+  // Rows that start on a byte of codes: 4 sites at a time (vectorizes)
+  if ((s->x_size & 3) == 0)
+    {
+    for (int y = 0; y < s->y_size; y++)
+      {
+      const site_t *row = s->lattice_configuration + site_index (s, 0, y);
+      uint8_t *out = codes + ((long) y * s->x_size >> 2);
+#pragma omp simd
+      for (int x = 0; x < s->x_size >> 2; x++)
+        out[x] = (uint8_t) ((row[4*x] & 3) | (row[4*x + 1] & 3) << 2
+                            | (row[4*x + 2] & 3) << 4 | (row[4*x + 3] & 3) << 6);
+      }
+    return;
+    }
+#endif
+  memset (codes, 0, (size_t) (s->n_sites + 3) / 4);
+  for (int y = 0; y < s->y_size; y++)
+    for (int x = 0; x < s->x_size; x++, p++)
+      codes[p >> 2] |= (uint8_t) ((get_site (s, site_index (s, x, y)) & 3) << ((p & 3) << 1));
+  }
+
+
+/* Keep the periodic halo up to date after site (x,y) changed. Random
+   sequential updates read the halo right after a write, so the ghost
+   copies of a border site are written through rather than exchanged
+   once per sweep. */
+void write_ghosts (struct simulation *s, int x, int y, int state)
+  {
+  int h = s->halo;
+  int xs[2] = {x, x}, ys[2] = {y, y};
+  int nx = 1, ny = 1;
+  if (x < h)
+    xs[nx++] = x + s->x_size;
+  else if (x >= s->x_size - h)
+    xs[nx++] = x - s->x_size;
+  if (y < h)
+    ys[ny++] = y + s->y_size;
+  else if (y >= s->y_size - h)
+    ys[ny++] = y - s->y_size;
+  for (int j = 0; j < ny; j++)
+    for (int k = 0; k < nx; k++)
+      if (j > 0 || k > 0)
+        set_site (s, site_index (s, xs[k], ys[j]), state);
+  }
+
+/* Add delta to the cached field of the Ising neighboorhood of site (x,y) */
+void update_field_cache (struct simulation *s, int x, int y, int delta)
+  {
+  int neighbors = (s->Ising_neighboorhood == 2) ? 12 : 4, nx, ny;
+  for (int k = 0; k < neighbors; k++)
+    if (lattice_neighbor (s, x, y, neighbor_offsets[k][0], neighbor_offsets[k][1], &nx, &ny))
+      s->field_cache[site_index (s, nx, ny)] += (int8_t) delta;
+  }
+
+
+int field_cache_supported (const struct simulation *s)
+  {
+  // Checkerboard threads update sites two apart, whose neighboorhoods overlap
+  if (s->schedule == SCHEDULE_RANDOM || s->schedule == SCHEDULE_DOMAIN
+      || s->schedule == SCHEDULE_ACTIVE)
+    return 0;
+  return -1;
+  }
+
+
+/* Allocate and fill the field cache if it is used and stale (the lattice
+   was rewritten or the radius changed), or drop it if it is not used */
+static void prepare_field_cache (struct simulation *s)
+  {
+  long i;
+  if (!s->use_field_cache || field_cache_supported (s) != 0)
+    {
+    free (s->field_cache);
+    s->field_cache = NULL;
+    return;
+    }
+  if (s->field_cache != NULL && s->field_cache_epoch == s->lattice_epoch
+      && s->field_cache_radius == s->Ising_neighboorhood)
+    return;
+  if (s->field_cache == NULL)
+    {
+    // Same positions as the lattice, halo included
+    s->field_cache = malloc ((size_t) s->stride * (size_t) (s->y_size + 2*s->halo));
+    if (s->field_cache == NULL)
+      return;
+    }
+  s->field_cache_epoch = s->lattice_epoch;
+  s->field_cache_radius = s->Ising_neighboorhood;
+  for (int y = 0; y < s->y_size; y++)
+    for (int x = 0; x < s->x_size; x++)
+      {
+      i = site_index (s, x, y);
+#define FIELD(wrap_mode, radius) s->field_cache[i] = (int8_t) local_field_kernel (s, x, y, i, wrap_mode, radius)
+      DISPATCH_KERNEL (s, FIELD);
+#undef FIELD
+      }
+  }
+
+
+/* Counts of a site in the block counts, by 2 bit code */
+static const uint64_t block_fields[4] =
+  {0, 1, (uint64_t) 1 << BLOCK_COUNT_BITS,
+   1 | (uint64_t) 1 << BLOCK_COUNT_BITS | (uint64_t) 1 << (2 * BLOCK_COUNT_BITS)};
+
+/* The parallel schedules change sites of the same block from different
+   threads, so the counts are atomic. A block never holds more than
+   2^(2*BLOCK_COUNT_LAST) sites, so the counts never carry into one
+   another, and adding the difference of two packed words modulo 2^64
+   moves each of them. */
+void update_block_counts (struct simulation *s, int x, int y, int old, int state)
+  {
+  uint64_t delta = block_fields[state & 3] - block_fields[old & 3];
+  for (int level = BLOCK_COUNT_FIRST; level <= s->block_count_last && s->block_counts[level] != NULL; level++)
+    atomic_fetch_add_explicit (&s->block_counts[level][(long) (y >> level) * block_count_width (s, level)
+                                                       + (x >> level)],
+                               delta, memory_order_relaxed);
+  }
+
+
+void prepare_block_counts (struct simulation *s)
+  {
+  int width, height, level, fresh = (s->block_counts_epoch == s->lattice_epoch);
+  uint64_t *row;
+  if (s->block_count_last > BLOCK_COUNT_LAST)
+    s->block_count_last = BLOCK_COUNT_LAST;
+  for (level = BLOCK_COUNT_FIRST; level <= BLOCK_COUNT_LAST; level++)
+    if (level > s->block_count_last)
+      {
+      free (s->block_counts[level]);
+      s->block_counts[level] = NULL;
+      }
+    else if (s->block_counts[level] == NULL)
+      {
+      height = (s->y_size + (1 << level) - 1) >> level;
+      s->block_counts[level] = malloc ((size_t) block_count_width (s, level) * (size_t) height
+                                       * sizeof (uint64_t));
+      fresh = 0;
+      if (s->block_counts[level] == NULL)
+        {
+        s->block_count_last = 0;
+        prepare_block_counts (s);
+        return;
+        }
+      }
+  if (s->block_count_last < BLOCK_COUNT_FIRST || fresh)
+    return;
+  // The first level from the sites, a row of blocks at a time ...
+  level = BLOCK_COUNT_FIRST;
+  width = block_count_width (s, level);
+  row = malloc ((size_t) width * sizeof (uint64_t));
+  if (row == NULL)
+    {
+    s->block_count_last = 0;
+    prepare_block_counts (s);
+    return;
+    }
+  for (int by = 0; by << level < s->y_size; by++)
+    {
+    memset (row, 0, (size_t) width * sizeof (uint64_t));
+    for (int y = by << level; y < ((by + 1) << level) && y < s->y_size; y++)
+      for (int x = 0; x < s->x_size; x++)
+        row[x >> level] += block_fields[get_site (s, site_index (s, x, y)) & 3];
+    for (int bx = 0; bx < width; bx++)
+      atomic_store_explicit (&s->block_counts[level][(long) by * width + bx], row[bx], memory_order_relaxed);
+    }
+  free (row);
+  // ... and each of the others from the (up to) four blocks below
+  for (level = BLOCK_COUNT_FIRST + 1; level <= s->block_count_last; level++)
+    {
+    int below = block_count_width (s, level - 1);
+    int below_height = (s->y_size + (1 << (level - 1)) - 1) >> (level - 1);
+    width = block_count_width (s, level);
+    height = (s->y_size + (1 << level) - 1) >> level;
+    for (int by = 0; by < height; by++)
+      for (int bx = 0; bx < width; bx++)
+        {
+        uint64_t sum = 0;
+        for (int y = 2 * by; y < 2 * by + 2 && y < below_height; y++)
+          for (int x = 2 * bx; x < 2 * bx + 2 && x < below; x++)
+            sum += atomic_load_explicit (&s->block_counts[level - 1][(long) y * below + x],
+                                         memory_order_relaxed);
+        atomic_store_explicit (&s->block_counts[level][(long) by * width + bx], sum, memory_order_relaxed);
+        }
+    }
+  s->block_counts_epoch = s->lattice_epoch;
+  }
+
+
+double local_energy (const struct simulation *s, int x, int y)
+  {
+  // Energy of site at coordinate (x,y)
+  int field = 0;
+  long i = site_index (s, x, y);
+#define FIELD(wrap_mode, radius) field = local_field_kernel (s, x, y, i, wrap_mode, radius)
+  DISPATCH_KERNEL (s, FIELD);
+#undef FIELD
+  return s->J * (double) (get_site (s, i) * field); //in kB*T units
+  }
+
+
+static inline long spin_pairs_kernel (const struct simulation *s, const int wrap_mode, const int radius)
+  {
+  long sum = 0;
+  long i;
+  int state;
+  for (int y = 0; y < s->y_size; y++)
+    for (int x = 0; x < s->x_size; x++)
+      {
+      i = site_index (s, x, y);
+      state = get_site (s, i);
+      if (state == 1 || state == -1)
+        sum += state * local_field_kernel (s, x, y, i, wrap_mode, radius);
+      }
+  return sum;
+  }
+
+double ising_energy (const struct simulation *s)
+  {
+  // Every pair is seen from both of its spins
+  long pairs = 0;
+#define PAIRS(wrap_mode, radius) pairs = spin_pairs_kernel (s, wrap_mode, radius)
+  DISPATCH_KERNEL (s, PAIRS);
+#undef PAIRS
+  return s->J * (double) pairs / 2;
+  }
+
+
+/* Flipping spin s_i in a field h costs dE = -2*J*s_i*h; s_i*h can only
+   take the 2*MAX_FIELD+1 integer values in [-MAX_FIELD, MAX_FIELD], so the
+   Metropolis acceptance exp(-dE/T) is tabulated. Must be called whenever
+   T or J change. */
+void build_boltzmann_table (struct simulation *s)
+  {
+  double energy_diff;
+  for (int k = -MAX_FIELD; k <= MAX_FIELD; k++)
+    {
+    energy_diff = -(2) * s->J * (double) k;
+    // Downhill moves are always accepted (no random number is drawn)
+    s->boltzmann[k + MAX_FIELD] = (energy_diff < 0) ? ALWAYS_ACCEPT : exp (-energy_diff/s->T);
+    s->accept_threshold[k + MAX_FIELD] = (energy_diff < 0) ? THRESHOLD_ONE + 1
+                                         : rate_threshold (s->boltzmann[k + MAX_FIELD]);
+    }
+  }
+
+
+/* Update function: one generation (x_size*y_size random site updates) */
+static inline void update_lattice_kernel (struct simulation *s, const int wrap_mode, const int radius)
+  {
+  struct rng *rng = &s->rng;
+  struct site_counts counts = {0, 0, 0, 0};
+  int random_x_coor, random_y_coor;
+  long focal;
+  prepare_rate_thresholds (s);
+  for (long site = 0; site < s->n_sites; site++)
+    {
+    /* Pick a random focal site */
+    random_x_coor = (int) draw_index (rng, s->x_size);
+    random_y_coor = (int) draw_index (rng, s->y_size);
+    focal = site_index (s, random_x_coor, random_y_coor);
+    update_site (s, rng, random_x_coor, random_y_coor, focal, &counts, wrap_mode, radius);
+    }
+  s->occupancy += counts.occupancy; s->vacancy += counts.vacancy;
+  s->up += counts.up; s->down += counts.down;
+  s->generation_time ++;
+  }
+
+
+/* One generation with the engine of the schedule; 0 on success */
+static int update_generation (struct simulation *s)
+  {
+  int multispin = s->schedule == SCHEDULE_CHECKERBOARD && s->use_multispin
+                  && multispin_supported (s) == 0;
+  int simd = !multispin && s->schedule == SCHEDULE_CHECKERBOARD && s->simd != SIMD_OFF
+             && simd_supported (s) == 0;
+  // The tables of the kmc, active and multispin engines only follow the
+  // lattice while they run: another engine makes them stale (every engine
+  // keeps the block counts)
+  if (s->engine != 3 * s->schedule + multispin + 2 * simd)
+    {
+    s->engine = 3 * s->schedule + multispin + 2 * simd;
+    s->lattice_epoch ++;
+    if (s->block_counts_epoch == s->lattice_epoch - 1)
+      s->block_counts_epoch = s->lattice_epoch;
+    }
+  prepare_field_cache (s);
+  prepare_block_counts (s);
+  if (multispin)
+    return update_lattice_multispin (s);
+  if (simd)
+    return update_lattice_simd (s);
+  if (s->schedule == SCHEDULE_CHECKERBOARD)
+    return update_lattice_checkerboard (s);
+  if (s->schedule == SCHEDULE_DOMAIN)
+    return update_lattice_domain (s);
+  if (s->schedule == SCHEDULE_KMC)
+    return update_lattice_kmc (s);
+  if (s->schedule == SCHEDULE_ACTIVE)
+    return update_lattice_active (s);
+#define SWEEP(wrap_mode, radius) update_lattice_kernel (s, wrap_mode, radius)
+  DISPATCH_KERNEL (s, SWEEP);
+#undef SWEEP
+  return 0;
+  }
+
+
+int update_lattice (struct simulation *s)
+  {
+  if (update_generation (s) != 0)
+    return -1;
+  if (s->cluster_interval > 0 && s->generation_time % s->cluster_interval == 0)
+    return cluster_update (s);
+  return 0;
+  }
+
+
+
+/* Initialize lattice according to the chosen initial condition */
+void init_lattice (struct simulation *s)
+  {
+  int random_spin;
+  int x,y;
+  int x_center = s->x_size/2, y_center = s->y_size/2;
+  /* Fill the lattice with 0s (unoccupied state) */
+  memset (s->lattice_configuration, 0, s->lattice_bytes);
+  s->occupancy = 0;
+  s->up =  0;
+  s->down = 0;
+  s->vacancy = s->n_sites;
+  switch(s->init_option)
+    {
+      case 1:
+            /* Set an occupied site in the middle of the lattice */
+            random_spin = (int) ((rng_next (&s->rng) % 2) * 2) - 1;
+            if (random_spin == 1)
+              {
+              set_site (s, site_index (s, x_center, y_center), random_spin);
+              s->up ++; s->vacancy--; s->occupancy++;
+              }
+            else if (random_spin == -1)
+              {
+              set_site (s, site_index (s, x_center, y_center), random_spin);
+              s->down ++; s->vacancy --; s->occupancy++;
+              }
+            break;
+      case 2:
+            /* Set an undifferentiated site in the middle of the lattice*/
+              set_site (s, site_index (s, x_center, y_center), 2);
+              s->vacancy--; s->occupancy++;
+
+            break;
+      case 3:
+            // Set a small (r=2) cluster with undifferentiated sites in the middle of the lattice
+           for (x = x_center - 2 ; x < x_center + 2; x++)
+                                for (y = y_center - 2; y < y_center + 2; y++)
+                                        {
+                                        set_site (s, site_index (s, x, y), 2);
+                                        s->occupancy ++; s->vacancy --;
+                                        }
+                        break;
+            break;
+      case 4:
+            for (x = x_center - 2 ; x < x_center + 2; x++)
+                                for (y = y_center - 2; y < y_center + 2; y++)
+                                    {
+                                      random_spin = (int) ((rng_next (&s->rng) % 2) * 2) - 1;
+                                      if (random_spin == 1)
+                                        {
+                                        set_site (s, site_index (s, x, y), random_spin);
+                                        s->up ++; s->vacancy--; s->occupancy++;
+                                        }
+                                        else if (random_spin == -1)
+                                           {
+                                           set_site (s, site_index (s, x, y), random_spin);
+                                           s->down ++; s->vacancy --; s->occupancy++;
+                                           }
+                                    }
+
+            break;
+      case 5:
+            // Se a lattice fully occupied with undufferenciated particels
+            for (y = 0; y < s->y_size; y++)
+               for (x = 0; x < s->x_size; x++)
+                    {
+                    set_site (s, site_index (s, x, y), 2);
+                    }
+            s->occupancy = s->n_sites; s->vacancy = 0;
+            break;
+    }
+   halo_exchange (s);
+   prepare_block_counts (s);
+   // Parameters may have been changed since the table was built
+   build_boltzmann_table (s);
+   s->initialized = 1;
+   s->generation_time = 0;
+  }
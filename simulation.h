@@ -0,0 +1,380 @@
+// Contact Process Ising Model (CPIM) simulation core.
+// This part of the code does not depend on Gtk, so it is shared by the
+// GUI (CPIM.c) and the command line batch tool (cpim_batch.c).
+
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "rng.h"
+
+/* Default lattice Size (the lattice is allocated at run time) */
+#define X_SIZE 256
+#define Y_SIZE 256
+/* Smallest lattice side we accept */
+#define MIN_SIZE 16
+
+/* Model defaults */
+// default birth/colonization rate/probability
+#define BETA  0.003
+// default mortality/extinction rate/probability
+#define DELTA  0.0001
+// default differentiation rate/probability
+#define ALPHA  0.1
+// strength of the coupling in positive terms (J =  -1*COUPLING kBT units)
+// we should have 1/2 if we do not want to douple count pairs
+// therefore
+// use a positive number!
+#define COUPLING (1)
+// default Temperature
+#define TEMPERATURE 2.269
+// default interaction radius
+#define RADIUS 1
+// default initial condition chosen
+#define INIT 1
+// default rounds per generation of the domain schedule
+#define DOMAIN_ROUNDS 4
+
+
+/* Boundary conditions (and lattice layout) */
+enum
+  {
+  BOUNDARY_PERIODIC,  /* torus: neighboors wrap around with a modulo (or mask) */
+  BOUNDARY_HALO,      /* torus on a halo-padded lattice: no modulo in the hot path */
+  BOUNDARY_OPEN       /* absorbing edges: a halo that stays vacant */
+  };
+
+/* Update schedules */
+enum
+  {
+  SCHEDULE_RANDOM,        /* random sequential (the reference dynamics) */
+  SCHEDULE_CHECKERBOARD,  /* sublattices updated in parallel (checkerboard.c) */
+  SCHEDULE_DOMAIN,        /* random sequential tiles updated in parallel (domain.c) */
+  SCHEDULE_KMC,           /* event driven, rejection free (kmc.c) */
+  SCHEDULE_ACTIVE         /* random sequential over the active sites only (active.c) */
+  };
+
+/* Kernels of the vector engine of the checkerboard schedule (simd.c) */
+enum
+  {
+  SIMD_OFF,     /* no vector engine: update_site () per site */
+  SIMD_SCALAR,  /* the scalar reference of the vector engine */
+  SIMD_AVX2,
+  SIMD_AVX512,
+  SIMD_AUTO     /* the best kernel this CPU runs */
+  };
+
+/* Width of the halo: enough for the r=2 (NNN) neighboorhood */
+#define HALO 2
+
+/* Largest local field |up - down| (the 12 sites of the NNN) */
+#define MAX_FIELD 12
+/* Entry of the Boltzmann table for moves that are always accepted */
+#define ALWAYS_ACCEPT 2.0
+
+/* Block counts (block_count_last): per square of 2^level x 2^level sites,
+   for levels BLOCK_COUNT_FIRST to at most BLOCK_COUNT_LAST, the sites whose 2 bit
+   code has bit 0 set (spins), bit 1 set (undifferentiated or down) and
+   both (down), three counts of BLOCK_COUNT_BITS to a 64 bit word */
+#define BLOCK_COUNT_FIRST 3
+#define BLOCK_COUNT_LAST 10
+#define BLOCK_COUNT_BITS 21
+
+
+/* Storage of the site states {0, -1, +1, 2}: one byte per site by default.
+   Build with -DCPIM_INT_LATTICE for the original int per site, or with
+   -DCPIM_PACKED_LATTICE for 2 bits per site (4 sites per byte).
+   Always go through get_site()/set_site() to read or write a site. */
+#if defined(CPIM_PACKED_LATTICE)
+typedef uint8_t site_t;
+#define SITE_LAYOUT "packed"
+#elif defined(CPIM_INT_LATTICE)
+typedef int site_t;
+#define SITE_LAYOUT "int"
+#else
+typedef int8_t site_t;
+#define SITE_LAYOUT "int8"
+#endif
+
+
+/* Structure with the simulation data */
+struct simulation
+  {
+  site_t *lattice_configuration; /* Store latice configuration: site (x,y) at site_index() */
+  size_t lattice_bytes;       /* Size of the lattice allocation */
+  int x_size;                 /* Lattice width */
+  int y_size;                 /* Lattice height */
+  long n_sites;               /* x_size*y_size */
+  int pow2;                   /* Are both sides powers of two? (wrap with masks) */
+  int x_mask, y_mask;         /* x_size-1, y_size-1 */
+  int boundary;               /* BOUNDARY_PERIODIC, BOUNDARY_HALO or BOUNDARY_OPEN */
+  int halo;                   /* Width of the halo around the lattice (0 for BOUNDARY_PERIODIC) */
+  int stride;                 /* Sites per stored row: x_size + 2*halo */
+  struct rng rng;             /* Generator of the simulation (see simulation_seed) */
+  int rng_backend;            /* RNG_MT64, RNG_XOSHIRO, RNG_PCG64 or RNG_PHILOX */
+  unsigned long long seed;    /* Master seed */
+  unsigned long long streams; /* Streams of the master seed handed out so far */
+  int schedule;               /* SCHEDULE_RANDOM, _CHECKERBOARD, _DOMAIN, _KMC or _ACTIVE */
+  int use_multispin;          /* Run the checkerboard schedule on bit planes (multispin.c) */
+  struct multispin *multispin;/* Bit planes of the multispin engine (built on first use) */
+  int simd;                   /* Vector engine of the checkerboard schedule: SIMD_OFF, ... (simd.c) */
+  int engine;                 /* Engine of the last generation (see update_lattice) */
+  struct rng *thread_rng;     /* One generator per thread (checkerboard schedule) */
+  int n_thread_rng;           /* Number of thread generators */
+  struct domain *domain;      /* Tiles of the domain schedule (built on first use) */
+  int domain_rounds;          /* Rounds per generation of the domain schedule */
+  struct kmc *kmc;            /* Event tables of the kmc schedule (built on first use) */
+  struct active *active;      /* Active sites of the active schedule (built on first use) */
+  int lattice_epoch;          /* Bumped when the lattice is rewritten (halo_exchange) */
+  int cluster_interval;       /* Generations between cluster steps of the spins (0: none) */
+  int use_field_cache;        /* Keep the local field of every site up to date? */
+  int8_t *field_cache;        /* Local field of each site (at site_index), or NULL */
+  int field_cache_epoch;      /* lattice_epoch and radius the cache was built for */
+  int field_cache_radius;
+  int block_count_last;       /* Keep the state counts of blocks of sites up to date, levels
+                                 BLOCK_COUNT_FIRST to this one (display), or 0 */
+  _Atomic uint64_t *block_counts[BLOCK_COUNT_LAST + 1]; /* Per level from BLOCK_COUNT_FIRST, the
+                                 blocks row by row (block_count_width a row), or NULL */
+  int block_counts_epoch;     /* lattice_epoch the counts were built for */
+  int init_option;            /* Choice of initial condition*/
+  int initialized;            /* Have we been initialized? */
+  int generation_time;        /* Generations simulated */
+  int Ising_neighboorhood;    /* Ising Neighboorhood: r=1 (NN) vs r=2 (NNN)*/
+  long occupancy;             /* Lattice occupancy */
+  long vacancy;               /* Lattice vacancy*/
+  long up;                    /* Number of spins in the up   (+1) state */
+  long down;                  /* Number of spins in the down (-1) state */
+  double birth_rate;          /* Contact Process' birth */
+  double death_rate;          /* Contact Process' death */
+  double differentiation_rate;/* Differentiation into spin state */
+  double T;                   /* Ising's temperature */
+  double J;                   /* Ising's coupling: ferro (-kB) or anti-ferro (+kB) */
+  double lamda_rate;          /* Contact-Ising Monte Carlo biass*/
+  double boltzmann[2*MAX_FIELD+1]; /* Spin flip acceptance for s_i*h in [-MAX_FIELD, MAX_FIELD] */
+  uint64_t birth_threshold;   /* Rates as integer thresholds of the raw */
+  uint64_t death_threshold;   /* generator outputs (see kernels.h) */
+  uint64_t differentiation_threshold;
+  uint64_t accept_threshold[2*MAX_FIELD+1]; /* boltzmann[] as thresholds */
+  };
+
+
+/* Bytes needed to store n sites */
+static inline size_t lattice_size_bytes (long n)
+  {
+#if defined(CPIM_PACKED_LATTICE)
+  return (size_t) (n + 3) / 4;
+#else
+  return (size_t) n * sizeof (site_t);
+#endif
+  }
+
+/* Position of site (x,y) in the lattice; -halo <= x,y < size+halo */
+static inline long site_index (const struct simulation *s, int x, int y)
+  {
+  return (long) (y + s->halo) * s->stride + (x + s->halo);
+  }
+
+/* State of site i (i = site_index (s, x, y)) */
+static inline int get_site (const struct simulation *s, long i)
+  {
+#if defined(CPIM_PACKED_LATTICE)
+  // 2 bit codes are the states modulo 4: 0, 1, 2 and 3 for -1
+  static const int8_t decode[4] = {0, 1, 2, -1};
+  return decode[(s->lattice_configuration[i >> 2] >> ((i & 3) << 1)) & 3];
+#else
+  return s->lattice_configuration[i];
+#endif
+  }
+
+/* Set the state of site i */
+static inline void set_site (struct simulation *s, long i, int state)
+  {
+#if defined(CPIM_PACKED_LATTICE)
+  int shift = (int) (i & 3) << 1;
+  site_t *byte = &s->lattice_configuration[i >> 2];
+  *byte = (site_t) ((*byte & ~(3 << shift)) | ((state & 3) << shift));
+#else
+  s->lattice_configuration[i] = (site_t) state;
+#endif
+  }
+
+
+/* Blocks of a row of the block counts of a level */
+static inline int block_count_width (const struct simulation *s, int level)
+  {
+  return (s->x_size + (1 << level) - 1) >> level;
+  }
+
+
+/* Set the default parameters of the model (does not touch the lattice);
+   the generator is seeded with the MT default seed */
+void simulation_defaults (struct simulation *s);
+
+/* Seed the generator of s with the backend s->rng_backend; the parallel
+   schedules draw their thread (or tile) generators as independent streams
+   of the same seed, so a run only depends on its seed */
+void simulation_seed (struct simulation *s, unsigned long long seed);
+
+/* Seed state with the next independent stream of the seed of s */
+void simulation_stream (struct simulation *s, struct rng *state);
+
+/* Allocate an x_size*y_size lattice (sides >= MIN_SIZE) with the given
+   boundary conditions; 0 on success */
+int simulation_alloc (struct simulation *s, int x_size, int y_size, int boundary);
+
+/* Boundary conditions by name: periodic, halo or open (-1 if unknown) */
+int boundary_from_name (const char *name);
+
+/* Can the schedule of s use the local field cache (use_field_cache)? 0 if
+   so: random, domain and active keep it, the other schedules run without */
+int field_cache_supported (const struct simulation *s);
+
+/* Allocate and fill the block counts of the levels up to block_count_last
+   if they are stale (the lattice was rewritten), and drop the others. Run
+   before every generation; the sites that change keep them up to date */
+void prepare_block_counts (struct simulation *s);
+
+/* Update schedule by name: random, checkerboard, domain, kmc or active
+   (-1 if unknown) */
+int schedule_from_name (const char *name);
+
+/* Release the lattice */
+void simulation_free (struct simulation *s);
+
+/* Allocate copy as a simulation with the parameters, generator state and
+   lattice of s (the tables of the engines are rebuilt); 0 on success */
+int simulation_clone (struct simulation *copy, const struct simulation *s);
+
+/* Refill the halo from the lattice (BOUNDARY_HALO) or with vacancies
+   (BOUNDARY_OPEN); call after writing sites directly with set_site()
+   (init_lattice does it, update_lattice keeps the halo in sync). This
+   also tells the kmc and active schedules to rebuild their tables. */
+void halo_exchange (struct simulation *s);
+
+/* Write the x_size*y_size sites of s row by row to codes, 2 bits each
+   (state & 3, 4 sites per byte, the first one in the low bits):
+   (n_sites + 3)/4 bytes, whatever the lattice layout of the build */
+void pack_lattice (const struct simulation *s, uint8_t *codes);
+
+/* Energy of site at coordinate (x,y) in kB*T units */
+double local_energy (const struct simulation *s, int x, int y);
+
+/* Ising energy of the lattice, J times the sum of s_i*s_j over the pairs of
+   spins within the Ising neighboorhood (kB units, as T) */
+double ising_energy (const struct simulation *s);
+
+/* Tabulate the spin flip acceptance: call whenever T or J change */
+void build_boltzmann_table (struct simulation *s);
+
+/* One generation: x_size*y_size site updates with the schedule of s, and a
+   cluster step of the spins every s->cluster_interval generations. 0 on
+   success, -1 if the engine or the cluster step could not allocate its
+   tables (out of memory): that step was not run in full, and the run can
+   not go on as asked */
+int update_lattice (struct simulation *s);
+
+/* Checkerboard schedule (checkerboard.c): 0 if s can use it */
+int checkerboard_supported (const struct simulation *s);
+
+/* One generation of the checkerboard schedule; 0 on success,
+   -1 as update_lattice */
+int update_lattice_checkerboard (struct simulation *s);
+
+/* Domain decomposition schedule (domain.c): 0 if s can use it */
+int domain_supported (const struct simulation *s);
+
+/* One generation of the domain decomposition schedule; 0 on success,
+   -1 as update_lattice */
+int update_lattice_domain (struct simulation *s);
+
+/* Release the tiles of the domain schedule */
+void domain_free (struct simulation *s);
+
+/* State of the tiles (generators and clocks) for checkpoints: its size in
+   bytes (0 if there are no tiles to keep), a copy of it into data, and the
+   tiles rebuilt from it (0 on success) */
+size_t domain_state_bytes (const struct simulation *s);
+void domain_state_save (const struct simulation *s, void *data);
+int domain_state_load (struct simulation *s, const void *data, size_t bytes);
+
+/* Event driven schedule (kmc.c): 0 if s can use it */
+int kmc_supported (const struct simulation *s);
+
+/* One generation (one unit of continuous time) of the event driven schedule;
+   0 on success, -1 as update_lattice (if the tables could not grow during
+   the generation, they are dropped: the events so far stand) */
+int update_lattice_kmc (struct simulation *s);
+
+/* Release the tables of the event driven schedule */
+void kmc_free (struct simulation *s);
+
+/* Mark the tables stale (the spins changed outside the schedule): they
+   are built again on next use */
+void kmc_invalidate (struct simulation *s);
+
+/* State of the tables (the order of the sites of each class) for
+   checkpoints, as the domain_state_ functions */
+size_t kmc_state_bytes (const struct simulation *s);
+void kmc_state_save (const struct simulation *s, void *data);
+int kmc_state_load (struct simulation *s, const void *data, size_t bytes);
+
+/* Multispin (bit-plane) engine of the checkerboard schedule (multispin.c):
+   0 if s can use it (the checkerboard schedule can, and the width is a
+   multiple of the number of colors) */
+int multispin_supported (const struct simulation *s);
+
+/* One generation of the checkerboard schedule on bit planes; 0 on success,
+   -1 as update_lattice */
+int update_lattice_multispin (struct simulation *s);
+
+/* Release the bit planes */
+void multispin_free (struct simulation *s);
+
+/* Mark the bit planes stale, as kmc_invalidate */
+void multispin_invalidate (struct simulation *s);
+
+/* Vector engine of the checkerboard schedule (simd.c): 0 if s can use it
+   (the checkerboard schedule can, with the int8 layout and a halo) */
+int simd_supported (const struct simulation *s);
+
+/* Does this CPU run the given SIMD_ kernel? */
+int simd_available (int kernel);
+
+/* Vector kernels by name: off, scalar, avx2, avx512 or auto (-1 if unknown) */
+int simd_from_name (const char *name);
+const char *simd_name (int kernel);
+
+/* One generation of the checkerboard schedule with the vector engine; 0 on success,
+   -1 as update_lattice */
+int update_lattice_simd (struct simulation *s);
+
+/* Cluster moves (cluster.c): 0 if s can run them */
+int cluster_supported (const struct simulation *s);
+
+/* One Swendsen-Wang step of the spins (update_lattice runs one every
+   s->cluster_interval generations); 0 on success (or nothing to do), -1
+   out of memory */
+int cluster_update (struct simulation *s);
+
+/* Active set schedule (active.c): 0 if s can use it */
+int active_supported (const struct simulation *s);
+
+/* One generation of the active set schedule; 0 on success,
+   -1 as update_lattice */
+int update_lattice_active (struct simulation *s);
+
+/* Release the active set */
+void active_free (struct simulation *s);
+
+/* State of the active set (the order of its sites) for checkpoints, as the
+   domain_state_ functions */
+size_t active_state_bytes (const struct simulation *s);
+void active_state_save (const struct simulation *s, void *data);
+int active_state_load (struct simulation *s, const void *data, size_t bytes);
+
+/* Fill the lattice according to s->init_option and reset the counters */
+void init_lattice (struct simulation *s);
+
+#endif
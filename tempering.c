@@ -0,0 +1,166 @@
+// Parallel tempering (replica exchange) of the Contact Process Ising Model.
+//
+// Near Tc single spin flips decorrelate slowly, and a run of a temperature
+// scan starts from scratch at each temperature. Here the replicas of a
+// ladder T_0 < T_1 < ... run side by side (one thread each, every replica
+// with its own lattice and generator), and every exchange_interval
+// generations the replicas at neighbooring temperatures propose to swap:
+// the replicas a (at T_k) and b (at T_k+1) exchange their temperatures with
+// probability
+//   min (1, exp ((1/T_k - 1/T_k+1) * (E_a - E_b)))
+// where E is the Ising energy of the occupied configuration (ising_energy).
+// Rounds alternate between the pairs (0,1), (2,3)... and (1,2), (3,4)...
+// This is the exact replica exchange of the pure Ising limit (no births nor
+// deaths); with the Contact Process the stationary state is not a Boltzmann
+// distribution, and the swaps are a heuristic that moves ordered domains
+// down the ladder. The per temperature acceptance tells how to space the
+// ladder: aim for 20 to 40%.
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "tempering.h"
+
+
+void tempering_free (struct tempering *t)
+  {
+  if (t->replica != NULL)
+    for (int r = 0; r < t->replicas; r++)
+      simulation_free (&t->replica[r]);
+  free (t->replica);
+  free (t->temperature);
+  free (t->slot);
+  free (t->energy);
+  free (t->proposed);
+  free (t->accepted);
+  free (t->occupancy_sum);
+  free (t->magnetization_sum);
+  free (t->energy_sum);
+  memset (t, 0, sizeof (*t));
+  }
+
+
+int tempering_alloc (struct tempering *t, const struct simulation *s, const double *temperatures,
+                     int replicas, int exchange_interval)
+  {
+  int n = replicas;
+  memset (t, 0, sizeof (*t));
+  if (replicas < 1 || exchange_interval < 1)
+    return -1;
+  for (int k = 1; k < replicas; k++)
+    if (temperatures[k] <= temperatures[k - 1])
+      return -1;
+  t->replicas = replicas;
+  t->exchange_interval = exchange_interval;
+  t->replica = calloc ((size_t) n, sizeof (struct simulation));
+  t->temperature = malloc ((size_t) n * sizeof (double));
+  t->slot = malloc ((size_t) n * sizeof (int));
+  t->energy = calloc ((size_t) n, sizeof (double));
+  t->proposed = calloc ((size_t) n, sizeof (long));
+  t->accepted = calloc ((size_t) n, sizeof (long));
+  t->occupancy_sum = calloc ((size_t) n, sizeof (double));
+  t->magnetization_sum = calloc ((size_t) n, sizeof (double));
+  t->energy_sum = calloc ((size_t) n, sizeof (double));
+  if (t->replica == NULL || t->temperature == NULL || t->slot == NULL || t->energy == NULL
+      || t->proposed == NULL || t->accepted == NULL || t->occupancy_sum == NULL
+      || t->magnetization_sum == NULL || t->energy_sum == NULL)
+    {
+    tempering_free (t);
+    return -1;
+    }
+  // The swaps draw from stream 0 of the seed, replica r is seeded from
+  // stream r+1 (as the batched replicas)
+  rng_seed_stream (&t->rng, s->rng_backend, s->seed, 0);
+  for (int r = 0; r < replicas; r++)
+    {
+    struct simulation *replica = &t->replica[r];
+    struct rng stream;
+    if (simulation_clone (replica, s) != 0)
+      {
+      tempering_free (t);
+      return -1;
+      }
+    t->temperature[r] = temperatures[r];
+    t->slot[r] = r;
+    replica->T = temperatures[r];
+    rng_seed_stream (&stream, s->rng_backend, s->seed, (uint64_t) r + 1);
+    simulation_seed (replica, rng_next (&stream));
+    init_lattice (replica);
+    }
+  return 0;
+  }
+
+
+/* One round of swaps between neighbooring temperatures */
+static void exchange (struct tempering *t)
+  {
+  int a, b;
+  double delta;
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int r = 0; r < t->replicas; r++)
+    t->energy[r] = ising_energy (&t->replica[r]);
+  for (int k = 0; k < t->replicas; k++)
+    t->energy_sum[k] += t->energy[t->slot[k]] / (double) t->replica[t->slot[k]].n_sites;
+  for (int k = t->rounds % 2; k + 1 < t->replicas; k += 2)
+    {
+    a = t->slot[k];
+    b = t->slot[k + 1];
+    delta = (1 / t->temperature[k] - 1 / t->temperature[k + 1]) * (t->energy[a] - t->energy[b]);
+    t->proposed[k] ++;
+    if (delta < 0 && (rng_next (&t->rng) >> 11) * (1.0/9007199254740992.0) >= exp (delta))
+      continue;
+    t->accepted[k] ++;
+    t->slot[k] = b;
+    t->slot[k + 1] = a;
+    t->replica[a].T = t->temperature[k + 1];
+    t->replica[b].T = t->temperature[k];
+    build_boltzmann_table (&t->replica[a]);
+    build_boltzmann_table (&t->replica[b]);
+    }
+  t->rounds ++;
+  }
+
+
+int tempering_update (struct tempering *t)
+  {
+  const struct simulation *replica;
+  int failures = 0;
+#pragma omp parallel for schedule(dynamic, 1) reduction(+:failures)
+  for (int r = 0; r < t->replicas; r++)
+    failures += update_lattice (&t->replica[r]) != 0;
+  if (failures > 0)
+    return -1;
+  t->generation_time ++;
+  for (int k = 0; k < t->replicas; k++)
+    {
+    replica = &t->replica[t->slot[k]];
+    t->occupancy_sum[k] += (double) replica->occupancy / (double) replica->n_sites;
+    if (replica->occupancy > 0)
+      t->magnetization_sum[k] += (double) labs (replica->up - replica->down) / (double) replica->occupancy;
+    }
+  t->samples ++;
+  if (t->generation_time % t->exchange_interval == 0)
+    exchange (t);
+  return 0;
+  }
+
+
+double tempering_occupancy (const struct tempering *t, int k)
+  {
+  return t->samples ? t->occupancy_sum[k] / (double) t->samples : 0;
+  }
+
+double tempering_magnetization (const struct tempering *t, int k)
+  {
+  return t->samples ? t->magnetization_sum[k] / (double) t->samples : 0;
+  }
+
+double tempering_energy (const struct tempering *t, int k)
+  {
+  return t->rounds ? t->energy_sum[k] / (double) t->rounds : 0;
+  }
+
+double tempering_acceptance (const struct tempering *t, int k)
+  {
+  return t->proposed[k] ? (double) t->accepted[k] / (double) t->proposed[k] : -1;
+  }
@@ -0,0 +1,59 @@
+// Parallel tempering (replica exchange) of the Contact Process Ising Model.
+// A ladder of temperatures, one replica (simulation) per temperature, run
+// in parallel; see tempering.c.
+
+#ifndef TEMPERING_H
+#define TEMPERING_H
+
+#include "rng.h"
+#include "simulation.h"
+
+// default generations between two rounds of swaps
+#define EXCHANGE_INTERVAL 10
+
+
+/* Replicas of a temperature ladder. Replicas keep their lattice: a swap
+   exchanges their temperatures, so slot[k] is the replica at temperature[k]. */
+struct tempering
+  {
+  int replicas;               /* Temperatures of the ladder (and replicas) */
+  struct simulation *replica; /* The replicas */
+  double *temperature;        /* The ladder, in increasing order */
+  int *slot;                  /* Replica at each temperature */
+  double *energy;             /* Ising energy of each replica at the last round of swaps */
+  int exchange_interval;      /* Generations between two rounds of swaps */
+  int generation_time;        /* Generations simulated */
+  int rounds;                 /* Rounds of swaps so far (even: pairs 0-1, 2-3...; odd: 1-2...) */
+  struct rng rng;             /* Generator of the swaps */
+  long *proposed, *accepted;  /* Swaps between temperatures k and k+1 */
+  // Sums of the observables of each temperature (averages: / samples)
+  long samples;               /* Generations summed */
+  double *occupancy_sum;      /* Occupancy / sites */
+  double *magnetization_sum;  /* |up - down| / occupancy */
+  double *energy_sum;         /* Ising energy / sites, summed at each round of swaps */
+  };
+
+
+/* Set up t with one replica of s (parameters, layout and schedule) per
+   temperature; replica r is seeded from stream r+1 of the seed of s (the
+   swaps draw from stream 0) and initialized with s->init_option. The temperatures must increase.
+   0 on success */
+int tempering_alloc (struct tempering *t, const struct simulation *s, const double *temperatures,
+                     int replicas, int exchange_interval);
+
+/* One generation of every replica (in parallel) and, every
+   exchange_interval generations, a round of swaps; 0 on success, -1 if a
+   replica could not run its generation (see update_lattice) */
+int tempering_update (struct tempering *t);
+
+/* Average observables of temperature k, and the acceptance of the swaps
+   between k and k+1 (-1 if none was proposed) */
+double tempering_occupancy (const struct tempering *t, int k);
+double tempering_magnetization (const struct tempering *t, int k);
+double tempering_energy (const struct tempering *t, int k);
+double tempering_acceptance (const struct tempering *t, int k);
+
+/* Release the replicas */
+void tempering_free (struct tempering *t);
+
+#endif